@@ -8,22 +8,28 @@ import asyncio
 import hashlib
 import json
 import os
+import re
 import shutil
+import struct
 import tempfile
 import base64
 from pathlib import Path
 from datetime import datetime, timezone
 from cryptography.hazmat.primitives import hashes, serialization
-from cryptography.hazmat.primitives.asymmetric import padding
+from cryptography.hazmat.primitives.asymmetric import ec, padding, rsa
 
 BACKEND_DIR = Path(__file__).parent
 ARTIFACTS_DIR = BACKEND_DIR / "artifacts"
 SIGNING_KEY_PATH = BACKEND_DIR / "ota_signing_key.pem"
 SIGNING_PUB_KEY_PATH = BACKEND_DIR / "ota_signing_key_pub.pem"
+# To rotate, move the old private key here before installing the new pair;
+# devices accept the new key only with its endorsement by the old one
+PREV_SIGNING_KEY_PATH = BACKEND_DIR / "ota_signing_key_prev.pem"
 
 ARTIFACTS_DIR.mkdir(exist_ok=True)
 
 BUILD_TIMEOUT = 180  # seconds
+OTA_CHUNK_SIZE = 64 * 1024  # per-chunk hashes; a multiple of the 4 KB flash sector
 MAX_LOG_LINES = 500
 PIO_CMD = "/root/.venv/bin/pio"
 
@@ -64,6 +70,37 @@ monitor_speed = {config['monitor_speed']}
     return ini
 
 
+def _app_project_name(project_name: str) -> str:
+    """CMake project name stamped into esp_app_desc_t (at most 31 chars).
+    Devices compare it in-stream, so it must be stable across builds."""
+    name = re.sub(r"[^A-Za-z0-9_]+", "_", project_name).strip("_")[:31]
+    return name or "fleet_agent"
+
+
+def _generate_project_cmake(app_project_name: str, version: str) -> str:
+    """Top-level CMakeLists.txt; without it PlatformIO names the project after
+    the (random) build directory and IDF stamps a git-describe version."""
+    return f"""cmake_minimum_required(VERSION 3.16.0)
+set(PROJECT_VER "{version}")
+include($ENV{{IDF_PATH}}/tools/cmake/project.cmake)
+project({app_project_name})
+"""
+
+
+# Component list PlatformIO would generate for src/ when it writes the project files itself
+SRC_CMAKELISTS = """\
+FILE(GLOB_RECURSE app_sources ${CMAKE_SOURCE_DIR}/src/*.*)
+idf_component_register(SRCS ${app_sources})
+"""
+
+
+# ESP-IDF options the fleet agent template relies on
+SDKCONFIG_DEFAULTS = """\
+# Offer cached TLS sessions on reconnect (http_pool.c save_client_session)
+CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS=y
+"""
+
+
 def _compute_sha256(filepath: str) -> str:
     h = hashlib.sha256()
     with open(filepath, "rb") as f:
@@ -72,20 +109,250 @@ def _compute_sha256(filepath: str) -> str:
     return h.hexdigest()
 
 
-def _sign_manifest(manifest_json: str) -> str:
-    """Sign manifest JSON with RSA private key, return base64 signature."""
-    if not SIGNING_KEY_PATH.exists():
-        return ""
-    with open(SIGNING_KEY_PATH, "rb") as f:
+# ─── Delta OTA patches ──────────────────────────────────────────────
+# Patch stream (little-endian), applied on-device by delta_patch.c:
+#   "VDP1" | u32 base_size | u32 target_size | ops... | END
+#   COPY: 0x01 u32 src_offset u32 length    (bytes from the running image)
+#   DATA: 0x02 u32 length <length bytes>    (literal bytes)
+#   END:  0x00
+# The patch is then LZSS-compressed (see _lzss_compress).
+DELTA_MAGIC = b"VDP1"
+DELTA_OP_END = 0x00
+DELTA_OP_COPY = 0x01
+DELTA_OP_DATA = 0x02
+DELTA_SEED_LEN = 16      # bytes hashed to find candidate matches
+DELTA_INDEX_STRIDE = 16  # only every Nth base offset is indexed; matches
+                         # found there are extended backward
+DELTA_MIN_COPY = 24      # shorter matches are cheaper as literals
+
+# heatshrink-compatible LZSS parameters; must match lzss_stream.c callers
+LZSS_WINDOW_BITS = 10
+LZSS_LOOKAHEAD_BITS = 5
+LZSS_MIN_MATCH = 3
+LZSS_CHAIN_DEPTH = 32
+
+
+def _match_len(a: bytes, a_off: int, b: bytes, b_off: int) -> int:
+    limit = min(len(a) - a_off, len(b) - b_off)
+    n = 0
+    while n + 64 <= limit and a[a_off + n:a_off + n + 64] == b[b_off + n:b_off + n + 64]:
+        n += 64
+    while n < limit and a[a_off + n] == b[b_off + n]:
+        n += 1
+    return n
+
+
+def _make_delta_patch(base: bytes, target: bytes) -> bytes:
+    """Greedy COPY/DATA patch that rebuilds `target` from `base`."""
+    # A common run of DELTA_SEED_LEN + DELTA_INDEX_STRIDE - 1 bytes or more
+    # always covers an indexed seed
+    index = {}
+    for off in range(0, len(base) - DELTA_SEED_LEN + 1, DELTA_INDEX_STRIDE):
+        index.setdefault(base[off:off + DELTA_SEED_LEN], off)
+
+    patch = bytearray(DELTA_MAGIC + struct.pack("<II", len(base), len(target)))
+    literal = bytearray()
+
+    def flush_literal():
+        if literal:
+            patch.extend(struct.pack("<BI", DELTA_OP_DATA, len(literal)))
+            patch.extend(literal)
+            literal.clear()
+
+    i = 0
+    expect = 0  # source offset that continues the previous copy
+    while i < len(target):
+        best_src, best_len, best_back = -1, 0, 0
+        for cand in (expect, index.get(target[i:i + DELTA_SEED_LEN])):
+            if cand is None or cand >= len(base):
+                continue
+            n = _match_len(base, cand, target, i)
+            # Take back pending literal bytes that the match also covers
+            back = 0
+            while back < len(literal) and back < cand and base[cand - back - 1] == target[i - back - 1]:
+                back += 1
+            if n + back > best_len:
+                best_src, best_len, best_back = cand - back, n + back, back
+        if best_len >= DELTA_MIN_COPY:
+            del literal[len(literal) - best_back:]
+            flush_literal()
+            patch.extend(struct.pack("<BII", DELTA_OP_COPY, best_src, best_len))
+            i += best_len - best_back
+            expect = best_src + best_len
+        else:
+            literal.append(target[i])
+            i += 1
+            expect += 1
+    flush_literal()
+    patch.append(DELTA_OP_END)
+    return bytes(patch)
+
+
+def _lzss_compress(data: bytes, window_bits: int = LZSS_WINDOW_BITS,
+                   lookahead_bits: int = LZSS_LOOKAHEAD_BITS) -> bytes:
+    """heatshrink-format LZSS encoder (MSB-first bits, 1=literal, 0=backref)."""
+    window = 1 << window_bits
+    max_len = 1 << lookahead_bits
+    out = bytearray()
+    acc = 0
+    nbits = 0
+
+    def put(value, count):
+        nonlocal acc, nbits
+        acc = (acc << count) | value
+        nbits += count
+        while nbits >= 8:
+            nbits -= 8
+            out.append((acc >> nbits) & 0xFF)
+        acc &= (1 << nbits) - 1
+
+    chains = {}
+    i, n = 0, len(data)
+    while i < n:
+        best_len, best_off = 0, 0
+        limit = min(max_len, n - i)
+        for p in reversed(chains.get(data[i:i + LZSS_MIN_MATCH], [])[-LZSS_CHAIN_DEPTH:]):
+            if i - p > window:
+                break
+            m = LZSS_MIN_MATCH
+            while m < limit and data[p + m] == data[i + m]:
+                m += 1
+            if m > best_len:
+                best_len, best_off = m, i - p
+                if m == limit:
+                    break
+        if best_len >= LZSS_MIN_MATCH:
+            put(0, 1)
+            put(best_off - 1, window_bits)
+            put(best_len - 1, lookahead_bits)
+            step = best_len
+        else:
+            put(1, 1)
+            put(data[i], 8)
+            step = 1
+        for j in range(i, min(i + step, n - LZSS_MIN_MATCH + 1)):
+            chain = chains.setdefault(data[j:j + LZSS_MIN_MATCH], [])
+            chain.append(j)
+            if len(chain) > 4 * LZSS_CHAIN_DEPTH:
+                del chain[:-LZSS_CHAIN_DEPTH]
+        i += step
+    if nbits:
+        out.append((acc << (8 - nbits)) & 0xFF)
+    return bytes(out)
+
+
+def _generate_delta(build_id: str, firmware_path: str, base_build: dict):
+    """Write a compressed patch from base_build's artifact to this firmware.
+    Returns the manifest "delta" entry, or None if no usable base exists."""
+    base_file = (base_build or {}).get("artifact_file", "")
+    if not base_file or not (ARTIFACTS_DIR / base_file).exists():
+        return None
+    base = (ARTIFACTS_DIR / base_file).read_bytes()
+    with open(firmware_path, "rb") as f:
+        target = f.read()
+    if base == target:
+        return None
+    patch = _lzss_compress(_make_delta_patch(base, target))
+    if len(patch) >= len(target):
+        return None
+    patch_filename = f"{build_id}_delta_{base_build['id'][:8]}.vdp"
+    (ARTIFACTS_DIR / patch_filename).write_bytes(patch)
+    return {
+        "base_build_id": base_build["id"],
+        "base_hash": hashlib.sha256(base).hexdigest(),
+        "base_size": len(base),
+        "patch_file": patch_filename,
+        "patch_size": len(patch),
+        "patch_hash_sha256": hashlib.sha256(patch).hexdigest(),
+        "compression": f"heatshrink-w{LZSS_WINDOW_BITS}-l{LZSS_LOOKAHEAD_BITS}",
+    }
+
+
+def _generate_compressed(build_id: str, firmware_path: str):
+    """Write an LZSS-compressed copy of the artifact for bandwidth-light OTA.
+    Returns the manifest "compressed" entry, or None if it does not help."""
+    with open(firmware_path, "rb") as f:
+        image = f.read()
+    packed = _lzss_compress(image)
+    if len(packed) >= len(image):
+        return None
+    packed_filename = f"{build_id}.bin.hs"
+    (ARTIFACTS_DIR / packed_filename).write_bytes(packed)
+    return {
+        "file": packed_filename,
+        "size": len(packed),
+        "hash_sha256": hashlib.sha256(packed).hexdigest(),
+        "compression": f"heatshrink-w{LZSS_WINDOW_BITS}-l{LZSS_LOOKAHEAD_BITS}",
+    }
+
+
+def _chunk_hashes(firmware_path: str) -> dict:
+    """Hash the image in OTA_CHUNK_SIZE chunks for early on-device verification.
+    The root is the SHA-256 of the concatenated binary digests, in order."""
+    digests = []
+    with open(firmware_path, "rb") as f:
+        for chunk in iter(lambda: f.read(OTA_CHUNK_SIZE), b""):
+            digests.append(hashlib.sha256(chunk).digest())
+    root = hashlib.sha256(b"".join(digests)).hexdigest()
+    return {
+        "size": OTA_CHUNK_SIZE,
+        "count": len(digests),
+        "hashes": [d.hex() for d in digests],
+        "root": root,
+        "root_signature": _sign_manifest(root),
+    }
+
+
+def _load_signing_key(path: Path = SIGNING_KEY_PATH):
+    """The fleet signing key: RSA or ECDSA P-256.
+
+    RSA-2048 is the cheaper to verify on-device: the ESP32-C3 accelerates
+    RSA and has no ECC accelerator (tests/bench_manifest_verify.py). P-256
+    buys a smaller key and signature (91 B / 71 B against 294 B / 256 B).
+    """
+    if not path.exists():
+        return None
+    with open(path, "rb") as f:
         private_key = serialization.load_pem_private_key(f.read(), password=None)
-    signature = private_key.sign(
-        manifest_json.encode(),
-        padding.PKCS1v15(),
-        hashes.SHA256(),
-    )
+    if isinstance(private_key, ec.EllipticCurvePrivateKey):
+        if not isinstance(private_key.curve, ec.SECP256R1):
+            raise ValueError("OTA signing key must be ECDSA P-256 or RSA")
+    elif not isinstance(private_key, rsa.RSAPrivateKey):
+        raise ValueError("OTA signing key must be ECDSA P-256 or RSA")
+    return private_key
+
+
+def signature_alg() -> str:
+    """Algorithm manifests are signed with, as advertised in them ("" = unsigned)."""
+    private_key = _load_signing_key()
+    if private_key is None:
+        return ""
+    if isinstance(private_key, ec.EllipticCurvePrivateKey):
+        return "ecdsa-p256-sha256"
+    return "rsa-pkcs1v15-sha256"
+
+
+def _sign(data: bytes, private_key) -> str:
+    """SHA-256 signature of `data`, base64 (DER for ECDSA)."""
+    if isinstance(private_key, ec.EllipticCurvePrivateKey):
+        signature = private_key.sign(data, ec.ECDSA(hashes.SHA256()))
+    else:
+        signature = private_key.sign(
+            data,
+            padding.PKCS1v15(),
+            hashes.SHA256(),
+        )
     return base64.b64encode(signature).decode()
 
 
+def _sign_manifest(manifest_json: str) -> str:
+    """Sign manifest JSON with the signing key, return base64 signature (DER for ECDSA)."""
+    private_key = _load_signing_key()
+    if private_key is None:
+        return ""
+    return _sign(manifest_json.encode(), private_key)
+
+
 def get_public_key_pem() -> str:
     """Return the public key PEM for verification on ESP32."""
     if not SIGNING_PUB_KEY_PATH.exists():
@@ -93,8 +360,39 @@ def get_public_key_pem() -> str:
     return SIGNING_PUB_KEY_PATH.read_text()
 
 
+def get_public_key_der() -> bytes:
+    """Return the public key as DER SubjectPublicKeyInfo (what devices cache)."""
+    pem = get_public_key_pem()
+    if not pem:
+        return b""
+    key = serialization.load_pem_public_key(pem.encode())
+    return key.public_bytes(serialization.Encoding.DER,
+                            serialization.PublicFormat.SubjectPublicKeyInfo)
+
+
+def get_public_key_endorsement() -> str:
+    """Signature of the public key DER by the previous signing key ("" = no rotation)."""
+    prev_key = _load_signing_key(PREV_SIGNING_KEY_PATH)
+    der = get_public_key_der()
+    if prev_key is None or not der:
+        return ""
+    return _sign(der, prev_key)
+
+
+def get_signing_key_id() -> str:
+    """Short fingerprint of the public key; devices refetch the key when it changes."""
+    der = get_public_key_der()
+    return hashlib.sha256(der).hexdigest()[:16] if der else ""
+
+
+def canonical_manifest(manifest: dict) -> str:
+    """The exact text the manifest signature covers."""
+    return json.dumps({k: v for k, v in manifest.items() if k != "signature"}, sort_keys=True)
+
+
 async def real_build_process(build_id: str, project_files: list, board_type: str,
-                              version: str, db, on_log=None):
+                              version: str, db, on_log=None, base_build: dict = None,
+                              project_name: str = ""):
     """
     Execute a real PlatformIO build in an isolated temp directory.
     
@@ -105,6 +403,8 @@ async def real_build_process(build_id: str, project_files: list, board_type: str
         version: Semantic version string
         db: MongoDB database reference
         on_log: Optional callback for log lines
+        base_build: Currently deployed build of this project (delta OTA base)
+        project_name: Project name; stamped (sanitized) into the app descriptor
     
     Returns:
         dict with build result info
@@ -137,6 +437,15 @@ async def real_build_process(build_id: str, project_files: list, board_type: str
             f.write(ini_content)
         await add_log("platformio.ini generated")
 
+        with open(os.path.join(build_dir, "sdkconfig.defaults"), "w") as f:
+            f.write(SDKCONFIG_DEFAULTS)
+
+        # Stamp project name and version into esp_app_desc_t for on-device checks
+        app_project = _app_project_name(project_name)
+        with open(os.path.join(build_dir, "CMakeLists.txt"), "w") as f:
+            f.write(_generate_project_cmake(app_project, version))
+        await add_log(f"App descriptor: project {app_project}, version {version}")
+
         # Step 3: Write source files
         src_dir = os.path.join(build_dir, "src")
         os.makedirs(src_dir, exist_ok=True)
@@ -160,6 +469,9 @@ async def real_build_process(build_id: str, project_files: list, board_type: str
             file_count += 1
             await add_log(f"  + {safe_name} ({len(content)} bytes)")
 
+        if not os.path.exists(os.path.join(src_dir, "CMakeLists.txt")):
+            with open(os.path.join(src_dir, "CMakeLists.txt"), "w") as f:
+                f.write(SRC_CMAKELISTS)
         await add_log(f"{file_count} source file(s) written")
 
         # Step 4: Run PlatformIO build with timeout
@@ -240,6 +552,23 @@ async def real_build_process(build_id: str, project_files: list, board_type: str
         shutil.copy2(firmware_path, str(artifact_dest))
         await add_log(f"Artifact stored: {artifact_filename}")
 
+        # Step 7a: Compressed artifact for streaming decompression on-device
+        compressed = await asyncio.to_thread(_generate_compressed, build_id, firmware_path)
+        if compressed:
+            await add_log(f"Compressed artifact: {compressed['file']} "
+                          f"({compressed['size']} bytes, {compressed['size'] * 100 / fw_size:.1f}%)")
+
+        # Step 7b: Delta patch against the currently deployed build
+        delta = await asyncio.to_thread(_generate_delta, build_id, firmware_path, base_build)
+        if delta:
+            await add_log(f"Delta patch vs {delta['base_build_id'][:8]}: "
+                          f"{delta['patch_size']} bytes ({delta['patch_size'] * 100 / fw_size:.1f}% of full image)")
+
+        # Step 7c: Per-chunk hashes so devices catch corruption early
+        chunks = await asyncio.to_thread(_chunk_hashes, firmware_path)
+        await add_log(f"Chunk hashes: {chunks['count']} x {OTA_CHUNK_SIZE // 1024} KB, "
+                      f"root {chunks['root'][:16]}...")
+
         # Step 8: Generate signed OTA manifest
         manifest = {
             "build_id": build_id,
@@ -248,17 +577,25 @@ async def real_build_process(build_id: str, project_files: list, board_type: str
             "artifact_file": artifact_filename,
             "artifact_size": fw_size,
             "artifact_hash_sha256": fw_hash,
+            "chunks": chunks,
+            "app_project_name": app_project,
             "built_at": datetime.now(timezone.utc).isoformat(),
         }
-        manifest_json = json.dumps(manifest, sort_keys=True)
-        signature = _sign_manifest(manifest_json)
+        alg = signature_alg()
+        if alg:
+            manifest["signature_alg"] = alg
+        if compressed:
+            manifest["compressed"] = compressed
+        if delta:
+            manifest["delta"] = delta
+        signature = _sign_manifest(canonical_manifest(manifest))
         manifest["signature"] = signature
 
         manifest_filename = f"{build_id}_manifest.json"
         manifest_path = ARTIFACTS_DIR / manifest_filename
         with open(manifest_path, "w") as f:
             json.dump(manifest, f, indent=2)
-        await add_log(f"Signed OTA manifest generated: {manifest_filename}")
+        await add_log(f"Signed OTA manifest generated: {manifest_filename} ({alg or 'unsigned'})")
 
         # Step 9: Extract memory usage from logs
         ram_usage = ""
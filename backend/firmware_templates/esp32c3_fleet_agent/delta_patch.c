@@ -0,0 +1,147 @@
+/**
+ * Delta Patch — Implementation
+ * Format (little-endian):
+ *   "VDP1" | u32 source_size | u32 target_size | ops...
+ *   0x01 COPY  u32 src_offset u32 length
+ *   0x02 DATA  u32 length, then <length> literal bytes
+ *   0x00 END
+ */
+
+#include "delta_patch.h"
+
+#include <string.h>
+
+#define DELTA_MAGIC    "VDP1"
+#define DELTA_OP_END   0x00
+#define DELTA_OP_COPY  0x01
+#define DELTA_OP_DATA  0x02
+
+enum {
+    DP_HEADER,
+    DP_OPCODE,
+    DP_COPY_ARGS,
+    DP_DATA_LEN,
+    DP_DATA,
+    DP_DONE,
+};
+
+/* ── Helpers ──────────────────────────────────────────────────── */
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool fail(delta_patch_t *dp)
+{
+    dp->error = true;
+    return false;
+}
+
+static void expect_field(delta_patch_t *dp, uint8_t state, uint8_t len)
+{
+    dp->state      = state;
+    dp->field_len  = 0;
+    dp->field_need = len;
+}
+
+static bool do_copy(delta_patch_t *dp, uint32_t offset, uint32_t len)
+{
+    if (offset > dp->source_size || len > dp->source_size - offset ||
+        len > dp->target_size - dp->written) {
+        return fail(dp);
+    }
+    while (len > 0) {
+        size_t n = len < sizeof(dp->scratch) ? len : sizeof(dp->scratch);
+        if (!dp->read_source(dp->user, offset, dp->scratch, n) ||
+            !dp->write_target(dp->user, dp->scratch, n)) {
+            return fail(dp);
+        }
+        offset      += n;
+        len         -= n;
+        dp->written += n;
+    }
+    return true;
+}
+
+/* A fixed-size field has been collected — act on it */
+static bool field_complete(delta_patch_t *dp)
+{
+    switch (dp->state) {
+    case DP_HEADER:
+        if (memcmp(dp->field, DELTA_MAGIC, 4) != 0) return fail(dp);
+        dp->source_size = get_u32(dp->field + 4);
+        dp->target_size = get_u32(dp->field + 8);
+        expect_field(dp, DP_OPCODE, 1);
+        return true;
+
+    case DP_OPCODE:
+        switch (dp->field[0]) {
+        case DELTA_OP_END:  dp->state = DP_DONE; dp->done = true; return true;
+        case DELTA_OP_COPY: expect_field(dp, DP_COPY_ARGS, 8);    return true;
+        case DELTA_OP_DATA: expect_field(dp, DP_DATA_LEN, 4);     return true;
+        default:            return fail(dp);
+        }
+
+    case DP_COPY_ARGS:
+        if (!do_copy(dp, get_u32(dp->field), get_u32(dp->field + 4))) return false;
+        expect_field(dp, DP_OPCODE, 1);
+        return true;
+
+    case DP_DATA_LEN:
+        dp->data_left = get_u32(dp->field);
+        if (dp->data_left > dp->target_size - dp->written) return fail(dp);
+        if (dp->data_left) {
+            dp->state = DP_DATA;
+        } else {
+            expect_field(dp, DP_OPCODE, 1);
+        }
+        return true;
+
+    default:
+        return fail(dp);
+    }
+}
+
+/* ── Public API ───────────────────────────────────────────────── */
+
+void delta_patch_init(delta_patch_t *dp, delta_read_fn read_source,
+                      delta_write_fn write_target, void *user)
+{
+    memset(dp, 0, sizeof(*dp));
+    dp->read_source  = read_source;
+    dp->write_target = write_target;
+    dp->user         = user;
+    expect_field(dp, DP_HEADER, 12);
+}
+
+bool delta_patch_feed(delta_patch_t *dp, const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && !dp->error) {
+        if (dp->state == DP_DONE) {
+            return fail(dp);   /* data after END */
+        }
+        if (dp->state == DP_DATA) {
+            size_t n = len - i;
+            if (n > dp->data_left) n = dp->data_left;
+            if (!dp->write_target(dp->user, data + i, n)) return fail(dp);
+            dp->written   += n;
+            dp->data_left -= n;
+            i += n;
+            if (dp->data_left == 0) expect_field(dp, DP_OPCODE, 1);
+            continue;
+        }
+        dp->field[dp->field_len++] = data[i++];
+        if (dp->field_len == dp->field_need) {
+            field_complete(dp);
+        }
+    }
+    return !dp->error;
+}
+
+bool delta_patch_finish(const delta_patch_t *dp)
+{
+    return dp->done && !dp->error && dp->written == dp->target_size;
+}
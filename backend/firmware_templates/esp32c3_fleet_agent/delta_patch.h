@@ -0,0 +1,56 @@
+/**
+ * Delta Patch — Header
+ * Streaming applier for the COPY/DATA patch format emitted by
+ * build_service.py. Source reads and target writes go through
+ * callbacks, so the same code runs against flash partitions on the
+ * device and against plain files on a host.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DELTA_PATCH_SCRATCH  256   /* bytes per source read during COPY */
+
+typedef bool (*delta_read_fn)(void *user, uint32_t offset, uint8_t *buf, size_t len);
+typedef bool (*delta_write_fn)(void *user, const uint8_t *data, size_t len);
+
+typedef struct {
+    delta_read_fn  read_source;
+    delta_write_fn write_target;
+    void          *user;
+
+    uint32_t source_size;
+    uint32_t target_size;
+    uint32_t written;
+
+    uint8_t  state;
+    uint8_t  field[12];        /* header / op arguments being collected */
+    uint8_t  field_len;
+    uint8_t  field_need;
+    uint32_t data_left;        /* literal bytes still to pass through   */
+    bool     done;
+    bool     error;
+
+    uint8_t  scratch[DELTA_PATCH_SCRATCH];
+} delta_patch_t;
+
+/**
+ * Prepare an applier. The patch header is validated on the first feed.
+ */
+void delta_patch_init(delta_patch_t *dp, delta_read_fn read_source,
+                      delta_write_fn write_target, void *user);
+
+/**
+ * Apply the next chunk of (decompressed) patch data.
+ * @return false on malformed patch or callback failure.
+ */
+bool delta_patch_feed(delta_patch_t *dp, const uint8_t *data, size_t len);
+
+/**
+ * @return true if the END op was reached and exactly target_size bytes
+ *         were produced.
+ */
+bool delta_patch_finish(const delta_patch_t *dp);
@@ -7,6 +7,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
@@ -17,6 +18,9 @@
 #include "nvs.h"
 
 #include "wifi_manager.h"
+#include "ota_manager.h"
+#include "http_pool.h"
+#include "peer_cache.h"
 
 static const char *TAG = "DEV_AGENT";
 
@@ -34,29 +38,30 @@ static const char *TAG = "DEV_AGENT";
 
 static char s_device_id[64] = {0};
 static int64_t s_boot_time_us = 0;
+static int s_ota_progress = -1;   /* percent, -1 = no download running */
 
 /* ── Helpers ──────────────────────────────────────────────────── */
 
-static void http_post_json(const char *path, const char *json_body)
+/* @return the response's Retry-After in seconds (0 if none), -1 on failure */
+static int http_post_json(const char *path, const char *json_body)
 {
     char url[256];
     snprintf(url, sizeof(url), "%s%s", OTA_SERVER_BASE_URL, path);
 
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_POST,
-        .timeout_ms = 10000,
-    };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    esp_http_client_handle_t client = http_pool_acquire(url, HTTP_POOL_CONTROL, HTTP_METHOD_POST, 10000);
+    if (!client) return -1;
     esp_http_client_set_header(client, "Content-Type", "application/json");
     esp_http_client_set_post_field(client, json_body, strlen(json_body));
 
-    esp_err_t err = esp_http_client_perform(client);
+    char retry_after[12] = "";
+    http_pool_capture_header(client, "Retry-After", retry_after, sizeof(retry_after));
+
+    esp_err_t err = http_pool_perform(client);
     if (err != ESP_OK) {
         ESP_LOGW(TAG, "HTTP POST %s failed: %s", path, esp_err_to_name(err));
     }
-    esp_http_client_cleanup(client);
+    http_pool_release(client, err == ESP_OK);
+    return err == ESP_OK ? atoi(retry_after) : -1;
 }
 
 /* ── Public API ───────────────────────────────────────────────── */
@@ -86,32 +91,86 @@ const char* device_agent_get_id(void)
     return s_device_id;
 }
 
-void device_agent_send_heartbeat(const char *firmware_version)
+int device_agent_send_heartbeat(const char *firmware_version,
+                                ota_update_info_t *out_info,
+                                ota_check_result_t *out_check)
 {
+    *out_check = OTA_CHECK_ERROR;
+
     int rssi = wifi_manager_get_rssi();
     uint32_t free_heap = esp_get_free_heap_size();
     int64_t uptime_us = esp_timer_get_time() - s_boot_time_us;
     uint32_t uptime_sec = (uint32_t)(uptime_us / 1000000);
 
-    char body[512];
+    http_pool_stats_t pool;
+    http_pool_get_stats(&pool);
+
+    /* Announce the LAN peer cache so the server can offer it to the site */
+    char peer_url[32] = "", peer_blob[OTA_MAX_HASH_LEN] = "";
+    peer_cache_advert(peer_url, sizeof(peer_url), peer_blob, sizeof(peer_blob));
+
+    char body[640];
     snprintf(body, sizeof(body),
         "{"
         "\"device_id\":\"%s\","
         "\"firmware_version\":\"%s\","
         "\"rssi\":%d,"
         "\"free_heap\":%lu,"
-        "\"uptime\":%lu"
+        "\"uptime\":%lu,"
+        "\"conn_hits\":%lu,"
+        "\"conn_misses\":%lu,"
+        "\"conn_handshakes\":%lu,"
+        "\"tls_full\":%lu,"
+        "\"tls_offered\":%lu,"
+        "\"ota_progress\":%d,"
+        "\"peer_url\":\"%s\","
+        "\"peer_blob\":\"%s\""
         "}",
         s_device_id,
         firmware_version,
         rssi,
         (unsigned long)free_heap,
-        (unsigned long)uptime_sec);
+        (unsigned long)uptime_sec,
+        (unsigned long)pool.hits,
+        (unsigned long)pool.misses,
+        (unsigned long)pool.handshakes,
+        (unsigned long)pool.tls_full,
+        (unsigned long)pool.tls_offered,
+        s_ota_progress,
+        peer_url,
+        peer_blob);
 
     ESP_LOGI(TAG, "Heartbeat: RSSI=%d, heap=%lu, uptime=%lus",
              rssi, (unsigned long)free_heap, (unsigned long)uptime_sec);
 
-    http_post_json("/api/telemetry/heartbeat", body);
+    /* The reply doubles as an OTA check, so read it instead of
+     * http_post_json()'s fire-and-forget */
+    char url[256];
+    snprintf(url, sizeof(url), "%s/api/telemetry/heartbeat", OTA_SERVER_BASE_URL);
+    esp_http_client_handle_t client = http_pool_acquire(url, HTTP_POOL_CONTROL, HTTP_METHOD_POST, 10000);
+    if (!client) return -1;
+    esp_http_client_set_header(client, "Content-Type", "application/json");
+
+    char retry_after[12] = "";
+    http_pool_capture_header(client, "Retry-After", retry_after, sizeof(retry_after));
+
+    int64_t content_len = http_pool_request(client, body, strlen(body));
+    if (content_len < 0) {
+        ESP_LOGW(TAG, "Heartbeat failed");
+        http_pool_release(client, false);
+        return -1;
+    }
+    if (esp_http_client_get_status_code(client) == 200) {
+        *out_check = ota_manager_read_check_response(client, content_len, out_info);
+    } else {
+        http_pool_release(client, true);
+    }
+    return atoi(retry_after);
+}
+
+void device_agent_set_ota_progress(int percent)
+{
+    s_ota_progress = percent;
 }
 
 void device_agent_report_status(const char *status)
@@ -127,6 +186,41 @@ void device_agent_report_ota_status(const char *status)
         "/api/ota/report?device_id=%s&status=%s&version=",
         s_device_id, status);
 
+    /* Attach phase timings once the attempt they describe has ended */
+    char body[768] = "{}";
+    ota_timings_t t;
+    if (ota_manager_take_timings(&t)) {
+        snprintf(body, sizeof(body),
+            "{\"timings\":{"
+            "\"method\":\"%s\","
+            "\"connect_ms\":%lu,\"first_byte_ms\":%lu,\"receive_ms\":%lu,\"throttle_ms\":%lu,"
+            "\"flash_read_ms\":%lu,\"flash_erase_ms\":%lu,\"flash_write_ms\":%lu,"
+            "\"hash_ms\":%lu,\"image_verify_ms\":%lu,\"set_boot_ms\":%lu,\"manifest_ms\":%lu,"
+            "\"probe_ms\":%lu,"
+            "\"preerase_saved_ms\":%lu,\"total_ms\":%lu,"
+            "\"bytes_received\":%lu,\"image_bytes\":%lu,"
+            "\"sectors_programmed\":%lu,\"sectors_skipped\":%lu,"
+            "\"rate_limit_bps\":%lu,\"chunk_retries\":%lu,"
+            "\"stall_aborts\":%lu,\"min_window_bps\":%lu,\"mirror_switches\":%lu"
+            "}}",
+            t.method,
+            (unsigned long)t.connect_ms, (unsigned long)t.first_byte_ms,
+            (unsigned long)t.receive_ms, (unsigned long)t.throttle_ms,
+            (unsigned long)t.flash_read_ms, (unsigned long)t.flash_erase_ms,
+            (unsigned long)t.flash_write_ms, (unsigned long)t.hash_ms,
+            (unsigned long)t.image_verify_ms, (unsigned long)t.set_boot_ms,
+            (unsigned long)t.manifest_ms, (unsigned long)t.probe_ms,
+            (unsigned long)t.preerase_saved_ms, (unsigned long)t.total_ms,
+            (unsigned long)t.bytes_received, (unsigned long)t.image_bytes,
+            (unsigned long)t.sectors_programmed, (unsigned long)t.sectors_skipped,
+            (unsigned long)t.rate_limit_bps, (unsigned long)t.chunk_retries,
+            (unsigned long)t.stall_aborts, (unsigned long)t.min_window_bps,
+            (unsigned long)t.mirror_switches);
+        ESP_LOGI(TAG, "OTA timings: total=%lums receive=%lums write=%lums",
+                 (unsigned long)t.total_ms, (unsigned long)t.receive_ms,
+                 (unsigned long)t.flash_write_ms);
+    }
+
     ESP_LOGI(TAG, "OTA status: %s", status);
-    http_post_json(url, "{}");
+    http_post_json(url, body);
 }
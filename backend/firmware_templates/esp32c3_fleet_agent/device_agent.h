@@ -6,6 +6,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include "ota_manager.h"
 
 /**
  * Initialize device agent (loads device_id from NVS or generates new).
@@ -20,8 +21,21 @@ const char* device_agent_get_id(void);
 /**
  * Send telemetry heartbeat to server.
  * Reports: RSSI, free_heap, uptime, firmware_version.
+ * The reply doubles as an OTA check: `out_check` gets OTA_UPDATE_AVAILABLE
+ * (with `out_info` filled) or OTA_NO_UPDATE, and OTA_CHECK_ERROR when the
+ * heartbeat failed or the server did not include a check answer.
+ * @return Seconds the server asked to wait before the next heartbeat
+ *         (Retry-After), 0 if none, -1 if the heartbeat failed.
  */
-void device_agent_send_heartbeat(const char *firmware_version);
+int device_agent_send_heartbeat(const char *firmware_version,
+                                ota_update_info_t *out_info,
+                                ota_check_result_t *out_check);
+
+/**
+ * Set the download progress (percent) carried by following heartbeats;
+ * -1 once no download is running.
+ */
+void device_agent_set_ota_progress(int percent);
 
 /**
  * Report device online/offline status.
@@ -29,6 +43,8 @@ void device_agent_send_heartbeat(const char *firmware_version);
 void device_agent_report_status(const char *status);
 
 /**
- * Report OTA progress status (downloading, applied, success, failed).
+ * Report OTA progress status (downloading, staged, applied, success, failed,
+ * interrupted, cancelled). Carries the OTA phase timings when an
+ * attempt just ended.
  */
 void device_agent_report_ota_status(const char *status);
@@ -0,0 +1,335 @@
+/**
+ * HTTP Pool — Implementation
+ * Each origin (scheme://host[:port]) and lane gets one lazily created
+ * client whose connection stays open between borrows. A borrow that
+ * connected counts as a miss, one that rode an open connection as a hit.
+ * When the table is full, the least recently used idle bulk client of an
+ * origin other than the server's (mirrors come and go with deployments)
+ * is closed to make room. Mirror connections only live while a download
+ * is running: outside one, a mirror borrow is closed on release, and
+ * http_pool_download_end() frees the idle mirror clients it leaves.
+ *
+ * TLS resumption relies on esp_http_client's save_client_session (needs
+ * CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS): the session from a client's
+ * first handshake is offered on its later connects. mbedTLS does not
+ * report whether the server accepted it, so tls_offered counts offers.
+ */
+
+#include "http_pool.h"
+
+#include <string.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "HTTP_POOL";
+
+typedef struct {
+    const char *name;
+    char       *buf;
+    size_t      size;
+} header_capture_t;
+
+typedef struct {
+    char                     origin[96];
+    http_pool_lane_t         lane;
+    esp_http_client_handle_t client;
+    SemaphoreHandle_t        busy;        /* held for the whole borrow         */
+    bool                     connected;   /* a connect happened in this borrow */
+    bool                     has_session; /* a TLS session is cached           */
+    int64_t                  t_request;   /* start of the current request      */
+    int64_t                  connect_us;
+    header_capture_t         captures[HTTP_POOL_MAX_CAPTURES];
+    int                      n_captures;
+    int                      users;       /* borrowers holding or waiting      */
+    int64_t                  t_used;      /* last release, for eviction        */
+} pool_entry_t;
+
+static pool_entry_t      s_entries[HTTP_POOL_MAX_ENTRIES];
+static SemaphoreHandle_t s_pool_lock = NULL;   /* table + counters */
+static http_pool_stats_t s_stats;
+static int               s_downloads;         /* open download spans  */
+
+/* ── Helpers ──────────────────────────────────────────────────── */
+
+void http_pool_origin(const char *url, char *out, size_t size)
+{
+    const char *host = strstr(url, "://");
+    host = host ? host + 3 : url;
+    const char *path = strchr(host, '/');
+    size_t n = path ? (size_t)(path - url) : strlen(url);
+    if (n >= size) n = size - 1;
+    memcpy(out, url, n);
+    out[n] = '\0';
+}
+
+static pool_entry_t *entry_for(esp_http_client_handle_t client)
+{
+    for (int i = 0; i < HTTP_POOL_MAX_ENTRIES; i++) {
+        if (s_entries[i].client == client) return &s_entries[i];
+    }
+    return NULL;
+}
+
+static void count(uint32_t *counter)
+{
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    (*counter)++;
+    xSemaphoreGive(s_pool_lock);
+}
+
+static esp_err_t pool_event_handler(esp_http_client_event_t *evt)
+{
+    pool_entry_t *e = evt->user_data;
+    if (evt->event_id == HTTP_EVENT_ON_CONNECTED) {
+        e->connected  = true;
+        e->connect_us = esp_timer_get_time() - e->t_request;
+        count(&s_stats.handshakes);
+        if (esp_http_client_get_transport_type(e->client) == HTTP_TRANSPORT_OVER_SSL) {
+            count(e->has_session ? &s_stats.tls_offered : &s_stats.tls_full);
+            e->has_session = true;
+        }
+    } else if (evt->event_id == HTTP_EVENT_ON_HEADER) {
+        for (int i = 0; i < e->n_captures; i++) {
+            header_capture_t *c = &e->captures[i];
+            if (strcasecmp(evt->header_key, c->name) == 0) {
+                strncpy(c->buf, evt->header_value, c->size - 1);
+                c->buf[c->size - 1] = '\0';
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+/* The server is the origin heartbeats and checks go to; mirrors only
+ * ever show up on the bulk lane. Call with s_pool_lock held. */
+static bool is_server_origin(const char *origin)
+{
+    for (int i = 0; i < HTTP_POOL_MAX_ENTRIES; i++) {
+        if (s_entries[i].lane != HTTP_POOL_BULK && strcmp(s_entries[i].origin, origin) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_mirror(const pool_entry_t *e)
+{
+    return e->origin[0] != '\0' && e->lane == HTTP_POOL_BULK && !is_server_origin(e->origin);
+}
+
+/* Call with s_pool_lock held; nobody can be waiting on the entry's mutex
+ * while users is 0. */
+static void free_entry(pool_entry_t *e)
+{
+    ESP_LOGD(TAG, "Freeing idle client for %s", e->origin);
+    if (e->client) esp_http_client_cleanup(e->client);
+    if (e->busy) vSemaphoreDelete(e->busy);
+    memset(e, 0, sizeof(*e));
+}
+
+/* Free the least recently used idle mirror entry. Call with s_pool_lock
+ * held. */
+static pool_entry_t *evict_lru(void)
+{
+    pool_entry_t *lru = NULL;
+    for (int i = 0; i < HTTP_POOL_MAX_ENTRIES; i++) {
+        pool_entry_t *e = &s_entries[i];
+        if (e->users > 0 || !is_mirror(e)) continue;
+        if (!lru || e->t_used < lru->t_used) lru = e;
+    }
+    if (!lru) return NULL;
+    free_entry(lru);
+    return lru;
+}
+
+/* A reused connection failed without reconnecting first: the server
+ * closed it while idle. Drop it so the retry connects afresh. */
+static bool stale_retry(pool_entry_t *e)
+{
+    if (!e || e->connected) return false;
+    esp_http_client_close(e->client);
+    count(&s_stats.reconnects);
+    ESP_LOGD(TAG, "Stale connection to %s — reconnecting", e->origin);
+    return true;
+}
+
+/* ── Public API ───────────────────────────────────────────────── */
+
+void http_pool_init(void)
+{
+    if (!s_pool_lock) {
+        s_pool_lock = xSemaphoreCreateMutex();
+    }
+}
+
+esp_http_client_handle_t http_pool_acquire(const char *url, http_pool_lane_t lane,
+                                           esp_http_client_method_t method,
+                                           int timeout_ms)
+{
+    char origin[sizeof(s_entries[0].origin)];
+    http_pool_origin(url, origin, sizeof(origin));
+
+    pool_entry_t *e = NULL;
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    for (int i = 0; i < HTTP_POOL_MAX_ENTRIES && !e; i++) {
+        if (s_entries[i].lane == lane && strcmp(s_entries[i].origin, origin) == 0) {
+            e = &s_entries[i];
+        }
+    }
+    if (!e) {
+        for (int i = 0; i < HTTP_POOL_MAX_ENTRIES && !e; i++) {
+            if (s_entries[i].origin[0] == '\0') e = &s_entries[i];
+        }
+        if (!e) e = evict_lru();
+        if (e) {
+            e->busy = xSemaphoreCreateMutex();
+            if (e->busy) {
+                e->lane = lane;
+                strcpy(e->origin, origin);
+            } else {
+                e = NULL;
+            }
+        }
+    }
+    if (e) e->users++;
+    xSemaphoreGive(s_pool_lock);
+    if (!e) {
+        ESP_LOGE(TAG, "No pool slot for %s", origin);
+        return NULL;
+    }
+
+    xSemaphoreTake(e->busy, portMAX_DELAY);
+    if (!e->client) {
+        esp_http_client_config_t config = {
+            .url = url,
+            .method = method,
+            .timeout_ms = timeout_ms,
+            .buffer_size = lane == HTTP_POOL_BULK ? HTTP_POOL_BULK_BUF_SIZE : 0,
+            .keep_alive_enable = true,
+            .save_client_session = true,
+            .event_handler = pool_event_handler,
+            .user_data = e,
+        };
+        e->client = esp_http_client_init(&config);
+        if (!e->client) {
+            xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+            e->users--;
+            xSemaphoreGive(s_pool_lock);
+            xSemaphoreGive(e->busy);
+            return NULL;
+        }
+    } else {
+        esp_http_client_set_url(e->client, url);
+        esp_http_client_set_method(e->client, method);
+        esp_http_client_set_timeout_ms(e->client, timeout_ms);
+    }
+    esp_http_client_set_post_field(e->client, NULL, 0);
+    e->connected  = false;
+    e->connect_us = 0;
+    e->n_captures = 0;
+    return e->client;
+}
+
+bool http_pool_capture_header(esp_http_client_handle_t client, const char *name,
+                              char *buf, size_t size)
+{
+    pool_entry_t *e = entry_for(client);
+    if (!e || e->n_captures == HTTP_POOL_MAX_CAPTURES || size == 0) return false;
+    buf[0] = '\0';
+    e->captures[e->n_captures++] = (header_capture_t){ .name = name, .buf = buf, .size = size };
+    return true;
+}
+
+esp_err_t http_pool_perform(esp_http_client_handle_t client)
+{
+    pool_entry_t *e = entry_for(client);
+    if (e) e->t_request = esp_timer_get_time();
+    esp_err_t err = esp_http_client_perform(client);
+    if (err != ESP_OK && stale_retry(e)) {
+        e->t_request = esp_timer_get_time();
+        err = esp_http_client_perform(client);
+    }
+    return err;
+}
+
+int64_t http_pool_request(esp_http_client_handle_t client, const char *body, int body_len)
+{
+    pool_entry_t *e = entry_for(client);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (e) e->t_request = esp_timer_get_time();
+        if (esp_http_client_open(client, body_len) == ESP_OK &&
+            (body_len == 0 || esp_http_client_write(client, body, body_len) == body_len)) {
+            int64_t len = esp_http_client_fetch_headers(client);
+            if (len >= 0 && esp_http_client_get_status_code(client) > 0) {
+                return len;
+            }
+        }
+        if (!stale_retry(e)) break;
+    }
+    esp_http_client_close(client);
+    return -1;
+}
+
+int64_t http_pool_connect_us(esp_http_client_handle_t client)
+{
+    pool_entry_t *e = entry_for(client);
+    return e ? e->connect_us : 0;
+}
+
+void http_pool_release(esp_http_client_handle_t client, bool reuse)
+{
+    pool_entry_t *e = entry_for(client);
+    if (!e) return;
+
+    if (reuse && e->lane == HTTP_POOL_BULK) {
+        xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+        if (s_downloads == 0 && is_mirror(e)) reuse = false;
+        xSemaphoreGive(s_pool_lock);
+    }
+    if (reuse) {
+        int drained = 0;
+        if (esp_http_client_flush_response(client, &drained) != ESP_OK) {
+            esp_http_client_close(client);
+        }
+    } else {
+        esp_http_client_close(client);
+    }
+
+    e->n_captures = 0;
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    if (e->connected) s_stats.misses++;
+    else              s_stats.hits++;
+    e->t_used = esp_timer_get_time();
+    e->users--;
+    xSemaphoreGive(s_pool_lock);
+    xSemaphoreGive(e->busy);
+}
+
+void http_pool_download_begin(void)
+{
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    s_downloads++;
+    xSemaphoreGive(s_pool_lock);
+}
+
+void http_pool_download_end(void)
+{
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    if (s_downloads > 0) s_downloads--;
+    if (s_downloads == 0) {
+        for (int i = 0; i < HTTP_POOL_MAX_ENTRIES; i++) {
+            if (s_entries[i].users == 0 && is_mirror(&s_entries[i])) free_entry(&s_entries[i]);
+        }
+    }
+    xSemaphoreGive(s_pool_lock);
+}
+
+void http_pool_get_stats(http_pool_stats_t *out)
+{
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+    *out = s_stats;
+    xSemaphoreGive(s_pool_lock);
+}
@@ -0,0 +1,110 @@
+/**
+ * HTTP Pool — Header
+ * One shared keep-alive esp_http_client per server origin and lane. A
+ * caller borrows the client for one request; borrows are serialized
+ * across tasks, and a connection the server dropped while idle is
+ * reopened once, transparently. Clients keep their TLS session and
+ * offer it on reconnects, so a server that accepts it skips the full
+ * handshake. Idle mirror clients are evicted, least recently used
+ * first, when the table fills, and freed when the download that used
+ * them ends.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+#define HTTP_POOL_MAX_ENTRIES     6   /* 3 server lanes + recent OTA mirrors */
+#define HTTP_POOL_BULK_BUF_SIZE   4096
+#define HTTP_POOL_MAX_CAPTURES    2
+
+/* Lanes keep long transfers from blocking small control requests */
+typedef enum {
+    HTTP_POOL_CONTROL,      /* heartbeats, reports, OTA checks */
+    HTTP_POOL_BULK,         /* firmware downloads              */
+    HTTP_POOL_NOTIFY,       /* long-polled update checks       */
+} http_pool_lane_t;
+
+typedef struct {
+    uint32_t hits;          /* requests served on an already-open connection */
+    uint32_t misses;        /* requests that had to connect first            */
+    uint32_t handshakes;    /* TCP (+TLS) connections established            */
+    uint32_t reconnects;    /* stale connections retried                     */
+    uint32_t tls_full;      /* TLS handshakes without a cached session       */
+    uint32_t tls_offered;   /* TLS handshakes offering a cached session      */
+} http_pool_stats_t;
+
+/**
+ * Create the pool lock. Call once at startup, before any task uses it.
+ */
+void http_pool_init(void);
+
+/**
+ * Borrow the client for `url`'s origin on `lane`, blocking while another
+ * task holds it. Method, timeout and URL are set; the post field is
+ * cleared. Headers set by earlier borrowers persist — delete any that
+ * must not be sent.
+ * @return NULL if no client could be created.
+ */
+esp_http_client_handle_t http_pool_acquire(const char *url, http_pool_lane_t lane,
+                                           esp_http_client_method_t method,
+                                           int timeout_ms);
+
+/**
+ * Copy response header `name` into `buf` for the rest of this borrow
+ * (esp_http_client only surfaces response headers as events). `buf` is
+ * cleared now and must stay valid until release.
+ * @return false if the borrow already captures HTTP_POOL_MAX_CAPTURES.
+ */
+bool http_pool_capture_header(esp_http_client_handle_t client, const char *name,
+                              char *buf, size_t size);
+
+/**
+ * esp_http_client_perform() with one retry when a reused connection
+ * turns out to be closed.
+ */
+esp_err_t http_pool_perform(esp_http_client_handle_t client);
+
+/**
+ * Open, send `body` (may be NULL) and fetch the response headers, with
+ * the same single retry. The caller then reads the body.
+ * @return Content length (0 if unknown), or -1 on failure.
+ */
+int64_t http_pool_request(esp_http_client_handle_t client, const char *body, int body_len);
+
+/**
+ * Time the last perform/request of this borrow spent connecting
+ * (TCP + TLS), in µs; 0 if it rode an open connection.
+ */
+int64_t http_pool_connect_us(esp_http_client_handle_t client);
+
+/**
+ * Return a borrowed client. With `reuse` the unread response is drained
+ * and the connection kept; otherwise it is closed (use after errors or
+ * when the body was abandoned mid-way).
+ */
+void http_pool_release(esp_http_client_handle_t client, bool reuse);
+
+/**
+ * Bracket a firmware download. Between begin and end, mirror (non-server
+ * bulk) connections are kept open across borrows; end frees the idle
+ * mirror clients, and mirror borrows outside a download are closed on
+ * release. Calls nest.
+ */
+void http_pool_download_begin(void);
+void http_pool_download_end(void);
+
+/**
+ * Copy the origin (scheme://host[:port]) of `url` into `out`; the pool
+ * keeps one client per origin and lane.
+ */
+void http_pool_origin(const char *url, char *out, size_t size);
+
+/**
+ * Snapshot of the pool counters since boot.
+ */
+void http_pool_get_stats(http_pool_stats_t *out);
@@ -0,0 +1,274 @@
+/**
+ * JSON Stream — Implementation
+ * Byte-at-a-time state machine; tokens are assembled in a fixed buffer
+ * and handed to the callback as soon as they are complete.
+ */
+
+#include "json_stream.h"
+
+#include <string.h>
+
+enum {
+    ST_VALUE,          /* expecting any value                        */
+    ST_VALUE_OR_END,   /* just after '[' — value or ']'              */
+    ST_KEY_OR_END,     /* just after '{' — member name or '}'        */
+    ST_KEY,            /* after ',' inside an object                 */
+    ST_COLON,          /* after a member name                        */
+    ST_AFTER_VALUE,    /* ',' or a closing bracket                   */
+    ST_STRING,
+    ST_STRING_ESC,
+    ST_STRING_UNICODE,
+    ST_LITERAL,        /* number / true / false / null               */
+};
+
+/* ── Helpers ──────────────────────────────────────────────────── */
+
+static bool fail(json_stream_t *js)
+{
+    js->error = true;
+    return false;
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool is_literal_char(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') || c == '-' || c == '+' || c == '.';
+}
+
+static bool append(json_stream_t *js, char c)
+{
+    if (js->len >= sizeof(js->buf) - 1) return fail(js);
+    js->buf[js->len++] = c;
+    return true;
+}
+
+static void emit(json_stream_t *js, json_stream_event_t ev)
+{
+    if (!js->cb) return;
+    if (ev <= JSON_STREAM_NULL) {
+        js->buf[js->len] = 0;
+        js->cb(js->user, js, ev, js->buf, js->len);
+    } else {
+        js->cb(js->user, js, ev, NULL, 0);
+    }
+}
+
+static void value_done(json_stream_t *js)
+{
+    if (js->depth == 0) js->done = true;
+    js->state = ST_AFTER_VALUE;
+}
+
+static bool open_container(json_stream_t *js, bool is_array)
+{
+    if (js->depth >= JSON_STREAM_MAX_DEPTH) return fail(js);
+    emit(js, is_array ? JSON_STREAM_ARRAY_START : JSON_STREAM_OBJECT_START);
+    json_stream_frame_t *f = &js->stack[js->depth++];
+    f->is_array = is_array;
+    f->key[0] = 0;
+    f->index = 0;
+    js->state = is_array ? ST_VALUE_OR_END : ST_KEY_OR_END;
+    return true;
+}
+
+static bool close_container(json_stream_t *js, bool is_array)
+{
+    if (js->depth == 0 || js->stack[js->depth - 1].is_array != is_array) {
+        return fail(js);
+    }
+    js->depth--;
+    emit(js, is_array ? JSON_STREAM_ARRAY_END : JSON_STREAM_OBJECT_END);
+    value_done(js);
+    return true;
+}
+
+static bool finish_literal(json_stream_t *js)
+{
+    js->buf[js->len] = 0;
+    if (strcmp(js->buf, "true") == 0) {
+        emit(js, JSON_STREAM_TRUE);
+    } else if (strcmp(js->buf, "false") == 0) {
+        emit(js, JSON_STREAM_FALSE);
+    } else if (strcmp(js->buf, "null") == 0) {
+        emit(js, JSON_STREAM_NULL);
+    } else {
+        for (uint16_t i = 0; i < js->len; i++) {
+            char c = js->buf[i];
+            if (!((c >= '0' && c <= '9') || c == '-' || c == '+' ||
+                  c == '.' || c == 'e' || c == 'E')) {
+                return fail(js);
+            }
+        }
+        emit(js, JSON_STREAM_NUMBER);
+    }
+    value_done(js);
+    return true;
+}
+
+/* Encode a \uXXXX code unit as UTF-8 (surrogate pairs are not joined) */
+static bool append_codepoint(json_stream_t *js, uint16_t cp)
+{
+    if (cp < 0x80) {
+        return append(js, (char)cp);
+    } else if (cp < 0x800) {
+        return append(js, (char)(0xC0 | (cp >> 6))) &&
+               append(js, (char)(0x80 | (cp & 0x3F)));
+    }
+    return append(js, (char)(0xE0 | (cp >> 12))) &&
+           append(js, (char)(0x80 | ((cp >> 6) & 0x3F))) &&
+           append(js, (char)(0x80 | (cp & 0x3F)));
+}
+
+static bool begin_value(json_stream_t *js, char c)
+{
+    if (c == '{') return open_container(js, false);
+    if (c == '[') return open_container(js, true);
+    if (c == '"') {
+        js->in_key = false;
+        js->len = 0;
+        js->state = ST_STRING;
+        return true;
+    }
+    if (is_literal_char(c)) {
+        js->len = 0;
+        js->state = ST_LITERAL;
+        return append(js, c);
+    }
+    return fail(js);
+}
+
+static bool step(json_stream_t *js, char c)
+{
+    switch (js->state) {
+    case ST_VALUE:
+        if (is_space(c)) return true;
+        return begin_value(js, c);
+
+    case ST_VALUE_OR_END:
+        if (is_space(c)) return true;
+        if (c == ']') return close_container(js, true);
+        return begin_value(js, c);
+
+    case ST_KEY_OR_END:
+    case ST_KEY:
+        if (is_space(c)) return true;
+        if (c == '}' && js->state == ST_KEY_OR_END) return close_container(js, false);
+        if (c != '"') return fail(js);
+        js->in_key = true;
+        js->len = 0;
+        js->state = ST_STRING;
+        return true;
+
+    case ST_COLON:
+        if (is_space(c)) return true;
+        if (c != ':') return fail(js);
+        js->state = ST_VALUE;
+        return true;
+
+    case ST_AFTER_VALUE:
+        if (is_space(c)) return true;
+        if (js->depth == 0) return fail(js);   /* trailing garbage */
+        if (c == '}') return close_container(js, false);
+        if (c == ']') return close_container(js, true);
+        if (c != ',') return fail(js);
+        if (js->stack[js->depth - 1].is_array) {
+            js->stack[js->depth - 1].index++;
+            js->state = ST_VALUE;
+        } else {
+            js->state = ST_KEY;
+        }
+        return true;
+
+    case ST_STRING:
+        if (c == '"') {
+            js->buf[js->len] = 0;
+            if (js->in_key) {
+                json_stream_frame_t *f = &js->stack[js->depth - 1];
+                strncpy(f->key, js->buf, sizeof(f->key) - 1);
+                f->key[sizeof(f->key) - 1] = 0;
+                js->state = ST_COLON;
+            } else {
+                emit(js, JSON_STREAM_STRING);
+                value_done(js);
+            }
+            return true;
+        }
+        if (c == '\\') {
+            js->state = ST_STRING_ESC;
+            return true;
+        }
+        if ((unsigned char)c < 0x20) return fail(js);
+        return append(js, c);
+
+    case ST_STRING_ESC:
+        js->state = ST_STRING;
+        switch (c) {
+        case '"': case '\\': case '/': return append(js, c);
+        case 'b': return append(js, '\b');
+        case 'f': return append(js, '\f');
+        case 'n': return append(js, '\n');
+        case 'r': return append(js, '\r');
+        case 't': return append(js, '\t');
+        case 'u':
+            js->esc_left = 4;
+            js->esc_code = 0;
+            js->state = ST_STRING_UNICODE;
+            return true;
+        default:
+            return fail(js);
+        }
+
+    case ST_STRING_UNICODE: {
+        uint16_t nibble;
+        if (c >= '0' && c <= '9')      nibble = c - '0';
+        else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+        else return fail(js);
+        js->esc_code = (js->esc_code << 4) | nibble;
+        if (--js->esc_left == 0) {
+            js->state = ST_STRING;
+            return append_codepoint(js, js->esc_code);
+        }
+        return true;
+    }
+
+    case ST_LITERAL:
+        if (is_literal_char(c)) return append(js, c);
+        if (!finish_literal(js)) return false;
+        return step(js, c);   /* delimiter belongs to the enclosing state */
+
+    default:
+        return fail(js);
+    }
+}
+
+/* ── Public API ───────────────────────────────────────────────── */
+
+void json_stream_init(json_stream_t *js, json_stream_cb_t cb, void *user)
+{
+    memset(js, 0, sizeof(*js));
+    js->cb    = cb;
+    js->user  = user;
+    js->state = ST_VALUE;
+}
+
+bool json_stream_feed(json_stream_t *js, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len && !js->error; i++) {
+        step(js, data[i]);
+    }
+    return !js->error;
+}
+
+bool json_stream_finish(json_stream_t *js)
+{
+    if (!js->error && js->state == ST_LITERAL && js->depth == 0) {
+        finish_literal(js);
+    }
+    return js->done && !js->error && js->depth == 0;
+}
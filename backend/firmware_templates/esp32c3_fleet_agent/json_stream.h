@@ -0,0 +1,106 @@
+/**
+ * JSON Stream — Header
+ * Incremental (push) JSON tokenizer for small server responses.
+ * Feed the body in arbitrary chunks straight from the HTTP read loop;
+ * a callback fires for every scalar value and container boundary.
+ * No heap, no document tree — all state lives in json_stream_t.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_STREAM_MAX_DEPTH  6
+#define JSON_STREAM_MAX_KEY    32
+#define JSON_STREAM_MAX_VALUE  384   /* fits a base64 RSA-2048 signature */
+
+typedef enum {
+    JSON_STREAM_STRING,
+    JSON_STREAM_NUMBER,
+    JSON_STREAM_TRUE,
+    JSON_STREAM_FALSE,
+    JSON_STREAM_NULL,
+    JSON_STREAM_OBJECT_START,
+    JSON_STREAM_OBJECT_END,
+    JSON_STREAM_ARRAY_START,
+    JSON_STREAM_ARRAY_END,
+} json_stream_event_t;
+
+typedef struct {
+    bool     is_array;
+    char     key[JSON_STREAM_MAX_KEY];   /* current member name (objects)  */
+    uint16_t index;                      /* current element index (arrays) */
+} json_stream_frame_t;
+
+typedef struct json_stream json_stream_t;
+
+/**
+ * Value callback.
+ * For scalars, `value`/`len` hold the decoded string or raw literal text
+ * (NUL-terminated). For container events `value` is NULL.
+ * The member name / array index of the event is json_stream_key() /
+ * json_stream_index() at level json_stream_depth() - 1.
+ */
+typedef void (*json_stream_cb_t)(void *user, const json_stream_t *js,
+                                 json_stream_event_t ev,
+                                 const char *value, size_t len);
+
+struct json_stream {
+    json_stream_cb_t    cb;
+    void               *user;
+    uint8_t             state;
+    uint8_t             depth;
+    uint8_t             esc_left;      /* remaining \uXXXX hex digits */
+    bool                in_key;
+    bool                done;
+    bool                error;
+    uint16_t            esc_code;
+    uint16_t            len;
+    char                buf[JSON_STREAM_MAX_VALUE];
+    json_stream_frame_t stack[JSON_STREAM_MAX_DEPTH];
+};
+
+/**
+ * Reset the tokenizer for a new document.
+ */
+void json_stream_init(json_stream_t *js, json_stream_cb_t cb, void *user);
+
+/**
+ * Feed the next chunk of the document.
+ * @return false once a syntax error (or overlong token) has been seen.
+ */
+bool json_stream_feed(json_stream_t *js, const char *data, size_t len);
+
+/**
+ * Signal end of input.
+ * @return true if exactly one complete JSON value was parsed.
+ */
+bool json_stream_finish(json_stream_t *js);
+
+/**
+ * Number of currently open containers.
+ */
+static inline int json_stream_depth(const json_stream_t *js)
+{
+    return js->depth;
+}
+
+/**
+ * Member name at the given nesting level ("" for array elements).
+ */
+static inline const char *json_stream_key(const json_stream_t *js, int level)
+{
+    if (level < 0 || level >= js->depth || js->stack[level].is_array) return "";
+    return js->stack[level].key;
+}
+
+/**
+ * Element index at the given nesting level (0 for object members).
+ */
+static inline int json_stream_index(const json_stream_t *js, int level)
+{
+    if (level < 0 || level >= js->depth || !js->stack[level].is_array) return 0;
+    return js->stack[level].index;
+}
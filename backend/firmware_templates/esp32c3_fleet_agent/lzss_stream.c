@@ -0,0 +1,112 @@
+/**
+ * LZSS Stream — Implementation
+ * Bitstream (MSB first): 1 + 8 bits = literal byte,
+ * 0 + W bits (offset - 1) + L bits (length - 1) = back-reference.
+ * Trailing pad bits never complete a token and are ignored.
+ */
+
+#include "lzss_stream.h"
+
+#include <string.h>
+
+enum {
+    LZ_TAG,
+    LZ_LITERAL,
+    LZ_OFFSET,
+    LZ_LENGTH,
+};
+
+/* ── Helpers ──────────────────────────────────────────────────── */
+
+static bool flush_out(lzss_stream_t *lz, lzss_output_cb_t cb, void *user)
+{
+    if (lz->out_len == 0) return true;
+    bool ok = cb(user, lz->out, lz->out_len);
+    lz->out_len = 0;
+    if (!ok) lz->error = true;
+    return ok;
+}
+
+static bool put_byte(lzss_stream_t *lz, uint8_t c, lzss_output_cb_t cb, void *user)
+{
+    uint16_t mask = (uint16_t)((1u << lz->window_bits) - 1);
+    lz->window[lz->head & mask] = c;
+    lz->head++;
+    lz->out[lz->out_len++] = c;
+    lz->total_out++;
+    if (lz->out_len == sizeof(lz->out)) {
+        return flush_out(lz, cb, user);
+    }
+    return true;
+}
+
+static uint8_t bits_needed(const lzss_stream_t *lz)
+{
+    switch (lz->state) {
+    case LZ_TAG:     return 1;
+    case LZ_LITERAL: return 8;
+    case LZ_OFFSET:  return lz->window_bits;
+    default:         return lz->lookahead_bits;
+    }
+}
+
+/* ── Public API ───────────────────────────────────────────────── */
+
+bool lzss_stream_init(lzss_stream_t *lz, uint8_t window_bits, uint8_t lookahead_bits)
+{
+    if (window_bits < 4 || window_bits > LZSS_MAX_WINDOW_BITS ||
+        lookahead_bits < 3 || lookahead_bits >= window_bits) {
+        return false;
+    }
+    memset(lz, 0, sizeof(*lz));
+    lz->window_bits    = window_bits;
+    lz->lookahead_bits = lookahead_bits;
+    lz->state          = LZ_TAG;
+    return true;
+}
+
+bool lzss_stream_feed(lzss_stream_t *lz, const uint8_t *in, size_t len,
+                      lzss_output_cb_t cb, void *user)
+{
+    lz->total_in += len;
+    for (size_t i = 0; i < len && !lz->error; i++) {
+        lz->bit_buf = (lz->bit_buf << 8) | in[i];
+        lz->bit_count += 8;
+
+        uint8_t need;
+        while (!lz->error && lz->bit_count >= (need = bits_needed(lz))) {
+            lz->bit_count -= need;
+            uint32_t v = (lz->bit_buf >> lz->bit_count) & ((1u << need) - 1);
+
+            switch (lz->state) {
+            case LZ_TAG:
+                lz->state = v ? LZ_LITERAL : LZ_OFFSET;
+                break;
+            case LZ_LITERAL:
+                put_byte(lz, (uint8_t)v, cb, user);
+                lz->state = LZ_TAG;
+                break;
+            case LZ_OFFSET:
+                lz->backref_offset = (uint16_t)(v + 1);
+                lz->state = LZ_LENGTH;
+                break;
+            case LZ_LENGTH: {
+                uint16_t mask = (uint16_t)((1u << lz->window_bits) - 1);
+                for (uint32_t n = 0; n <= v && !lz->error; n++) {
+                    uint8_t c = lz->window[(uint16_t)(lz->head - lz->backref_offset) & mask];
+                    put_byte(lz, c, cb, user);
+                }
+                lz->state = LZ_TAG;
+                break;
+            }
+            }
+        }
+    }
+    return !lz->error;
+}
+
+bool lzss_stream_finish(lzss_stream_t *lz, lzss_output_cb_t cb, void *user)
+{
+    if (lz->error) return false;
+    return flush_out(lz, cb, user);
+}
@@ -0,0 +1,55 @@
+/**
+ * LZSS Stream — Header
+ * Streaming decoder for heatshrink-format LZSS (as produced by
+ * build_service.py). Fixed window, no heap: peak RAM is the struct.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZSS_MAX_WINDOW_BITS  10     /* 1 KB history window */
+#define LZSS_OUT_CHUNK        128    /* bytes batched per output callback */
+
+/**
+ * Output callback; return false to abort decoding.
+ */
+typedef bool (*lzss_output_cb_t)(void *user, const uint8_t *data, size_t len);
+
+typedef struct {
+    uint8_t  window_bits;
+    uint8_t  lookahead_bits;
+    uint8_t  state;
+    uint8_t  bit_count;
+    uint32_t bit_buf;
+    uint16_t head;             /* next write position in window   */
+    uint16_t backref_offset;
+    bool     error;
+    size_t   out_len;
+    uint32_t total_in;
+    uint32_t total_out;
+    uint8_t  out[LZSS_OUT_CHUNK];
+    uint8_t  window[1 << LZSS_MAX_WINDOW_BITS];
+} lzss_stream_t;
+
+/**
+ * Prepare a decoder.
+ * @param window_bits     History window size (log2), 4..LZSS_MAX_WINDOW_BITS.
+ * @param lookahead_bits  Max backref length (log2), 3..window_bits-1.
+ * @return false if the parameters are out of range.
+ */
+bool lzss_stream_init(lzss_stream_t *lz, uint8_t window_bits, uint8_t lookahead_bits);
+
+/**
+ * Decode a chunk of compressed input, emitting output through `cb`.
+ * @return false on callback abort.
+ */
+bool lzss_stream_feed(lzss_stream_t *lz, const uint8_t *in, size_t len,
+                      lzss_output_cb_t cb, void *user);
+
+/**
+ * Emit any buffered output. Call once after the last feed.
+ */
+bool lzss_stream_finish(lzss_stream_t *lz, lzss_output_cb_t cb, void *user);
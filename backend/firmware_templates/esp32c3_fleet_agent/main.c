@@ -13,6 +13,7 @@
  *   - Dual OTA partition with automatic rollback
  *   - Telemetry heartbeat (RSSI, free_heap, uptime)
  *   - Device claim flow (pairing code)
+ *   - Optional LAN peer cache for verified images (peer_cache.c)
  */
 
 #include <stdio.h>
@@ -21,6 +22,7 @@
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
+#include "esp_random.h"
 #include "esp_log.h"
 #include "esp_event.h"
 #include "nvs_flash.h"
@@ -30,6 +32,8 @@
 #include "wifi_manager.h"
 #include "ota_manager.h"
 #include "device_agent.h"
+#include "http_pool.h"
+#include "peer_cache.h"
 
 static const char *TAG = "MAIN";
 
@@ -40,6 +44,18 @@ static const char *TAG = "MAIN";
 #define WIFI_CONNECT_TIMEOUT_MS (15 * 1000)   /* Wi-Fi connect timeout     */
 #define AP_PORTAL_TIMEOUT_MS    (300 * 1000)  /* AP portal timeout (5 min) */
 #define HEALTH_CHECK_HEAP_MIN   (32 * 1024)   /* Minimum 32KB free heap    */
+#define OTA_CHECK_BACKOFF_MAX_MS (30 * 60 * 1000) /* Cap for check backoff  */
+#define RETRY_AFTER_MAX_S       3600          /* Larger server hints ignored */
+
+/* Background pre-erase of the inactive OTA slot (opt-in):
+ * 0 = off, 1 = once an update is found, 2 = also proactively while idle */
+#define OTA_PREERASE_MODE       0
+
+/* Update watch: hold a long-poll open so the server can announce a
+ * deployment at once (0 = interval polling only). While it holds,
+ * interval checks are only a safety net. */
+#define OTA_LONG_POLL_WAIT_S    120
+#define OTA_CHECK_FALLBACK_MS   (15 * 60 * 1000)
 
 /* ── Agent State Machine ──────────────────────────────────────── */
 typedef enum {
@@ -49,8 +65,10 @@ typedef enum {
     STATE_IDLE,
     STATE_CHECK_UPDATE,
     STATE_DOWNLOAD,
+    STATE_DOWNLOADING,
     STATE_VERIFY,
     STATE_APPLY,
+    STATE_ACTIVATE,
     STATE_HEALTH_CHECK,
 } agent_state_t;
 
@@ -62,8 +80,10 @@ static const char* state_name(agent_state_t s) {
         case STATE_IDLE:         return "IDLE";
         case STATE_CHECK_UPDATE: return "CHECK_UPDATE";
         case STATE_DOWNLOAD:     return "DOWNLOAD";
+        case STATE_DOWNLOADING:  return "DOWNLOADING";
         case STATE_VERIFY:       return "VERIFY";
         case STATE_APPLY:        return "APPLY";
+        case STATE_ACTIVATE:     return "ACTIVATE";
         case STATE_HEALTH_CHECK: return "HEALTH_CHECK";
         default:                 return "UNKNOWN";
     }
@@ -98,11 +118,53 @@ static bool perform_health_check(void)
     return true;
 }
 
+/* ── Poll Scheduling ──────────────────────────────────────────── */
+
+/* Stable per-device offset in [0, interval), derived from the device ID,
+ * so a fleet that boots together (site power cut) keeps distinct phases
+ * instead of polling in lockstep */
+static TickType_t device_phase(uint32_t interval_ms)
+{
+    uint32_t h = 2166136261u;   /* FNV-1a */
+    for (const char *p = device_agent_get_id(); *p; p++) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+    return pdMS_TO_TICKS(h % interval_ms);
+}
+
+/* Interval from a server Retry-After hint, if it gave a sane one */
+static uint32_t server_interval_ms(int retry_after_s, uint32_t default_ms)
+{
+    if (retry_after_s <= 0 || retry_after_s > RETRY_AFTER_MAX_S) return default_ms;
+    return (uint32_t)retry_after_s * 1000;
+}
+
+/* Exponential backoff: the ceiling doubles per consecutive failure (capped),
+ * the delay is drawn from its upper half so failed devices drift apart */
+static uint32_t next_backoff_ms(uint32_t *ceiling_ms)
+{
+    *ceiling_ms = *ceiling_ms ? *ceiling_ms * 2 : OTA_CHECK_INTERVAL_MS * 2;
+    if (*ceiling_ms > OTA_CHECK_BACKOFF_MAX_MS) *ceiling_ms = OTA_CHECK_BACKOFF_MAX_MS;
+    return *ceiling_ms / 2 + esp_random() % (*ceiling_ms / 2);
+}
+
+/* Where an offered update leads: download it, activate the copy already
+ * staged for it, or keep waiting for the server's activation signal */
+static agent_state_t state_for_update(const ota_update_info_t *info)
+{
+    const char *staged = ota_manager_staged_deployment();
+    if (!staged || strcmp(staged, info->deployment_id) != 0) return STATE_DOWNLOAD;
+    return info->activate ? STATE_ACTIVATE : STATE_IDLE;
+}
+
 /* ── Main State Machine Task ──────────────────────────────────── */
 static void agent_task(void *pvParameters)
 {
     agent_state_t state = STATE_BOOT;
     ota_update_info_t update_info = {0};
+    uint32_t heartbeat_ms = HEARTBEAT_INTERVAL_MS;
+    uint32_t ota_check_ms = OTA_CHECK_INTERVAL_MS;
+    uint32_t ota_backoff_ms = 0;   /* backoff ceiling; 0 = last check succeeded */
     TickType_t last_heartbeat = 0;
     TickType_t last_ota_check = 0;
 
@@ -139,6 +201,15 @@ static void agent_task(void *pvParameters)
             if (result == WIFI_CONNECT_OK) {
                 ESP_LOGI(TAG, "Wi-Fi connected! IP: %s", wifi_manager_get_ip());
                 device_agent_report_status("online");
+                peer_cache_start();
+
+                /* First heartbeat / check fall at a per-device offset into
+                 * their interval, counted from when the network came up */
+                TickType_t up = xTaskGetTickCount();
+                last_heartbeat = up - pdMS_TO_TICKS(HEARTBEAT_INTERVAL_MS)
+                                 + device_phase(HEARTBEAT_INTERVAL_MS);
+                last_ota_check = up - pdMS_TO_TICKS(OTA_CHECK_INTERVAL_MS)
+                                 + device_phase(OTA_CHECK_INTERVAL_MS);
                 state = STATE_IDLE;
             } else if (result == WIFI_CONNECT_NO_CREDENTIALS) {
                 ESP_LOGW(TAG, "No saved Wi-Fi credentials");
@@ -153,6 +224,7 @@ static void agent_task(void *pvParameters)
         /* ─── AP_PORTAL ──────────────────────────────────────── */
         case STATE_AP_PORTAL: {
             ESP_LOGI(TAG, "Starting AP mode + captive portal...");
+            peer_cache_stop();
             wifi_manager_start_ap_portal();
 
             /* Block until credentials are saved or timeout */
@@ -175,14 +247,45 @@ static void agent_task(void *pvParameters)
         case STATE_IDLE: {
             TickType_t now = xTaskGetTickCount();
 
-            /* Periodic heartbeat */
-            if ((now - last_heartbeat) >= pdMS_TO_TICKS(HEARTBEAT_INTERVAL_MS)) {
-                device_agent_send_heartbeat(FIRMWARE_VERSION);
+            /* Periodic heartbeat; its reply also answers the OTA check,
+             * so a separate check only runs if the server left it out */
+            if ((now - last_heartbeat) >= pdMS_TO_TICKS(heartbeat_ms)) {
+                ota_check_result_t check;
+                int retry_after = device_agent_send_heartbeat(FIRMWARE_VERSION,
+                                                              &update_info, &check);
+                heartbeat_ms = server_interval_ms(retry_after, HEARTBEAT_INTERVAL_MS);
                 last_heartbeat = now;
+
+                if (check != OTA_CHECK_ERROR) {
+                    last_ota_check = now;
+                    ota_backoff_ms = 0;
+                    ota_check_ms = OTA_CHECK_INTERVAL_MS;
+                    if (OTA_LONG_POLL_WAIT_S > 0) {
+                        ota_manager_watch_start(FIRMWARE_VERSION, OTA_LONG_POLL_WAIT_S);
+                    }
+                }
+                agent_state_t next = check == OTA_UPDATE_AVAILABLE
+                                     ? state_for_update(&update_info) : STATE_IDLE;
+                if (next != STATE_IDLE) {
+                    ESP_LOGI(TAG, "Heartbeat: update v%s available", update_info.version);
+                    if (next == STATE_DOWNLOAD && OTA_PREERASE_MODE >= 1) {
+                        ota_manager_preerase_start();
+                    }
+                    state = next;
+                    break;
+                }
             }
 
-            /* Periodic OTA check */
-            if ((now - last_ota_check) >= pdMS_TO_TICKS(OTA_CHECK_INTERVAL_MS)) {
+            if (OTA_PREERASE_MODE >= 2) {
+                ota_manager_preerase_start();
+            }
+
+            /* OTA check: at once when the watch saw an update, else periodically */
+            uint32_t check_ms = ota_check_ms;
+            if (ota_manager_watch_active() && check_ms < OTA_CHECK_FALLBACK_MS) {
+                check_ms = OTA_CHECK_FALLBACK_MS;
+            }
+            if (ota_manager_update_hinted() || (now - last_ota_check) >= pdMS_TO_TICKS(check_ms)) {
                 state = STATE_CHECK_UPDATE;
                 last_ota_check = now;
                 break;
@@ -195,7 +298,8 @@ static void agent_task(void *pvParameters)
                 break;
             }
 
-            vTaskDelay(pdMS_TO_TICKS(1000));
+            /* Sleep; the update watch cuts this short */
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
             break;
         }
 
@@ -207,17 +311,34 @@ static void agent_task(void *pvParameters)
             ota_check_result_t check = ota_manager_check_update(
                 FIRMWARE_VERSION, &update_info);
 
+            if (check == OTA_CHECK_ERROR) {
+                ota_check_ms = next_backoff_ms(&ota_backoff_ms);
+            } else {
+                ota_backoff_ms = 0;
+                ota_check_ms = server_interval_ms(ota_manager_retry_after(),
+                                                  OTA_CHECK_INTERVAL_MS);
+                /* Started only after a check answered, so it inherits the
+                 * device's phase after a mass reboot */
+                if (OTA_LONG_POLL_WAIT_S > 0) {
+                    ota_manager_watch_start(FIRMWARE_VERSION, OTA_LONG_POLL_WAIT_S);
+                }
+            }
+
             if (check == OTA_UPDATE_AVAILABLE) {
                 ESP_LOGI(TAG, "Update available: v%s (size=%d, hash=%s)",
                          update_info.version,
                          update_info.artifact_size,
                          update_info.artifact_hash);
-                state = STATE_DOWNLOAD;
+                state = state_for_update(&update_info);
+                if (state == STATE_DOWNLOAD && OTA_PREERASE_MODE >= 1) {
+                    ota_manager_preerase_start();
+                }
             } else if (check == OTA_NO_UPDATE) {
                 ESP_LOGI(TAG, "Firmware is up to date");
                 state = STATE_IDLE;
             } else {
-                ESP_LOGW(TAG, "OTA check failed (server unreachable?)");
+                ESP_LOGW(TAG, "OTA check failed (server unreachable?) — next in %lus",
+                         (unsigned long)(ota_check_ms / 1000));
                 state = STATE_IDLE;
             }
             break;
@@ -228,15 +349,73 @@ static void agent_task(void *pvParameters)
             ESP_LOGI(TAG, "Downloading firmware v%s...", update_info.version);
             device_agent_report_ota_status("downloading");
 
-            ota_download_result_t dl = ota_manager_download(&update_info);
-
-            if (dl == OTA_DOWNLOAD_OK) {
-                ESP_LOGI(TAG, "Download complete");
-                state = STATE_VERIFY;
-            } else {
-                ESP_LOGE(TAG, "Download failed");
-                device_agent_report_ota_status("failed");
+            if (!ota_manager_download_start(&update_info)) {
+                ESP_LOGE(TAG, "Could not start download — retrying later");
+                device_agent_report_ota_status("interrupted");
                 state = STATE_IDLE;
+                break;
+            }
+            device_agent_set_ota_progress(0);
+            state = STATE_DOWNLOADING;
+            break;
+        }
+
+        /* ─── DOWNLOADING ────────────────────────────────────── */
+        /* The transfer runs in its own task; this loop keeps heartbeating,
+         * watches Wi-Fi and cancels if the server withdraws the update */
+        case STATE_DOWNLOADING: {
+            ota_event_t ev;
+            if (ota_manager_next_event(&ev, 1000)) {
+                if (ev.type == OTA_EVENT_PROGRESS) {
+                    if (ev.total > 0) {
+                        device_agent_set_ota_progress((int)((uint64_t)ev.bytes * 100 / ev.total));
+                    }
+                    ESP_LOGI(TAG, "Download progress: %lu / %lu bytes",
+                             (unsigned long)ev.bytes, (unsigned long)ev.total);
+                    break;
+                }
+
+                device_agent_set_ota_progress(-1);
+                if (ev.result == OTA_DOWNLOAD_OK) {
+                    ESP_LOGI(TAG, "Download complete");
+                    state = STATE_VERIFY;
+                } else if (ev.result == OTA_DOWNLOAD_TIMEOUT) {
+                    /* Checkpoint kept — the next check resumes this download */
+                    ESP_LOGW(TAG, "Download interrupted, will resume");
+                    device_agent_report_ota_status("interrupted");
+                    state = STATE_IDLE;
+                } else if (ev.result == OTA_DOWNLOAD_CANCELLED) {
+                    ESP_LOGW(TAG, "Download cancelled");
+                    device_agent_report_ota_status("cancelled");
+                    state = STATE_IDLE;
+                } else {
+                    ESP_LOGE(TAG, "Download failed");
+                    device_agent_report_ota_status("failed");
+                    state = STATE_IDLE;
+                }
+                break;
+            }
+
+            TickType_t now = xTaskGetTickCount();
+            if ((now - last_heartbeat) >= pdMS_TO_TICKS(heartbeat_ms)) {
+                /* update_info belongs to the running download */
+                static ota_update_info_t hb_info;
+                ota_check_result_t check;
+                int retry_after = device_agent_send_heartbeat(FIRMWARE_VERSION, &hb_info, &check);
+                heartbeat_ms = server_interval_ms(retry_after, HEARTBEAT_INTERVAL_MS);
+                last_heartbeat = now;
+
+                if (check == OTA_NO_UPDATE ||
+                    (check == OTA_UPDATE_AVAILABLE &&
+                     strcmp(hb_info.deployment_id, update_info.deployment_id) != 0)) {
+                    ESP_LOGW(TAG, "Update withdrawn by server — cancelling download");
+                    ota_manager_download_cancel();
+                }
+            }
+
+            if (!wifi_manager_is_connected()) {
+                ESP_LOGW(TAG, "Wi-Fi lost during download — cancelling");
+                ota_manager_download_cancel();
             }
             break;
         }
@@ -247,7 +426,18 @@ static void agent_task(void *pvParameters)
 
             if (ota_manager_verify_hash(&update_info)) {
                 ESP_LOGI(TAG, "SHA-256 verification PASSED");
-                state = STATE_APPLY;
+                if (update_info.activate) {
+                    state = STATE_APPLY;
+                } else if (ota_manager_stage(&update_info)) {
+                    /* Reboot later, on the server's activation signal */
+                    device_agent_report_ota_status("staged");
+                    peer_cache_start();
+                    state = STATE_IDLE;
+                } else {
+                    ESP_LOGE(TAG, "Staging failed");
+                    device_agent_report_ota_status("failed");
+                    state = STATE_IDLE;
+                }
             } else {
                 ESP_LOGE(TAG, "SHA-256 verification FAILED — aborting OTA");
                 device_agent_report_ota_status("failed");
@@ -275,6 +465,25 @@ static void agent_task(void *pvParameters)
             break;
         }
 
+        /* ─── ACTIVATE ───────────────────────────────────────── */
+        case STATE_ACTIVATE: {
+            ESP_LOGI(TAG, "Activating staged firmware v%s...", update_info.version);
+
+            if (ota_manager_activate_staged()) {
+                ESP_LOGI(TAG, "Staged image activated — rebooting in 3s...");
+                device_agent_report_ota_status("applied");
+                vTaskDelay(pdMS_TO_TICKS(3000));
+                esp_restart();
+                /* Does not return */
+            } else {
+                /* Record dropped — the next check downloads it again */
+                ESP_LOGE(TAG, "Activation failed");
+                device_agent_report_ota_status("interrupted");
+                state = STATE_IDLE;
+            }
+            break;
+        }
+
         /* ─── HEALTH_CHECK ───────────────────────────────────── */
         case STATE_HEALTH_CHECK: {
             /* First, connect Wi-Fi (needed for health check) */
@@ -325,6 +534,7 @@ void app_main(void)
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
     /* Initialize subsystems */
+    http_pool_init();
     wifi_manager_init();
     ota_manager_init();
     device_agent_init();
@@ -7,165 +7,2122 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
+#include "esp_app_format.h"
+#include "esp_image_format.h"
 #include "esp_http_client.h"
 #include "esp_partition.h"
+#include "nvs.h"
 #include "mbedtls/sha256.h"
-#include "cJSON.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/base64.h"
+
+#include "json_stream.h"
+#include "lzss_stream.h"
+#include "delta_patch.h"
+#include "http_pool.h"
+#include "ota_pipeline.h"
 
 static const char *TAG = "OTA_MGR";
 
-/* ── Configuration ── adjust SERVER_BASE_URL to your fleet server ─ */
-#ifndef OTA_SERVER_BASE_URL
-#define OTA_SERVER_BASE_URL  "https://your-server.com"
-#endif
+/* ── Configuration ── adjust SERVER_BASE_URL to your fleet server ─ */
+#ifndef OTA_SERVER_BASE_URL
+#define OTA_SERVER_BASE_URL  "https://your-server.com"
+#endif
+
+#ifndef OTA_DEVICE_ID
+#define OTA_DEVICE_ID        "REPLACE_WITH_DEVICE_ID"
+#endif
+
+#define OTA_CHECK_MAX_RESPONSE  2048
+#define OTA_DOWNLOAD_BUF_SIZE   4096
+
+/* Download pipeline: receive buffers in flight between HTTP and flash */
+#ifndef OTA_PIPELINE_DEPTH
+#define OTA_PIPELINE_DEPTH      3
+#endif
+
+/* Background pre-erase: sectors per slice, pause between slices */
+#define OTA_PREERASE_SLICE_SECTORS  4
+#define OTA_PREERASE_PAUSE_MS       50
+
+/* Resumable downloads: NVS checkpoint every N committed bytes */
+#define NVS_NAMESPACE_OTA       "ota_resume"
+#define NVS_KEY_CHECKPOINT      "checkpoint"
+#define OTA_CHECKPOINT_BYTES    (32 * 1024)
+
+/* Chunk hashes: most chunks a list may have (x 32 bytes of RAM), and
+ * fetches of one chunk before the plain download gives up */
+#define OTA_CHUNK_MAX_COUNT     256
+#define OTA_CHUNK_MAX_ATTEMPTS  3
+
+/* Manifest signing key: DER public key + the server's key ID for it */
+#define NVS_NAMESPACE_KEYS      "ota_keys"
+#define NVS_KEY_PUBKEY          "pubkey"
+#define NVS_KEY_KEY_ID          "key_id"
+#define OTA_PUBKEY_MAX_DER      600
+#define OTA_SIGNATURE_MAX_B64   400
+
+/* Image head checked in-stream: esp_image_header_t, the first segment
+ * header, then esp_app_desc_t */
+#define OTA_APP_DESC_OFFSET     (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t))
+#define OTA_IMAGE_HEAD_LEN      (OTA_APP_DESC_OFFSET + sizeof(esp_app_desc_t))
+
+/* Deferred activation: the verified image waiting in the inactive slot */
+#define NVS_KEY_STAGED          "staged"
+
+/* Last image that passed image verification, kept for the peer cache */
+#define NVS_KEY_VERIFIED        "verified"
+
+/* Site-wide download cap (bytes/s, u32) set by provisioning; the stricter
+ * of this and the deployment's rate_limit_bps applies */
+#define NVS_NAMESPACE_CONFIG    "device_cfg"
+#define NVS_KEY_RATE_LIMIT      "ota_rate_bps"
+
+/* Stall watchdog: a stream whose rate over the sliding window stays below
+ * the floor (bytes/s; NVS device_cfg/ota_min_bps overrides, 0 = off) is
+ * dropped; the plain image then resumes from the next source */
+#ifndef OTA_STALL_MIN_BPS
+#define OTA_STALL_MIN_BPS       1024
+#endif
+#define NVS_KEY_MIN_THROUGHPUT  "ota_min_bps"
+#define OTA_STALL_SLOTS         10
+#define OTA_STALL_SLOT_US       (3 * 1000 * 1000)   /* 30 s window */
+#define OTA_STALL_PROBE_READ    512
+
+/* Mirrors: bytes fetched to probe a source, how long a ranking holds,
+ * and streams a source may lose in one download before it is skipped */
+#define OTA_MIRROR_PROBE_LEN     (16 * 1024)
+#define OTA_MIRROR_PROBE_TIMEOUT 5000
+#define OTA_MIRROR_RANK_TTL_MS   (60 * 60 * 1000)
+#define OTA_MIRROR_MAX_FAILS     3
+
+/* heatshrink parameters of delta patches and compressed images;
+ * must match build_service.py */
+#define OTA_LZSS_WINDOW_BITS     10
+#define OTA_LZSS_LOOKAHEAD_BITS  5
+
+/* Update watch (long-poll): consecutive failures before falling back to
+ * interval polling, backoff step between failures, and the pause before
+ * the watch may be started again */
+#define OTA_WATCH_MAX_FAILURES   5
+#define OTA_WATCH_BACKOFF_MS     (5 * 1000)
+#define OTA_WATCH_RESTART_MS     (10 * 60 * 1000)
+/* A TLS handshake plus the check request and streamed-parser buffers */
+#define OTA_WATCH_STACK_SIZE     8192
+
+/* Background download: runs below the agent task so heartbeats and
+ * Wi-Fi supervision keep going; a progress event per N image bytes */
+#define OTA_DOWNLOAD_STACK_SIZE  8192
+#define OTA_DOWNLOAD_PRIORITY    (tskIDLE_PRIORITY + 3)
+#define OTA_EVENT_QUEUE_LEN      8
+#define OTA_PROGRESS_STEP        (64 * 1024)
+
+/* ── Internal State ───────────────────────────────────────────── */
+static const esp_partition_t *s_update_part   = NULL;
+static mbedtls_sha256_context s_sha_ctx;
+static bool                   s_download_active = false;
+static int                    s_image_bytes   = 0;
+static uint8_t               *s_stage         = NULL;  /* pending sector + read-back  */
+static size_t                 s_stage_len     = 0;
+static uint32_t               s_flushed       = 0;     /* bytes on flash + in hash   */
+static uint32_t               s_sectors_kept  = 0;     /* identical, not rewritten   */
+static uint32_t               s_sectors_programmed = 0;
+static const ota_update_info_t *s_image_info  = NULL;  /* update being written     */
+static bool                   s_head_checked  = false;
+static bool                   s_image_rejected = false; /* wrong image: no fallback */
+
+/* Persisted in NVS so an interrupted download continues where it stopped */
+typedef struct {
+    char     deployment_id[64];
+    char     artifact_hash[OTA_MAX_HASH_LEN];
+    uint32_t partition_addr;
+    uint32_t offset;               /* sector-aligned bytes already on flash */
+    uint8_t  prefix_sha256[32];    /* SHA-256 of [0, offset)                */
+} ota_checkpoint_t;
+
+/* Phase timing accumulators (µs) behind ota_timings_t */
+typedef struct {
+    int64_t connect, first_byte, receive;
+    int64_t flash_read, flash_erase, flash_write, hash;
+    int64_t image_verify, set_boot, total, throttle, manifest, probe;
+} ota_phase_us_t;
+
+typedef struct {
+    char     deployment_id[64];
+    char     version[OTA_MAX_VERSION_LEN];
+    char     artifact_hash[OTA_MAX_HASH_LEN];
+    uint32_t partition_addr;
+    uint32_t size;
+} ota_staged_t;
+
+typedef struct {
+    char     artifact_hash[OTA_MAX_HASH_LEN];
+    uint32_t partition_addr;
+    uint32_t size;
+} ota_verified_t;
+
+/* Chunk hash list of the image being written (see Chunk Verification) */
+typedef struct {
+    uint8_t               *digests;     /* n x 32 bytes; NULL = no list      */
+    uint32_t               n;
+    uint32_t               size;        /* image bytes per chunk             */
+    uint32_t               image_size;
+    uint32_t               verified;    /* image bytes in verified chunks    */
+    uint32_t               failed_at;   /* chunk that failed last            */
+    int                    attempts;    /* consecutive failures of it        */
+    bool                   bad;         /* the stream stopped on a bad chunk */
+    mbedtls_sha256_context sha;         /* chunk being committed             */
+    mbedtls_sha256_context image_sha;   /* s_sha_ctx as of `verified`        */
+} ota_chunks_t;
+
+static ota_phase_us_t         s_phase_us;
+static ota_timings_t          s_timings;
+static bool                   s_timings_ready = false;
+
+static ota_chunks_t           s_chunks;
+static mbedtls_pk_context     s_sign_key;
+static char                   s_sign_key_id[OTA_MAX_KEY_ID_LEN] = "";  /* "" = none cached */
+static ota_staged_t           s_staged;                /* mirrors NVS_KEY_STAGED */
+static bool                   s_has_staged     = false;
+static ota_verified_t         s_verified;              /* mirrors NVS_KEY_VERIFIED */
+static volatile int           s_verified_state = 0;    /* 1 intact, -1 none, 0 unchecked */
+
+static char                   s_check_etag[48] = "";   /* last "no update" answer */
+static int                    s_retry_after_s  = 0;    /* server's next-check hint */
+
+static TaskHandle_t           s_watch_task     = NULL;
+static TaskHandle_t           s_watch_notify   = NULL;  /* woken on a hint      */
+static const char            *s_watch_version  = NULL;
+static int                    s_watch_wait_s   = 0;
+static volatile bool          s_watch_active   = false; /* long-poll is holding */
+static volatile bool          s_update_hint    = false;
+static TickType_t             s_watch_gave_up  = 0;
+static ota_update_info_t      s_watch_info;             /* parse scratch        */
+
+static QueueHandle_t          s_event_q        = NULL;
+static ota_update_info_t      s_dl_info;                /* download task's copy */
+static volatile bool          s_dl_running     = false;
+static volatile bool          s_dl_cancel      = false;
+static uint32_t               s_progress_posted = 0;
+
+static ota_checkpoint_t       s_checkpoint;
+static bool                   s_checkpointing   = false;
+static uint32_t               s_last_checkpoint = 0;
+
+/* Consumer for streamed HTTP body chunks; return false to abort */
+typedef bool (*ota_stream_consumer_t)(void *user, const uint8_t *data, size_t len);
+
+/* ── Helpers ──────────────────────────────────────────────────── */
+
+/* Convert binary hash to hex string */
+static void hash_to_hex(const uint8_t *hash, char *hex_out, size_t hash_len)
+{
+    for (size_t i = 0; i < hash_len; i++) {
+        sprintf(hex_out + i * 2, "%02x", hash[i]);
+    }
+    hex_out[hash_len * 2] = 0;
+}
+
+/* Server paths are relative to OTA_SERVER_BASE_URL; mirrors may be absolute */
+static void server_url(char *dst, size_t dst_len, const char *path)
+{
+    if (strncmp(path, "http://", 7) == 0 || strncmp(path, "https://", 8) == 0) {
+        snprintf(dst, dst_len, "%s", path);
+    } else {
+        snprintf(dst, dst_len, "%s%s", OTA_SERVER_BASE_URL, path);
+    }
+}
+
+/* Copy a streamed JSON string into a fixed-size field */
+static void copy_field(char *dst, size_t dst_len, const char *src)
+{
+    strncpy(dst, src, dst_len - 1);
+    dst[dst_len - 1] = 0;
+}
+
+/* ── Check Response Parsing ───────────────────────────────────── */
+
+typedef struct {
+    ota_update_info_t *info;
+    bool               update_available;
+    bool               answered;          /* update_available was present */
+} check_parse_ctx_t;
+
+/* Picks top-level members of the /api/ota/check response as they stream in */
+static void check_response_cb(void *user, const json_stream_t *js,
+                              json_stream_event_t ev,
+                              const char *value, size_t len)
+{
+    check_parse_ctx_t *ctx = (check_parse_ctx_t *)user;
+    ota_update_info_t *info = ctx->info;
+
+    if (json_stream_depth(js) == 2 && ev == JSON_STREAM_STRING &&
+        strcmp(json_stream_key(js, 0), "mirrors") == 0) {
+        if (info->mirror_count < OTA_MAX_MIRRORS) {
+            server_url(info->mirrors[info->mirror_count], OTA_MAX_URL_LEN, value);
+            info->mirror_count++;
+        }
+        return;
+    }
+    if (json_stream_depth(js) != 1) return;
+    const char *key = json_stream_key(js, 0);
+
+    if (strcmp(key, "update_available") == 0) {
+        ctx->update_available = (ev == JSON_STREAM_TRUE);
+        ctx->answered = true;
+    } else if (strcmp(key, "activate") == 0) {
+        info->activate = (ev == JSON_STREAM_TRUE);
+    } else if (ev == JSON_STREAM_NUMBER && strcmp(key, "artifact_size") == 0) {
+        info->artifact_size = (uint32_t)strtoul(value, NULL, 10);
+    } else if (ev == JSON_STREAM_NUMBER && strcmp(key, "delta_base_size") == 0) {
+        info->delta_base_size = (uint32_t)strtoul(value, NULL, 10);
+    } else if (ev == JSON_STREAM_NUMBER && strcmp(key, "rate_limit_bps") == 0) {
+        info->rate_limit_bps = (uint32_t)strtoul(value, NULL, 10);
+    } else if (ev == JSON_STREAM_NUMBER && strcmp(key, "chunk_size") == 0) {
+        info->chunk_size = (uint32_t)strtoul(value, NULL, 10);
+    } else if (ev != JSON_STREAM_STRING) {
+        return;
+    } else if (strcmp(key, "version") == 0) {
+        copy_field(info->version, sizeof(info->version), value);
+    } else if (strcmp(key, "artifact_hash") == 0) {
+        copy_field(info->artifact_hash, sizeof(info->artifact_hash), value);
+    } else if (strcmp(key, "download_url") == 0) {
+        /* Build full download URL */
+        snprintf(info->download_url, sizeof(info->download_url),
+                 "%s%s", OTA_SERVER_BASE_URL, value);
+    } else if (strcmp(key, "blob_url") == 0) {
+        server_url(info->blob_url, sizeof(info->blob_url), value);
+    } else if (strcmp(key, "deployment_id") == 0) {
+        copy_field(info->deployment_id, sizeof(info->deployment_id), value);
+    } else if (strcmp(key, "compressed_url") == 0) {
+        snprintf(info->compressed_url, sizeof(info->compressed_url),
+                 "%s%s", OTA_SERVER_BASE_URL, value);
+    } else if (strcmp(key, "compressed_hash") == 0) {
+        copy_field(info->compressed_hash, sizeof(info->compressed_hash), value);
+    } else if (strcmp(key, "delta_url") == 0) {
+        snprintf(info->delta_url, sizeof(info->delta_url),
+                 "%s%s", OTA_SERVER_BASE_URL, value);
+    } else if (strcmp(key, "delta_base_hash") == 0) {
+        copy_field(info->delta_base_hash, sizeof(info->delta_base_hash), value);
+    } else if (strcmp(key, "chunks_url") == 0) {
+        snprintf(info->chunks_url, sizeof(info->chunks_url),
+                 "%s%s", OTA_SERVER_BASE_URL, value);
+    } else if (strcmp(key, "chunk_root") == 0) {
+        copy_field(info->chunk_root, sizeof(info->chunk_root), value);
+    } else if (strcmp(key, "manifest_url") == 0) {
+        snprintf(info->manifest_url, sizeof(info->manifest_url),
+                 "%s%s", OTA_SERVER_BASE_URL, value);
+    } else if (strcmp(key, "signing_key_id") == 0) {
+        copy_field(info->signing_key_id, sizeof(info->signing_key_id), value);
+    } else if (strcmp(key, "app_project_name") == 0) {
+        copy_field(info->app_project_name, sizeof(info->app_project_name), value);
+    }
+}
+
+static void checkpoint_maybe_save(void);
+static void progress_maybe_post(void);
+
+/* ── Background Pre-Erase ─────────────────────────────────────── */
+/*
+ * Optionally erase the inactive slot ahead of time so the download only
+ * programs flash. [s_erase_base, s_erased_to) on s_erase_part is known
+ * erased; the eraser task grows it one sector at a time under
+ * s_erase_lock, and the writer either finds its sector inside it or
+ * erases the sector itself and pushes the region past it. The region
+ * therefore always stays ahead of everything written.
+ */
+
+static SemaphoreHandle_t      s_erase_lock      = NULL;
+static const esp_partition_t *s_erase_part      = NULL;
+static uint32_t               s_erase_base      = 0;
+static uint32_t               s_erased_to       = 0;
+static bool                   s_preerase_running = false;
+static int64_t                s_erase_us        = 0;   /* eraser time, for cost/sector */
+static uint32_t               s_erase_sectors   = 0;
+static uint32_t               s_preerase_hits   = 0;   /* sectors this session skipped */
+
+static void erase_lock_ensure(void)
+{
+    if (!s_erase_lock) {
+        s_erase_lock = xSemaphoreCreateMutex();
+    }
+}
+
+static uint32_t preerase_saved_ms(void)
+{
+    if (s_erase_sectors == 0) return 0;
+    return (uint32_t)((s_erase_us / s_erase_sectors) * s_preerase_hits / 1000);
+}
+
+/* Writer reached `offset` ahead of the eraser: restart its region beyond
+ * this sector so it never erases what the writer keeps. Lock held. */
+static void preerase_pass(uint32_t offset)
+{
+    if (s_erase_part == s_update_part && offset >= s_erased_to) {
+        if (offset > s_erased_to) s_erase_base = offset + SPI_FLASH_SEC_SIZE;
+        s_erased_to = offset + SPI_FLASH_SEC_SIZE;
+    }
+}
+
+/* Make sure the sector at `offset` of s_update_part is erased */
+static esp_err_t prepare_sector(uint32_t offset)
+{
+    erase_lock_ensure();
+    xSemaphoreTake(s_erase_lock, portMAX_DELAY);
+
+    esp_err_t err = ESP_OK;
+    if (s_erase_part == s_update_part && offset >= s_erase_base && offset < s_erased_to) {
+        s_preerase_hits++;
+    } else {
+        int64_t t0 = esp_timer_get_time();
+        err = esp_partition_erase_range(s_update_part, offset, SPI_FLASH_SEC_SIZE);
+        s_phase_us.flash_erase += esp_timer_get_time() - t0;
+        preerase_pass(offset);
+    }
+
+    xSemaphoreGive(s_erase_lock);
+    return err;
+}
+
+/* The sector at `offset` already holds the right bytes and is kept */
+static void preerase_keep(uint32_t offset)
+{
+    erase_lock_ensure();
+    xSemaphoreTake(s_erase_lock, portMAX_DELAY);
+    preerase_pass(offset);
+    xSemaphoreGive(s_erase_lock);
+}
+
+/* Sectors below `written_to` now hold data and are no longer erased */
+static void preerase_release(uint32_t written_to)
+{
+    uint32_t end = (written_to + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+    erase_lock_ensure();
+    xSemaphoreTake(s_erase_lock, portMAX_DELAY);
+    if (s_erase_part == s_update_part && s_erase_base < end) {
+        s_erase_base = end;
+        if (s_erased_to < end) s_erased_to = end;
+    }
+    xSemaphoreGive(s_erase_lock);
+}
+
+static void preerase_task(void *arg)
+{
+    const esp_partition_t *part = arg;
+    uint32_t done = 0;
+
+    for (;;) {
+        bool finished = false;
+        for (int i = 0; i < OTA_PREERASE_SLICE_SECTORS && !finished; i++) {
+            xSemaphoreTake(s_erase_lock, portMAX_DELAY);
+            if (s_erase_part != part || s_erased_to >= part->size) {
+                finished = true;
+            } else {
+                int64_t t0 = esp_timer_get_time();
+                if (esp_partition_erase_range(part, s_erased_to, SPI_FLASH_SEC_SIZE) == ESP_OK) {
+                    s_erase_us += esp_timer_get_time() - t0;
+                    s_erase_sectors++;
+                    s_erased_to += SPI_FLASH_SEC_SIZE;
+                    done++;
+                } else {
+                    ESP_LOGW(TAG, "Pre-erase failed at 0x%lx", (unsigned long)s_erased_to);
+                    finished = true;
+                }
+            }
+            xSemaphoreGive(s_erase_lock);
+        }
+        if (finished) break;
+        vTaskDelay(pdMS_TO_TICKS(OTA_PREERASE_PAUSE_MS));
+    }
+
+    ESP_LOGI(TAG, "Pre-erase of %s finished: %lu sectors", part->label, (unsigned long)done);
+    s_preerase_running = false;
+    vTaskDelete(NULL);
+}
+
+/* ── Chunk Verification ───────────────────────────────────────── */
+/*
+ * build_service.py hashes the image in fixed-size chunks (64 KB); the
+ * SHA-256 of the concatenated digests is the chunk root carried by the
+ * check answer and signed in the manifest. Each chunk is checked as soon
+ * as its last byte is committed, so corruption is caught one chunk in
+ * rather than after the whole image, and the plain download re-fetches
+ * from the failed chunk by Range. The image hash stays the final word;
+ * without a usable list the download simply runs unchunked.
+ */
+
+static void chunks_free(void)
+{
+    if (!s_chunks.digests) return;
+    free(s_chunks.digests);
+    mbedtls_sha256_free(&s_chunks.sha);
+    mbedtls_sha256_free(&s_chunks.image_sha);
+    memset(&s_chunks, 0, sizeof(s_chunks));
+}
+
+/* Fetch the digest list and check it against info->chunk_root */
+static void chunks_load(const ota_update_info_t *info)
+{
+    chunks_free();
+    if (!info->chunks_url[0] || !info->chunk_root[0] ||
+        info->chunk_size == 0 || info->chunk_size % SPI_FLASH_SEC_SIZE) {
+        return;
+    }
+    uint32_t n = (info->artifact_size + info->chunk_size - 1) / info->chunk_size;
+    if (n == 0 || n > OTA_CHUNK_MAX_COUNT) return;
+
+    uint8_t *digests = malloc(n * 32);
+    if (!digests) return;
+
+    bool ok = false;
+    esp_http_client_handle_t client = http_pool_acquire(info->chunks_url, HTTP_POOL_CONTROL,
+                                                        HTTP_METHOD_GET, 10000);
+    if (client) {
+        int64_t len = http_pool_request(client, NULL, 0);
+        if (len == (int64_t)n * 32 && esp_http_client_get_status_code(client) == 200) {
+            int got = 0;
+            while (got < len) {
+                int r = esp_http_client_read(client, (char *)digests + got, len - got);
+                if (r <= 0) break;
+                got += r;
+            }
+            ok = (got == len);
+        }
+        http_pool_release(client, ok);
+    }
+
+    if (ok) {
+        uint8_t root[32];
+        char hex_root[65];
+        mbedtls_sha256(digests, n * 32, root, 0);
+        hash_to_hex(root, hex_root, 32);
+        ok = (strcasecmp(hex_root, info->chunk_root) == 0);
+    }
+    if (!ok) {
+        ESP_LOGW(TAG, "No usable chunk list — verifying the image as a whole");
+        free(digests);
+        return;
+    }
+
+    s_chunks.digests    = digests;
+    s_chunks.n          = n;
+    s_chunks.size       = info->chunk_size;
+    s_chunks.image_size = info->artifact_size;
+    mbedtls_sha256_init(&s_chunks.sha);
+    mbedtls_sha256_init(&s_chunks.image_sha);
+    ESP_LOGI(TAG, "Chunk list: %lu chunks of %lu KB",
+             (unsigned long)n, (unsigned long)(info->chunk_size / 1024));
+}
+
+/* Everything committed so far is verified: start the next chunk there */
+static void chunks_rebase(void)
+{
+    if (!s_chunks.digests) return;
+    s_chunks.verified = s_flushed;
+    mbedtls_sha256_clone(&s_chunks.image_sha, &s_sha_ctx);
+    mbedtls_sha256_starts(&s_chunks.sha, 0);
+}
+
+/* Fresh write session */
+static void chunks_reset(void)
+{
+    s_chunks.failed_at = UINT32_MAX;
+    s_chunks.attempts  = 0;
+    s_chunks.bad       = false;
+    chunks_rebase();
+}
+
+/* Fold bytes just committed at the write front into the current chunk.
+ * @return false if that completed a chunk whose hash does not match. */
+static bool chunks_feed(const uint8_t *data, size_t len)
+{
+    if (!s_chunks.digests) return true;
+
+    uint32_t index = s_chunks.verified / s_chunks.size;
+    uint32_t end = s_chunks.verified + s_chunks.size;
+    if (end > s_chunks.image_size) end = s_chunks.image_size;
+    if (index >= s_chunks.n || s_flushed > end) {
+        ESP_LOGE(TAG, "Image runs past its chunk list");
+        return false;
+    }
+    mbedtls_sha256_update(&s_chunks.sha, data, len);
+    if (s_flushed < end) return true;
+
+    uint8_t hash[32];
+    mbedtls_sha256_finish(&s_chunks.sha, hash);
+    if (memcmp(hash, s_chunks.digests + index * 32, 32) != 0) {
+        ESP_LOGE(TAG, "Chunk %lu (0x%lx) hash mismatch",
+                 (unsigned long)index, (unsigned long)s_chunks.verified);
+        s_chunks.attempts  = (s_chunks.failed_at == index) ? s_chunks.attempts + 1 : 1;
+        s_chunks.failed_at = index;
+        s_chunks.bad       = true;
+        return false;
+    }
+    chunks_rebase();
+    return true;
+}
+
+/* After a stream stopped on a bad chunk: put the write front and image
+ * hash back to the chunk's start, if it has attempts left.
+ * @return true to re-fetch from s_flushed. */
+static bool chunks_retry(void)
+{
+    if (!s_chunks.bad) return false;
+    s_chunks.bad = false;
+    if (s_chunks.attempts >= OTA_CHUNK_MAX_ATTEMPTS) {
+        ESP_LOGE(TAG, "Chunk %lu failed %d times — giving up",
+                 (unsigned long)s_chunks.failed_at, s_chunks.attempts);
+        return false;
+    }
+
+    /* Its sectors were programmed, so they are no longer erased */
+    preerase_release(s_flushed);
+    mbedtls_sha256_free(&s_sha_ctx);
+    mbedtls_sha256_init(&s_sha_ctx);
+    mbedtls_sha256_clone(&s_sha_ctx, &s_chunks.image_sha);
+    s_flushed = s_image_bytes = s_chunks.verified;
+    s_stage_len = 0;
+    mbedtls_sha256_starts(&s_chunks.sha, 0);
+    s_timings.chunk_retries++;
+    ESP_LOGW(TAG, "Re-fetching chunk %lu from 0x%lx",
+             (unsigned long)s_chunks.failed_at, (unsigned long)s_flushed);
+    return true;
+}
+
+/* ── Image Write Session ──────────────────────────────────────── */
+/*
+ * Image bytes are staged into one flash sector and committed a sector at
+ * a time with esp_partition_write(); this module owns the erase, so the
+ * esp_ota handle API (which insists on erasing itself) is not used.
+ * esp_ota_set_boot_partition() verifies the finished image before it
+ * switches; an image that is only staged goes through esp_image_verify().
+ * A sector-aligned write front is what lets a download resume at a
+ * checkpoint, and keeps writes 16-byte aligned under flash encryption.
+ */
+
+/* Is the head of the incoming image an app for this chip and project,
+ * at the offered version, and not below our anti-rollback version? */
+static bool image_head_valid(const uint8_t *head)
+{
+    esp_image_header_t hdr;
+    esp_app_desc_t desc;
+    memcpy(&hdr, head, sizeof(hdr));
+    memcpy(&desc, head + OTA_APP_DESC_OFFSET, sizeof(desc));
+    const esp_app_desc_t *running = esp_app_get_description();
+    const ota_update_info_t *info = s_image_info;
+
+    /* Builds stamp project name and version only since app_project_name
+     * is announced; older ones carry the build directory's */
+    bool stamped = info->app_project_name[0] != '\0';
+    const char *why = NULL;
+    if (hdr.magic != ESP_IMAGE_HEADER_MAGIC || desc.magic_word != ESP_APP_DESC_MAGIC_WORD) {
+        why = "not an ESP app image";
+    } else if (hdr.chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID) {
+        why = "built for another chip";
+    } else if (desc.secure_version < running->secure_version) {
+        why = "secure version below the running app's";
+    } else if (stamped && strncmp(desc.project_name, info->app_project_name,
+                                  sizeof(desc.project_name)) != 0) {
+        why = "another project";
+    } else if (stamped && strncmp(desc.version, info->version, sizeof(desc.version)) != 0) {
+        why = "not the offered version";
+    }
+    if (why) {
+        ESP_LOGE(TAG, "Image rejected, %s: chip %d, project \"%.32s\", v%.32s, secure version %lu",
+                 why, (int)hdr.chip_id, desc.project_name, desc.version,
+                 (unsigned long)desc.secure_version);
+        return false;
+    }
+    ESP_LOGI(TAG, "Image head OK: %.32s v%.32s (IDF %.32s)",
+             desc.project_name, desc.version, desc.idf_ver);
+    return true;
+}
+
+/* Start a fresh write + hash session on s_update_part */
+static bool ota_session_begin(void)
+{
+    /* Staging sector followed by a read-back sector for the comparison */
+    s_stage = malloc(2 * SPI_FLASH_SEC_SIZE);
+    if (!s_stage) return false;
+
+    /* Initialize SHA-256 context for verification */
+    mbedtls_sha256_init(&s_sha_ctx);
+    mbedtls_sha256_starts(&s_sha_ctx, 0); /* 0 = SHA-256 (not SHA-224) */
+    s_stage_len   = 0;
+    s_flushed     = 0;
+    s_image_bytes = 0;
+    s_preerase_hits = 0;
+    s_sectors_kept  = 0;
+    s_sectors_programmed = 0;
+    s_head_checked  = false;
+    s_download_active = true;
+    chunks_reset();
+    return true;
+}
+
+static void ota_session_abort(void)
+{
+    preerase_release(s_flushed);
+    mbedtls_sha256_free(&s_sha_ctx);
+    free(s_stage);
+    s_stage = NULL;
+    s_download_active = false;
+}
+
+/* True if flash at s_flushed already holds exactly the staged bytes */
+static bool stage_matches_flash(void)
+{
+    uint8_t *current = s_stage + SPI_FLASH_SEC_SIZE;
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = esp_partition_read(s_update_part, s_flushed, current, s_stage_len);
+    s_phase_us.flash_read += esp_timer_get_time() - t0;
+    return err == ESP_OK && memcmp(current, s_stage, s_stage_len) == 0;
+}
+
+/* Commit the staged sector — erase + program only if flash differs —
+ * then fold it into the image hash */
+static bool stage_flush(void)
+{
+    if (s_stage_len == 0) return true;
+
+    esp_err_t err = ESP_OK;
+    if (stage_matches_flash()) {
+        preerase_keep(s_flushed);
+        s_sectors_kept++;
+    } else {
+        err = prepare_sector(s_flushed);
+        if (err == ESP_OK) {
+            int64_t t0 = esp_timer_get_time();
+            err = esp_partition_write(s_update_part, s_flushed, s_stage, s_stage_len);
+            s_phase_us.flash_write += esp_timer_get_time() - t0;
+        }
+        s_sectors_programmed++;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Flash write at 0x%lx failed: %s",
+                 (unsigned long)s_flushed, esp_err_to_name(err));
+        return false;
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    mbedtls_sha256_update(&s_sha_ctx, s_stage, s_stage_len);
+    s_flushed += s_stage_len;
+    bool chunk_ok = chunks_feed(s_stage, s_stage_len);
+    s_phase_us.hash += esp_timer_get_time() - t0;
+    s_stage_len = 0;
+    if (!chunk_ok) return false;
+    checkpoint_maybe_save();
+    progress_maybe_post();
+    return true;
+}
+
+/* Every reconstructed image byte goes through here */
+static bool image_write(const uint8_t *data, size_t len)
+{
+    if (s_flushed + s_stage_len + len > s_update_part->size) {
+        ESP_LOGE(TAG, "Image larger than partition %s", s_update_part->label);
+        return false;
+    }
+    if (s_image_info->artifact_size && s_image_bytes + len > s_image_info->artifact_size) {
+        ESP_LOGE(TAG, "Image longer than the announced %lu bytes",
+                 (unsigned long)s_image_info->artifact_size);
+        return false;
+    }
+    while (len > 0) {
+        size_t n = SPI_FLASH_SEC_SIZE - s_stage_len;
+        if (n > len) n = len;
+        memcpy(s_stage + s_stage_len, data, n);
+        s_stage_len   += n;
+        s_image_bytes += n;
+        data += n;
+        len  -= n;
+        /* Still in the first sector, so the stage holds the image head */
+        if (!s_head_checked && s_image_bytes >= (int)OTA_IMAGE_HEAD_LEN) {
+            s_head_checked = true;
+            if (!image_head_valid(s_stage)) {
+                s_image_rejected = true;
+                return false;
+            }
+        }
+        /* The image's last bytes close its last chunk: commit them now
+         * so that chunk is checked while the stream can still retry */
+        bool tail = s_chunks.digests && s_flushed + s_stage_len == s_chunks.image_size;
+        if ((s_stage_len == SPI_FLASH_SEC_SIZE || tail) && !stage_flush()) return false;
+    }
+    return true;
+}
+
+/* Commit the trailing partial sector; the image hash is final after this */
+static bool ota_session_finish(void)
+{
+    bool ok = stage_flush();
+    free(s_stage);
+    s_stage = NULL;
+    preerase_release(s_flushed);
+    ESP_LOGI(TAG, "Flash: %lu sectors programmed, %lu unchanged and skipped",
+             (unsigned long)s_sectors_programmed, (unsigned long)s_sectors_kept);
+    s_timings.sectors_programmed = s_sectors_programmed;
+    s_timings.sectors_skipped    = s_sectors_kept;
+    s_timings.preerase_saved_ms  = preerase_saved_ms();
+    if (s_preerase_hits) {
+        ESP_LOGI(TAG, "Pre-erase covered %lu sectors (~%lu ms of erase skipped)",
+                 (unsigned long)s_preerase_hits, (unsigned long)preerase_saved_ms());
+    }
+    return ok;
+}
+
+static bool consume_image(void *user, const uint8_t *data, size_t len)
+{
+    return image_write(data, len);
+}
+
+/* ── Resume Checkpoints ───────────────────────────────────────── */
+
+static void checkpoint_clear(void)
+{
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_OTA, NVS_READWRITE, &h) == ESP_OK) {
+        if (nvs_erase_key(h, NVS_KEY_CHECKPOINT) == ESP_OK) {
+            nvs_commit(h);
+        }
+        nvs_close(h);
+    }
+}
+
+static bool checkpoint_load(ota_checkpoint_t *cp)
+{
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_OTA, NVS_READONLY, &h) != ESP_OK) return false;
+    size_t len = sizeof(*cp);
+    esp_err_t err = nvs_get_blob(h, NVS_KEY_CHECKPOINT, cp, &len);
+    nvs_close(h);
+    return err == ESP_OK && len == sizeof(*cp);
+}
+
+/* Persist offset + hash of everything committed so far — with a chunk
+ * list, of everything verified so far */
+static void checkpoint_save(void)
+{
+    uint32_t offset = s_chunks.digests ? s_chunks.verified : s_flushed;
+    if (!s_checkpointing || offset == s_last_checkpoint) return;
+
+    mbedtls_sha256_context snap;
+    mbedtls_sha256_init(&snap);
+    mbedtls_sha256_clone(&snap, s_chunks.digests ? &s_chunks.image_sha : &s_sha_ctx);
+    mbedtls_sha256_finish(&snap, s_checkpoint.prefix_sha256);
+    mbedtls_sha256_free(&snap);
+    s_checkpoint.offset = offset;
+
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_OTA, NVS_READWRITE, &h) == ESP_OK) {
+        nvs_set_blob(h, NVS_KEY_CHECKPOINT, &s_checkpoint, sizeof(s_checkpoint));
+        nvs_commit(h);
+        nvs_close(h);
+        s_last_checkpoint = offset;
+    }
+}
+
+static void checkpoint_maybe_save(void)
+{
+    if (s_flushed - s_last_checkpoint >= OTA_CHECKPOINT_BYTES) {
+        checkpoint_save();
+    }
+}
+
+/* Re-hash the already-written prefix from flash and check it against the
+ * checkpoint. The running image hash then simply continues from there. */
+static bool session_restore(const ota_checkpoint_t *cp)
+{
+    if (cp->offset % SPI_FLASH_SEC_SIZE || cp->offset > s_update_part->size) return false;
+    if (s_chunks.digests && cp->offset % s_chunks.size) return false;
+
+    for (uint32_t off = 0; off < cp->offset; off += SPI_FLASH_SEC_SIZE) {
+        if (esp_partition_read(s_update_part, off, s_stage, SPI_FLASH_SEC_SIZE) != ESP_OK) {
+            return false;
+        }
+        int64_t t0 = esp_timer_get_time();
+        mbedtls_sha256_update(&s_sha_ctx, s_stage, SPI_FLASH_SEC_SIZE);
+        s_phase_us.hash += esp_timer_get_time() - t0;
+    }
+
+    uint8_t prefix[32];
+    mbedtls_sha256_context snap;
+    mbedtls_sha256_init(&snap);
+    mbedtls_sha256_clone(&snap, &s_sha_ctx);
+    mbedtls_sha256_finish(&snap, prefix);
+    mbedtls_sha256_free(&snap);
+    if (memcmp(prefix, cp->prefix_sha256, sizeof(prefix)) != 0) return false;
+
+    s_flushed = s_image_bytes = s_last_checkpoint = cp->offset;
+    s_head_checked = cp->offset > 0;   /* checked before the checkpoint */
+    chunks_rebase();
+    return true;
+}
+
+/* ── Rate Limiting ────────────────────────────────────────────── */
+
+/*
+ * Token bucket charged after every read: tokens refill at `rate` bytes/s
+ * up to a quarter second's worth, and a read that overdraws the bucket
+ * sleeps off the debt. Reads are at most OTA_DOWNLOAD_BUF_SIZE, so the
+ * pacing is smooth at that granularity; while we sleep, TCP flow control
+ * holds the sender back instead of the link.
+ */
+typedef struct {
+    uint32_t rate;      /* bytes/s, 0 = unlimited */
+    int64_t  tokens;
+    int64_t  last_us;
+} rate_bucket_t;
+
+static rate_bucket_t s_bucket;
+
+static uint32_t rate_limit_for(const ota_update_info_t *info)
+{
+    uint32_t rate = info->rate_limit_bps;
+    uint32_t site = 0;
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_CONFIG, NVS_READONLY, &h) == ESP_OK) {
+        nvs_get_u32(h, NVS_KEY_RATE_LIMIT, &site);
+        nvs_close(h);
+    }
+    if (site && (!rate || site < rate)) rate = site;
+    return rate;
+}
+
+static int64_t rate_burst(void)
+{
+    int64_t burst = s_bucket.rate / 4;
+    return burst > OTA_DOWNLOAD_BUF_SIZE ? burst : OTA_DOWNLOAD_BUF_SIZE;
+}
+
+static void rate_limit_begin(uint32_t rate)
+{
+    s_bucket.rate    = rate;
+    s_bucket.tokens  = rate_burst();
+    s_bucket.last_us = esp_timer_get_time();
+    if (rate) {
+        ESP_LOGI(TAG, "Download capped at %lu B/s", (unsigned long)rate);
+    }
+}
+
+static void rate_limit_take(size_t n)
+{
+    if (!s_bucket.rate) return;
+
+    int64_t now = esp_timer_get_time();
+    s_bucket.tokens += (now - s_bucket.last_us) * s_bucket.rate / 1000000;
+    if (s_bucket.tokens > rate_burst()) s_bucket.tokens = rate_burst();
+    s_bucket.last_us = now;
+    s_bucket.tokens -= (int64_t)n;
+    if (s_bucket.tokens >= 0) return;
+
+    /* Oversleeping by up to a tick is refunded by the next refill */
+    int64_t debt_us = -s_bucket.tokens * 1000000 / s_bucket.rate;
+    TickType_t ticks = pdMS_TO_TICKS(debt_us / 1000);
+    vTaskDelay(ticks > 0 ? ticks : 1);
+    s_phase_us.throttle += esp_timer_get_time() - now;
+}
+
+/* ── Stall Watchdog ───────────────────────────────────────────── */
+
+/*
+ * The HTTP timeout only fires when a read gets no data at all, so a link
+ * trickling a few bytes a second could hold a download for hours. Bytes
+ * are counted per slot over a sliding window; once a full window has
+ * passed, a window averaging below the floor stops the stream. A read
+ * returns only when its buffer is full, so while the link runs slow the
+ * reads shrink to OTA_STALL_PROBE_READ to keep the check responsive.
+ */
+typedef struct {
+    uint32_t floor_bps;                 /* 0 = off                      */
+    int64_t  start_us;                  /* of the current stream        */
+    int64_t  slot;                      /* newest slot index            */
+    uint32_t bytes[OTA_STALL_SLOTS];
+    bool     slow;                      /* last read ran below 2x floor */
+    bool     tripped;                   /* last stream stopped on it    */
+    uint32_t min_bps;                   /* lowest full-window rate seen */
+} stall_watch_t;
+
+static stall_watch_t s_stall;
+
+/* Per download: floor from config, never above half a deliberate cap */
+static void stall_watch_setup(uint32_t rate_cap)
+{
+    uint32_t floor = OTA_STALL_MIN_BPS;
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_CONFIG, NVS_READONLY, &h) == ESP_OK) {
+        nvs_get_u32(h, NVS_KEY_MIN_THROUGHPUT, &floor);
+        nvs_close(h);
+    }
+    if (rate_cap && floor > rate_cap / 2) floor = rate_cap / 2;
+
+    memset(&s_stall, 0, sizeof(s_stall));
+    s_stall.floor_bps = floor;
+    s_stall.min_bps   = UINT32_MAX;
+}
+
+static void stall_watch_begin(void)
+{
+    memset(s_stall.bytes, 0, sizeof(s_stall.bytes));
+    s_stall.start_us = esp_timer_get_time();
+    s_stall.slot     = 0;
+    s_stall.slow     = false;
+    s_stall.tripped  = false;
+}
+
+static int stall_read_len(void)
+{
+    return s_stall.slow ? OTA_STALL_PROBE_READ : OTA_DOWNLOAD_BUF_SIZE;
+}
+
+/* Account a read of `n` bytes that took `read_us`.
+ * @return true if the window average fell below the floor. */
+static bool stall_watch_update(size_t n, int64_t read_us)
+{
+    if (!s_stall.floor_bps) return false;
+
+    int64_t elapsed = esp_timer_get_time() - s_stall.start_us;
+    int64_t slot = elapsed / OTA_STALL_SLOT_US;
+    for (int i = 0; i < OTA_STALL_SLOTS && s_stall.slot < slot; i++) {
+        s_stall.bytes[++s_stall.slot % OTA_STALL_SLOTS] = 0;
+    }
+    s_stall.slot = slot;
+    s_stall.bytes[slot % OTA_STALL_SLOTS] += n;
+    s_stall.slow = read_us > 0 && (int64_t)n * 1000000 / read_us < 2 * (int64_t)s_stall.floor_bps;
+
+    /* The first window is grace: connect, TCP slow start */
+    if (slot < OTA_STALL_SLOTS) return false;
+
+    uint64_t sum = 0;
+    for (int i = 0; i < OTA_STALL_SLOTS; i++) sum += s_stall.bytes[i];
+    int64_t window_us = (OTA_STALL_SLOTS - 1) * (int64_t)OTA_STALL_SLOT_US +
+                        elapsed % OTA_STALL_SLOT_US;
+    uint32_t bps = (uint32_t)(sum * 1000000 / window_us);
+    if (bps < s_stall.min_bps) s_stall.min_bps = bps;
+    if (bps >= s_stall.floor_bps) return false;
+
+    ESP_LOGW(TAG, "Stalled: %lu B/s over %lld s, floor %lu B/s",
+             (unsigned long)bps, (long long)(window_us / 1000000),
+             (unsigned long)s_stall.floor_bps);
+    s_stall.tripped = true;
+    s_timings.stall_aborts++;
+    return true;
+}
+
+/* ── Mirror Selection ─────────────────────────────────────────── */
+
+/*
+ * The plain image can come from blob_url, download_url or any of
+ * info->mirrors (site caches, other servers). The content-addressed
+ * blob_url goes first so caches between us and the server can answer
+ * it. With more than one origin, each is probed with a short Range
+ * request: time to the response headers gives its RTT, the body its
+ * throughput. Sources are ranked by the time they would take for the
+ * rest of the image. Stats are kept per origin so the ranking carries
+ * over to later downloads for OTA_MIRROR_RANK_TTL_MS, refined by the
+ * rate real streams achieve; they live in RAM, so a reboot re-probes.
+ */
+typedef struct {
+    char       origin[96];
+    uint32_t   rtt_ms;
+    uint32_t   bps;                     /* 0 = unusable at last probe  */
+    uint32_t   fails;                   /* streams lost since probed   */
+    TickType_t probed;                  /* 0 = never                   */
+} mirror_stat_t;
+
+typedef struct {
+    const char    *url;
+    mirror_stat_t *stat;
+    int            fails;               /* streams lost this download  */
+} ota_source_t;
+
+static mirror_stat_t s_mirror_stats[OTA_MAX_MIRRORS + 2];
+static ota_source_t  s_sources[OTA_MAX_MIRRORS + 2];
+static int           s_source_count = 0;
+static int           s_source       = 0;   /* serving the plain image */
+static bool          s_stream_refused = false;   /* bad HTTP status      */
+
+/* Stats of `url`'s origin; a new origin replaces the stalest entry not
+ * taken by the first `assigned` sources */
+static mirror_stat_t *mirror_stat_for(const char *url, int assigned)
+{
+    char origin[sizeof(s_mirror_stats[0].origin)];
+    http_pool_origin(url, origin, sizeof(origin));
+
+    mirror_stat_t *oldest = NULL;
+    for (int i = 0; i < OTA_MAX_MIRRORS + 2; i++) {
+        mirror_stat_t *m = &s_mirror_stats[i];
+        if (strcmp(m->origin, origin) == 0) return m;
+        bool taken = false;
+        for (int j = 0; j < assigned; j++) taken |= s_sources[j].stat == m;
+        if (!taken && (!oldest || m->probed < oldest->probed)) oldest = m;
+    }
+    memset(oldest, 0, sizeof(*oldest));
+    strcpy(oldest->origin, origin);
+    return oldest;
+}
+
+/* Fetch the first OTA_MIRROR_PROBE_LEN bytes; a source that cannot do
+ * Range requests cannot take over mid-download, so it ranks last */
+static void mirror_probe(mirror_stat_t *m, const char *url)
+{
+    m->probed = xTaskGetTickCount() | 1;
+    m->fails  = 0;
+    m->bps    = 0;
+
+    uint8_t *buf = malloc(OTA_DOWNLOAD_BUF_SIZE);
+    esp_http_client_handle_t client = buf
+        ? http_pool_acquire(url, HTTP_POOL_BULK, HTTP_METHOD_GET, OTA_MIRROR_PROBE_TIMEOUT) : NULL;
+    if (!client) {
+        free(buf);
+        return;
+    }
+    char range[32];
+    snprintf(range, sizeof(range), "bytes=0-%d", OTA_MIRROR_PROBE_LEN - 1);
+    esp_http_client_set_header(client, "Range", range);
+
+    int64_t t0 = esp_timer_get_time();
+    if (http_pool_request(client, NULL, 0) >= 0 &&
+        esp_http_client_get_status_code(client) == 206) {
+        int64_t t1 = esp_timer_get_time();
+        int total = 0, n;
+        while (total < OTA_MIRROR_PROBE_LEN &&
+               (n = esp_http_client_read(client, (char *)buf, OTA_DOWNLOAD_BUF_SIZE)) > 0) {
+            total += n;
+        }
+        int64_t t2 = esp_timer_get_time();
+        m->rtt_ms = (uint32_t)((t1 - t0) / 1000);
+        if (total == OTA_MIRROR_PROBE_LEN && t2 > t1) {
+            m->bps = (uint32_t)((int64_t)total * 1000000 / (t2 - t1));
+        }
+    }
+    /* Losers must not hold a TLS session open; the winner reconnects */
+    http_pool_release(client, false);
+    free(buf);
+
+    ESP_LOGI(TAG, "Probed %s: rtt %lu ms, %lu B/s", m->origin,
+             (unsigned long)m->rtt_ms, (unsigned long)m->bps);
+}
+
+/* Estimated ms for `bytes` from a source; unusable sources go last */
+static uint64_t mirror_cost(const mirror_stat_t *m, uint32_t bytes)
+{
+    if (!m->bps) return UINT64_MAX;
+    return m->rtt_ms + (uint64_t)bytes * 1000 / m->bps;
+}
+
+/* Order the image's sources, best first. Once per download. */
+static void mirrors_rank(const ota_update_info_t *info)
+{
+    if (s_source_count) return;
+
+    if (info->blob_url[0]) {
+        s_sources[s_source_count++] = (ota_source_t){ .url = info->blob_url };
+    }
+    s_sources[s_source_count++] = (ota_source_t){ .url = info->download_url };
+    for (int i = 0; i < info->mirror_count && i < OTA_MAX_MIRRORS; i++) {
+        s_sources[s_source_count++] = (ota_source_t){ .url = info->mirrors[i] };
+    }
+    s_source = 0;
+    if (!info->mirror_count) return;   /* all on the server: nothing to rank */
+
+    int64_t t0 = esp_timer_get_time();
+    TickType_t now = xTaskGetTickCount();
+    for (int i = 0; i < s_source_count; i++) {
+        mirror_stat_t *m = mirror_stat_for(s_sources[i].url, i);
+        if (!m->probed || m->fails ||
+            now - m->probed > pdMS_TO_TICKS(OTA_MIRROR_RANK_TTL_MS)) {
+            mirror_probe(m, s_sources[i].url);
+        }
+        s_sources[i].stat = m;
+    }
+    s_phase_us.probe += esp_timer_get_time() - t0;
+
+    uint32_t left = info->artifact_size > (uint32_t)s_image_bytes
+                  ? info->artifact_size - (uint32_t)s_image_bytes : OTA_MIRROR_PROBE_LEN;
+    for (int i = 1; i < s_source_count; i++) {
+        ota_source_t src = s_sources[i];
+        int j = i;
+        for (; j > 0 && mirror_cost(s_sources[j - 1].stat, left) > mirror_cost(src.stat, left); j--) {
+            s_sources[j] = s_sources[j - 1];
+        }
+        s_sources[j] = src;
+    }
+    ESP_LOGI(TAG, "Best source: %s", s_sources[0].stat->origin);
+}
+
+static const char *mirror_url(void)
+{
+    return s_sources[s_source].url;
+}
+
+/* The best source is somewhere other than the server: prefer the plain
+ * image from it over fetching a variant from the server */
+static bool mirror_preferred(void)
+{
+    const char *base = OTA_SERVER_BASE_URL;
+    return s_source_count > 1 && strncmp(s_sources[0].url, base, strlen(base)) != 0;
+}
+
+/* Fold a finished stream into the source's rate for later rankings */
+static void mirror_account(uint32_t bytes, int64_t us)
+{
+    mirror_stat_t *m = s_sources[s_source].stat;
+    if (!m || bytes < OTA_MIRROR_PROBE_LEN || us <= 0) return;
+    uint32_t bps = (uint32_t)((int64_t)bytes * 1000000 / us);
+    m->bps = m->bps ? (m->bps * 3 + bps) / 4 : bps;
+}
+
+/* The current source lost a stream: move on to the next ranked source
+ * with tries left (possibly the same one). Resuming is by Range. */
+static bool mirror_failover(void)
+{
+    ota_source_t *cur = &s_sources[s_source];
+    cur->fails++;
+    if (cur->stat) cur->stat->fails++;
+
+    for (int k = 1; k <= s_source_count; k++) {
+        int i = (s_source + k) % s_source_count;
+        if (s_sources[i].fails >= OTA_MIRROR_MAX_FAILS) continue;
+        if (i != s_source) {
+            s_timings.mirror_switches++;
+            s_source = i;
+        }
+        ESP_LOGW(TAG, "Resuming at %d bytes from %s", s_image_bytes, mirror_url());
+        return true;
+    }
+    return false;
+}
+
+/* ── HTTP Streaming ───────────────────────────────────────────── */
+
+/*
+ * GET `url` from byte `range_start` and hand the body to `consume` chunk
+ * by chunk. Returns OTA_DOWNLOAD_TIMEOUT for transport problems and
+ * stalls (worth resuming), OTA_DOWNLOAD_CANCELLED once ota_manager_download_cancel()
+ * is seen between reads, and OTA_DOWNLOAD_FAIL for everything else.
+ */
+static ota_download_result_t http_stream(const char *url, uint32_t range_start,
+                                         ota_stream_consumer_t consume, void *user)
+{
+    s_stream_refused = false;
+    esp_http_client_handle_t client = http_pool_acquire(url, HTTP_POOL_BULK, HTTP_METHOD_GET, 30000);
+    if (!client) return OTA_DOWNLOAD_FAIL;
+    esp_http_client_delete_header(client, "Range");
+    if (range_start > 0) {
+        char range[32];
+        snprintf(range, sizeof(range), "bytes=%lu-", (unsigned long)range_start);
+        esp_http_client_set_header(client, "Range", range);
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    int64_t content_len = http_pool_request(client, NULL, 0);
+    int64_t connect_us = http_pool_connect_us(client);
+    s_phase_us.connect    += connect_us;
+    s_phase_us.first_byte += esp_timer_get_time() - t0 - connect_us;
+    if (content_len < 0) {
+        ESP_LOGE(TAG, "HTTP request failed for %s", url);
+        http_pool_release(client, false);
+        return OTA_DOWNLOAD_TIMEOUT;
+    }
+
+    int status = esp_http_client_get_status_code(client);
+    ESP_LOGI(TAG, "Content length: %lld bytes", (long long)content_len);
+    if (status != (range_start > 0 ? 206 : 200)) {
+        ESP_LOGE(TAG, "HTTP status %d for %s", status, url);
+        http_pool_release(client, false);
+        s_stream_refused = true;
+        return OTA_DOWNLOAD_FAIL;
+    }
+
+    ota_pipeline_t pipe;
+    if (!ota_pipeline_start(&pipe, OTA_PIPELINE_DEPTH, OTA_DOWNLOAD_BUF_SIZE, consume, user)) {
+        http_pool_release(client, false);
+        return OTA_DOWNLOAD_FAIL;
+    }
+
+    /* Receiver side: fill free buffers while the writer drains full ones */
+    int64_t t_start = esp_timer_get_time();
+    int64_t total = 0;
+    int read_len = 0;
+    bool stalled = false;
+    ota_chunk_t chunk;
+    stall_watch_begin();
+    while (!pipe.failed && !s_dl_cancel && !stalled) {
+        ota_pipeline_acquire(&pipe, &chunk);
+        int64_t t_read = esp_timer_get_time();
+        read_len = esp_http_client_read(client, (char *)chunk.data, stall_read_len());
+        chunk.len = read_len;
+        ota_pipeline_submit(&pipe, &chunk);
+        if (read_len <= 0) break;
+        total += read_len;
+        if (content_len <= 0 || total < content_len) {
+            stalled = stall_watch_update(read_len, esp_timer_get_time() - t_read);
+        }
+        rate_limit_take(read_len);
+        if (total % (64 * 1024) == 0) {
+            ESP_LOGI(TAG, "Downloaded %lld bytes...", (long long)(range_start + total));
+        }
+    }
+    ota_pipeline_stop(&pipe);
+
+    int64_t elapsed_us = esp_timer_get_time() - t_start;
+    s_phase_us.receive += elapsed_us;
+    s_timings.bytes_received += (uint32_t)total;
+    ESP_LOGI(TAG, "Pipeline: %lld bytes in %lld ms (%lld ms writing, depth %d)",
+             (long long)total, (long long)(elapsed_us / 1000),
+             (long long)(pipe.consume_us / 1000), OTA_PIPELINE_DEPTH);
+
+    ota_download_result_t res = OTA_DOWNLOAD_OK;
+    if (pipe.failed) {
+        res = OTA_DOWNLOAD_FAIL;
+    } else if (s_dl_cancel) {
+        ESP_LOGW(TAG, "Download cancelled after %lld bytes", (long long)total);
+        res = OTA_DOWNLOAD_CANCELLED;
+    } else if (stalled) {
+        res = OTA_DOWNLOAD_TIMEOUT;
+    } else if (read_len < 0) {
+        ESP_LOGE(TAG, "HTTP read error after %lld bytes", (long long)total);
+        res = OTA_DOWNLOAD_TIMEOUT;
+    } else if (content_len > 0 && total != content_len) {
+        ESP_LOGE(TAG, "Truncated body: %lld of %lld bytes",
+                 (long long)total, (long long)content_len);
+        res = OTA_DOWNLOAD_TIMEOUT;
+    }
+
+    http_pool_release(client, res == OTA_DOWNLOAD_OK);
+    return res;
+}
+
+/* ── Plain Images ─────────────────────────────────────────────── */
+
+/* Stream the uncompressed image from s_flushed onwards. Only this path
+ * maps 1:1 onto flash offsets, so only this path is checkpointed,
+ * re-fetches bad chunks and switches source mid-way. */
+static ota_download_result_t download_plain(const ota_update_info_t *info)
+{
+    memset(&s_checkpoint, 0, sizeof(s_checkpoint));
+    copy_field(s_checkpoint.deployment_id, sizeof(s_checkpoint.deployment_id), info->deployment_id);
+    copy_field(s_checkpoint.artifact_hash, sizeof(s_checkpoint.artifact_hash), info->artifact_hash);
+    s_checkpoint.partition_addr = s_update_part->address;
+    s_last_checkpoint = s_flushed;
+    s_checkpointing = true;
+
+    /* Every byte received is consumed by now, so s_image_bytes is where
+     * the next request picks up */
+    mirrors_rank(info);
+    ota_download_result_t res;
+    for (;;) {
+        uint32_t bytes0 = s_timings.bytes_received;
+        int64_t  us0    = s_phase_us.receive;
+        res = http_stream(mirror_url(), (uint32_t)s_image_bytes, consume_image, NULL);
+        mirror_account(s_timings.bytes_received - bytes0, s_phase_us.receive - us0);
+        if (res == OTA_DOWNLOAD_OK || res == OTA_DOWNLOAD_CANCELLED) break;
+        if (res == OTA_DOWNLOAD_FAIL && chunks_retry()) {
+            /* The bad bytes may be the source's: take the chunk elsewhere */
+            if (s_source_count > 1) mirror_failover();
+            continue;
+        }
+        if ((res == OTA_DOWNLOAD_TIMEOUT || s_stream_refused) && mirror_failover()) continue;
+        break;
+    }
+    if (res == OTA_DOWNLOAD_TIMEOUT || res == OTA_DOWNLOAD_CANCELLED) {
+        checkpoint_save();   /* keep everything committed so far */
+    }
+    s_checkpointing = false;
+
+    if (res == OTA_DOWNLOAD_OK && !ota_session_finish()) {
+        res = OTA_DOWNLOAD_FAIL;
+    }
+    if (res != OTA_DOWNLOAD_OK) {
+        if (res == OTA_DOWNLOAD_FAIL) checkpoint_clear();
+        ota_session_abort();
+        return res;
+    }
+
+    checkpoint_clear();
+    ESP_LOGI(TAG, "Download complete: %d bytes total", s_image_bytes);
+    return OTA_DOWNLOAD_OK;
+}
+
+/* ── Compressed Images ────────────────────────────────────────── */
+
+typedef struct {
+    lzss_stream_t          lz;
+    mbedtls_sha256_context wire_sha;   /* hash of the bytes as received */
+} compressed_session_t;
+
+static bool lzss_out_image(void *user, const uint8_t *data, size_t len)
+{
+    return image_write(data, len);
+}
+
+static bool consume_compressed(void *user, const uint8_t *data, size_t len)
+{
+    compressed_session_t *cs = (compressed_session_t *)user;
+    mbedtls_sha256_update(&cs->wire_sha, data, len);
+    return lzss_stream_feed(&cs->lz, data, len, lzss_out_image, cs);
+}
+
+/* Download the compressed image and inflate it straight into the partition.
+ * Peak extra RAM is one lzss_stream_t (1 KB window + state). */
+static bool download_compressed(const ota_update_info_t *info)
+{
+    compressed_session_t *cs = calloc(1, sizeof(*cs));
+    if (!cs) return false;
+
+    lzss_stream_init(&cs->lz, OTA_LZSS_WINDOW_BITS, OTA_LZSS_LOOKAHEAD_BITS);
+    mbedtls_sha256_init(&cs->wire_sha);
+    mbedtls_sha256_starts(&cs->wire_sha, 0);
+
+    ESP_LOGI(TAG, "Compressed download from: %s", info->compressed_url);
+    bool ok = http_stream(info->compressed_url, 0, consume_compressed, cs) == OTA_DOWNLOAD_OK &&
+              lzss_stream_finish(&cs->lz, lzss_out_image, cs) &&
+              ota_session_finish();
+
+    uint8_t hash[32];
+    char hex_hash[65];
+    mbedtls_sha256_finish(&cs->wire_sha, hash);
+    mbedtls_sha256_free(&cs->wire_sha);
+    hash_to_hex(hash, hex_hash, 32);
+    if (ok && info->compressed_hash[0] &&
+        strcasecmp(hex_hash, info->compressed_hash) != 0) {
+        ESP_LOGE(TAG, "Compressed stream hash mismatch");
+        ok = false;
+    }
+    if (ok) {
+        ESP_LOGI(TAG, "Inflated %lu bytes to %d bytes",
+                 (unsigned long)cs->lz.total_in, s_image_bytes);
+    }
+
+    free(cs);
+    return ok;
+}
+
+/* ── Delta Updates ────────────────────────────────────────────── */
+
+typedef struct {
+    lzss_stream_t          lz;
+    delta_patch_t          patch;
+    const esp_partition_t *source;
+} delta_session_t;
+
+/* Hash the first `size` bytes of `part` against `expected_hex` */
+static bool partition_hash_matches(const esp_partition_t *part,
+                                   const char *expected_hex, uint32_t size)
+{
+    if (!expected_hex[0] || size == 0 || size > part->size) return false;
+
+    uint8_t *buf = malloc(1024);
+    if (!buf) return false;
+
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    bool ok = true;
+    for (uint32_t off = 0; off < size && ok; off += 1024) {
+        size_t n = (size - off) < 1024 ? (size - off) : 1024;
+        ok = (esp_partition_read(part, off, buf, n) == ESP_OK);
+        if (ok) mbedtls_sha256_update(&ctx, buf, n);
+    }
+    uint8_t hash[32];
+    mbedtls_sha256_finish(&ctx, hash);
+    mbedtls_sha256_free(&ctx);
+    free(buf);
+
+    char hex_hash[65];
+    hash_to_hex(hash, hex_hash, 32);
+    return ok && strcasecmp(hex_hash, expected_hex) == 0;
+}
+
+static bool running_image_matches(const char *expected_hex, uint32_t size)
+{
+    if (partition_hash_matches(esp_ota_get_running_partition(), expected_hex, size)) {
+        return true;
+    }
+    ESP_LOGI(TAG, "Running image is not the delta base — full download");
+    return false;
+}
+
+static bool delta_read_running(void *user, uint32_t offset, uint8_t *buf, size_t len)
+{
+    delta_session_t *ds = (delta_session_t *)user;
+    return esp_partition_read(ds->source, offset, buf, len) == ESP_OK;
+}
+
+static bool delta_write_image(void *user, const uint8_t *data, size_t len)
+{
+    return image_write(data, len);
+}
+
+static bool delta_lzss_out(void *user, const uint8_t *data, size_t len)
+{
+    delta_session_t *ds = (delta_session_t *)user;
+    return delta_patch_feed(&ds->patch, data, len);
+}
+
+static bool consume_delta(void *user, const uint8_t *data, size_t len)
+{
+    delta_session_t *ds = (delta_session_t *)user;
+    return lzss_stream_feed(&ds->lz, data, len, delta_lzss_out, ds);
+}
+
+/* Download the compressed patch and rebuild the image from the running partition */
+static bool download_delta(const ota_update_info_t *info)
+{
+    delta_session_t *ds = calloc(1, sizeof(*ds));
+    if (!ds) return false;
+
+    ds->source = esp_ota_get_running_partition();
+    lzss_stream_init(&ds->lz, OTA_LZSS_WINDOW_BITS, OTA_LZSS_LOOKAHEAD_BITS);
+    delta_patch_init(&ds->patch, delta_read_running, delta_write_image, ds);
+
+    ESP_LOGI(TAG, "Delta download from: %s (base %s)",
+             info->delta_url, ds->source->label);
+    bool ok = http_stream(info->delta_url, 0, consume_delta, ds) == OTA_DOWNLOAD_OK &&
+              lzss_stream_finish(&ds->lz, delta_lzss_out, ds) &&
+              delta_patch_finish(&ds->patch) &&
+              ota_session_finish();
+
+    free(ds);
+    return ok;
+}
+
+/* ── Signed Manifests ─────────────────────────────────────────── */
+/*
+ * build_service.py signs each build's manifest (sorted-key JSON) with the
+ * fleet signing key. Before a download the agent fetches exactly those
+ * signed bytes, checks the signature against the public key cached in
+ * NVS, and requires the check answer to agree with the manifest on
+ * version, image hash, size, chunk root and project, so an image is trusted for
+ * what was signed at build time, not for what served it. ECDSA P-256
+ * and RSA keys both go through mbedtls_pk; the manifest names its
+ * algorithm and it must be the cached key's. RSA is the cheaper check
+ * here: the C3 accelerates RSA and runs P-256 in software. The key is
+ * fetched on first use and again only when the check answer names
+ * another key ID (rotation). A rotated key is only taken if its
+ * X-Key-Signature, a signature by the cached key over the new key's DER,
+ * verifies, so whoever serves the key cannot swap in their own. Once a
+ * key is cached, updates that come without a signed manifest are refused.
+ */
+
+/* Replace the cached key; on a parse error the old one stays */
+static bool sign_key_set(const uint8_t *der, size_t len, const char *key_id)
+{
+    mbedtls_pk_context key;
+    mbedtls_pk_init(&key);
+    if (mbedtls_pk_parse_public_key(&key, der, len) != 0) {
+        mbedtls_pk_free(&key);
+        return false;
+    }
+    mbedtls_pk_free(&s_sign_key);
+    s_sign_key = key;
+    copy_field(s_sign_key_id, sizeof(s_sign_key_id), key_id);
+    return true;
+}
+
+/* Does the cached key vouch for `der`: is `sig_b64` its signature over it? */
+static bool sign_key_endorses(const uint8_t *der, size_t len, const char *sig_b64)
+{
+    uint8_t hash[32];
+    uint8_t sig[OTA_SIGNATURE_MAX_B64 * 3 / 4];
+    size_t sig_len = 0;
+    mbedtls_sha256(der, len, hash, 0);
+    return mbedtls_base64_decode(sig, sizeof(sig), &sig_len,
+                                 (const uint8_t *)sig_b64, strlen(sig_b64)) == 0 &&
+           sig_len > 0 &&
+           mbedtls_pk_verify(&s_sign_key, MBEDTLS_MD_SHA256, hash, sizeof(hash),
+                             sig, sig_len) == 0;
+}
+
+/* Manifest "signature_alg" the cached key verifies */
+static const char *sign_key_alg(void)
+{
+    switch (mbedtls_pk_get_type(&s_sign_key)) {
+    case MBEDTLS_PK_ECKEY: return "ecdsa-p256-sha256";
+    case MBEDTLS_PK_RSA:   return "rsa-pkcs1v15-sha256";
+    default:               return "";
+    }
+}
+
+static void sign_key_load(void)
+{
+    mbedtls_pk_init(&s_sign_key);
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_KEYS, NVS_READONLY, &h) != ESP_OK) return;
+
+    uint8_t der[OTA_PUBKEY_MAX_DER];
+    char key_id[OTA_MAX_KEY_ID_LEN];
+    size_t der_len = sizeof(der), id_len = sizeof(key_id);
+    if (nvs_get_blob(h, NVS_KEY_PUBKEY, der, &der_len) == ESP_OK &&
+        nvs_get_str(h, NVS_KEY_KEY_ID, key_id, &id_len) == ESP_OK &&
+        sign_key_set(der, der_len, key_id)) {
+        ESP_LOGI(TAG, "Manifest signing key %s (%s) loaded", s_sign_key_id, sign_key_alg());
+    }
+    nvs_close(h);
+}
+
+/* Make `key_id` the cached signing key, fetching it if it is new */
+static ota_download_result_t sign_key_ensure(const char *key_id)
+{
+    if (s_sign_key_id[0] && strcmp(s_sign_key_id, key_id) == 0) return OTA_DOWNLOAD_OK;
 
-#ifndef OTA_DEVICE_ID
-#define OTA_DEVICE_ID        "REPLACE_WITH_DEVICE_ID"
-#endif
+    char url[128];
+    snprintf(url, sizeof(url), "%s/api/ota/public-key?format=der", OTA_SERVER_BASE_URL);
+    esp_http_client_handle_t client = http_pool_acquire(url, HTTP_POOL_CONTROL, HTTP_METHOD_GET, 10000);
+    if (!client) return OTA_DOWNLOAD_FAIL;
+    char served_id[OTA_MAX_KEY_ID_LEN];
+    http_pool_capture_header(client, "X-Key-Id", served_id, sizeof(served_id));
 
-/* ── Internal State ───────────────────────────────────────────── */
-static esp_ota_handle_t       s_ota_handle    = 0;
-static const esp_partition_t *s_update_part   = NULL;
-static mbedtls_sha256_context s_sha_ctx;
-static bool                   s_download_active = false;
+    /* Key DER, then the endorsement header */
+    uint8_t *der = malloc(OTA_PUBKEY_MAX_DER + OTA_SIGNATURE_MAX_B64);
+    if (!der) {
+        http_pool_release(client, false);
+        return OTA_DOWNLOAD_FAIL;
+    }
+    char *endorsement = (char *)der + OTA_PUBKEY_MAX_DER;
+    http_pool_capture_header(client, "X-Key-Signature", endorsement, OTA_SIGNATURE_MAX_B64);
+    int64_t len = http_pool_request(client, NULL, 0);
+    int got = 0;
+    if (len > 0 && len <= OTA_PUBKEY_MAX_DER && esp_http_client_get_status_code(client) == 200) {
+        while (got < len) {
+            int r = esp_http_client_read(client, (char *)der + got, len - got);
+            if (r <= 0) break;
+            got += r;
+        }
+    }
+    http_pool_release(client, got == len);
+    if (len < 0) {
+        free(der);
+        return OTA_DOWNLOAD_TIMEOUT;
+    }
 
-/* ── Helpers ──────────────────────────────────────────────────── */
+    ota_download_result_t res = OTA_DOWNLOAD_FAIL;
+    if (got != len || len <= 0 || strcmp(served_id, key_id) != 0) {
+        ESP_LOGE(TAG, "Signing key %s not available from server", key_id);
+    } else if (s_sign_key_id[0] && !sign_key_endorses(der, got, endorsement)) {
+        ESP_LOGE(TAG, "Signing key %s not endorsed by key %s — rotation refused",
+                 key_id, s_sign_key_id);
+    } else if (!sign_key_set(der, got, key_id)) {
+        ESP_LOGE(TAG, "Signing key %s does not parse", key_id);
+    } else {
+        nvs_handle_t h;
+        if (nvs_open(NVS_NAMESPACE_KEYS, NVS_READWRITE, &h) == ESP_OK) {
+            nvs_set_blob(h, NVS_KEY_PUBKEY, der, got);
+            nvs_set_str(h, NVS_KEY_KEY_ID, key_id);
+            nvs_commit(h);
+            nvs_close(h);
+        }
+        ESP_LOGI(TAG, "Manifest signing key %s (%s) cached", key_id, sign_key_alg());
+        res = OTA_DOWNLOAD_OK;
+    }
+    free(der);
+    return res;
+}
 
-/* Convert binary hash to hex string */
-static void hash_to_hex(const uint8_t *hash, char *hex_out, size_t hash_len)
+typedef struct {
+    char     version[OTA_MAX_VERSION_LEN];
+    char     artifact_hash[OTA_MAX_HASH_LEN];
+    char     chunk_root[OTA_MAX_HASH_LEN];
+    char     signature_alg[24];
+    char     app_project_name[32];
+    uint32_t artifact_size;
+} manifest_fields_t;
+
+static void manifest_cb(void *user, const json_stream_t *js,
+                        json_stream_event_t ev, const char *value, size_t len)
 {
-    for (size_t i = 0; i < hash_len; i++) {
-        sprintf(hex_out + i * 2, "%02x", hash[i]);
+    manifest_fields_t *m = (manifest_fields_t *)user;
+    int depth = json_stream_depth(js);
+    const char *key = depth > 0 ? json_stream_key(js, depth - 1) : "";
+
+    if (depth == 1 && ev == JSON_STREAM_NUMBER && strcmp(key, "artifact_size") == 0) {
+        m->artifact_size = (uint32_t)strtoul(value, NULL, 10);
+    } else if (ev != JSON_STREAM_STRING) {
+        return;
+    } else if (depth == 1 && strcmp(key, "version") == 0) {
+        copy_field(m->version, sizeof(m->version), value);
+    } else if (depth == 1 && strcmp(key, "artifact_hash_sha256") == 0) {
+        copy_field(m->artifact_hash, sizeof(m->artifact_hash), value);
+    } else if (depth == 1 && strcmp(key, "signature_alg") == 0) {
+        copy_field(m->signature_alg, sizeof(m->signature_alg), value);
+    } else if (depth == 1 && strcmp(key, "app_project_name") == 0) {
+        copy_field(m->app_project_name, sizeof(m->app_project_name), value);
+    } else if (depth == 2 && strcmp(json_stream_key(js, 0), "chunks") == 0 &&
+               strcmp(key, "root") == 0) {
+        copy_field(m->chunk_root, sizeof(m->chunk_root), value);
     }
-    hex_out[hash_len * 2] = 0;
 }
 
-/* ── Public API ───────────────────────────────────────────────── */
+/* Fetch the signed manifest of info's build, hashing and parsing it as it
+ * streams in, then check signature and fields */
+static ota_download_result_t manifest_verify(const ota_update_info_t *info)
+{
+    if (!info->manifest_url[0] || !info->signing_key_id[0]) {
+        if (s_sign_key_id[0]) {
+            ESP_LOGE(TAG, "Update v%s has no signed manifest — refused", info->version);
+            return OTA_DOWNLOAD_FAIL;
+        }
+        ESP_LOGW(TAG, "Server does not sign manifests — relying on the image hash");
+        return OTA_DOWNLOAD_OK;
+    }
 
-void ota_manager_init(void)
+    int64_t t0 = esp_timer_get_time();
+    ota_download_result_t res = sign_key_ensure(info->signing_key_id);
+    if (res != OTA_DOWNLOAD_OK) return res;
+
+    esp_http_client_handle_t client = http_pool_acquire(info->manifest_url, HTTP_POOL_CONTROL,
+                                                        HTTP_METHOD_GET, 10000);
+    if (!client) return OTA_DOWNLOAD_FAIL;
+    char *sig_b64 = malloc(OTA_SIGNATURE_MAX_B64);
+    char *buf = malloc(512);
+    manifest_fields_t *m = calloc(1, sizeof(*m) + sizeof(json_stream_t));
+    if (!sig_b64 || !buf || !m) {
+        http_pool_release(client, false);
+        free(sig_b64);
+        free(buf);
+        free(m);
+        return OTA_DOWNLOAD_FAIL;
+    }
+    json_stream_t *js = (json_stream_t *)(m + 1);
+    http_pool_capture_header(client, "X-Manifest-Signature", sig_b64, OTA_SIGNATURE_MAX_B64);
+
+    int64_t content_len = http_pool_request(client, NULL, 0);
+    bool ok = content_len >= 0 && esp_http_client_get_status_code(client) == 200;
+    res = content_len < 0 ? OTA_DOWNLOAD_TIMEOUT : OTA_DOWNLOAD_FAIL;
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    json_stream_init(js, manifest_cb, m);
+    int r = 0;
+    while (ok && (r = esp_http_client_read(client, buf, 512)) > 0) {
+        mbedtls_sha256_update(&sha, (const uint8_t *)buf, r);
+        ok = json_stream_feed(js, buf, r);
+    }
+    ok = ok && r == 0 && json_stream_finish(js);
+    http_pool_release(client, ok);
+    uint8_t hash[32];
+    mbedtls_sha256_finish(&sha, hash);
+    mbedtls_sha256_free(&sha);
+
+    /* Manifests from before signature_alg existed are RSA-signed */
+    const char *alg = m->signature_alg[0] ? m->signature_alg : "rsa-pkcs1v15-sha256";
+    if (!ok) {
+        if (res == OTA_DOWNLOAD_FAIL) ESP_LOGE(TAG, "Signed manifest unreadable");
+    } else if (strcmp(alg, sign_key_alg()) != 0) {
+        ESP_LOGE(TAG, "Manifest signed with %s, cached key is %s", alg, sign_key_alg());
+        ok = false;
+    } else {
+        /* The signature covers the bytes exactly as served */
+        uint8_t sig[OTA_SIGNATURE_MAX_B64 * 3 / 4];
+        size_t sig_len = 0;
+        int64_t t_sig = esp_timer_get_time();
+        ok = mbedtls_base64_decode(sig, sizeof(sig), &sig_len,
+                                   (const uint8_t *)sig_b64, strlen(sig_b64)) == 0 &&
+             sig_len > 0 &&
+             mbedtls_pk_verify(&s_sign_key, MBEDTLS_MD_SHA256, hash, sizeof(hash),
+                               sig, sig_len) == 0;
+        ESP_LOGI(TAG, "Manifest signature (%s) %s in %lld us", alg, ok ? "valid" : "INVALID",
+                 (long long)(esp_timer_get_time() - t_sig));
+    }
+
+    if (ok) {
+        ok = strcmp(m->version, info->version) == 0 &&
+             strcasecmp(m->artifact_hash, info->artifact_hash) == 0 &&
+             m->artifact_size == info->artifact_size &&
+             strcasecmp(m->chunk_root, info->chunk_root) == 0 &&
+             strcmp(m->app_project_name, info->app_project_name) == 0;
+        if (!ok) ESP_LOGE(TAG, "Check answer disagrees with the signed manifest");
+    }
+    if (ok) res = OTA_DOWNLOAD_OK;
+
+    free(sig_b64);
+    free(buf);
+    free(m);
+    s_phase_us.manifest = esp_timer_get_time() - t0;
+    return res;
+}
+
+/* ── Check Requests ───────────────────────────────────────────── */
+
+/* Stream a 200 response body through the check parser and return the
+ * borrowed client. A body without "update_available" is no answer. */
+static ota_check_result_t read_check_body(esp_http_client_handle_t client, int64_t content_len,
+                                          ota_update_info_t *out_info)
 {
-    ESP_LOGI(TAG, "OTA manager initialized");
-    ESP_LOGI(TAG, "Running partition: %s",
-             esp_ota_get_running_partition()->label);
+    if (content_len > OTA_CHECK_MAX_RESPONSE) {
+        ESP_LOGW(TAG, "OTA check: response too large (%lld)", (long long)content_len);
+        http_pool_release(client, false);
+        return OTA_CHECK_ERROR;
+    }
 
-    const esp_partition_t *boot = esp_ota_get_boot_partition();
-    const esp_partition_t *run  = esp_ota_get_running_partition();
-    if (boot != run) {
-        ESP_LOGW(TAG, "Boot partition (%s) != running partition (%s)",
-                 boot->label, run->label);
+    memset(out_info, 0, sizeof(*out_info));
+    out_info->activate = true;   /* servers without staging apply at once */
+    check_parse_ctx_t ctx = { .info = out_info };
+    json_stream_t js;
+    json_stream_init(&js, check_response_cb, &ctx);
+
+    char chunk[128];
+    int total = 0;
+    int n;
+    bool parsed = true;
+    while ((n = esp_http_client_read(client, chunk, sizeof(chunk))) > 0) {
+        total += n;
+        if (total > OTA_CHECK_MAX_RESPONSE || !json_stream_feed(&js, chunk, n)) {
+            parsed = false;
+            break;
+        }
     }
+    /* Only a fully read response leaves the connection reusable */
+    http_pool_release(client, parsed && n == 0);
+
+    if (n < 0 || total > OTA_CHECK_MAX_RESPONSE || !json_stream_finish(&js)) {
+        ESP_LOGE(TAG, "OTA check: JSON parse failed (%d bytes)", total);
+        return OTA_CHECK_ERROR;
+    }
+    if (!ctx.answered) return OTA_CHECK_ERROR;
+    return ctx.update_available ? OTA_UPDATE_AVAILABLE : OTA_NO_UPDATE;
 }
 
-ota_check_result_t ota_manager_check_update(const char *current_version,
-                                             ota_update_info_t *out_info)
+/* One POST /api/ota/check on `lane`. A non-empty `if_none_match` makes it
+ * conditional (304 -> OTA_NO_UPDATE); `wait_s` > 0 asks the server to hold
+ * an unchanged answer that long. The response ETag lands in `etag_out`,
+ * its Retry-After (0 if absent) in `*retry_after_s`. */
+static ota_check_result_t check_request(const char *current_version, http_pool_lane_t lane,
+                                        int wait_s, const char *if_none_match,
+                                        char *etag_out, size_t etag_size,
+                                        int *retry_after_s, ota_update_info_t *out_info)
 {
+    char retry_after[12] = "";
+    *retry_after_s = 0;
+
     char url[512];
     snprintf(url, sizeof(url), "%s/api/ota/check", OTA_SERVER_BASE_URL);
 
     /* Build JSON body */
     char body[256];
-    snprintf(body, sizeof(body),
-             "{\"device_id\":\"%s\",\"current_version\":\"%s\"}",
-             OTA_DEVICE_ID, current_version);
-
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_POST,
-        .timeout_ms = 10000,
-    };
+    int body_len = snprintf(body, sizeof(body),
+             "{\"device_id\":\"%s\",\"current_version\":\"%s\",\"wait\":%d}",
+             OTA_DEVICE_ID, current_version, wait_s);
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    /* Single round trip on the shared connection: send the body, then
+     * stream the response straight into the tokenizer. A long-poll must
+     * outlast the server's hold. */
+    int timeout_ms = 10000 + wait_s * 1000;
+    esp_http_client_handle_t client = http_pool_acquire(url, lane, HTTP_METHOD_POST, timeout_ms);
+    if (!client) return OTA_CHECK_ERROR;
     esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, body, strlen(body));
 
-    esp_err_t err = esp_http_client_perform(client);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "OTA check HTTP error: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
-        return OTA_CHECK_ERROR;
+    /* Conditional check: a "no update" answer we already have comes back
+     * as an empty 304 */
+    http_pool_capture_header(client, "ETag", etag_out, etag_size);
+    http_pool_capture_header(client, "Retry-After", retry_after, sizeof(retry_after));
+    if (if_none_match[0]) {
+        esp_http_client_set_header(client, "If-None-Match", if_none_match);
     }
 
+    int64_t content_len = http_pool_request(client, body, body_len);
+    esp_http_client_delete_header(client, "If-None-Match");
+    if (content_len < 0) {
+        ESP_LOGE(TAG, "OTA check: request failed");
+        http_pool_release(client, false);
+        return OTA_CHECK_ERROR;
+    }
     int status = esp_http_client_get_status_code(client);
-    int content_len = esp_http_client_get_content_length(client);
-
-    if (status != 200 || content_len <= 0 || content_len > 2048) {
-        ESP_LOGW(TAG, "OTA check: status=%d len=%d", status, content_len);
-        esp_http_client_cleanup(client);
+    *retry_after_s = atoi(retry_after);
+    if (status == 304) {
+        http_pool_release(client, true);
+        ESP_LOGD(TAG, "OTA check: not modified");
+        return OTA_NO_UPDATE;
+    }
+    if (status != 200) {
+        ESP_LOGW(TAG, "OTA check: status=%d", status);
+        http_pool_release(client, content_len <= OTA_CHECK_MAX_RESPONSE);
         return OTA_CHECK_ERROR;
     }
+    return read_check_body(client, content_len, out_info);
+}
 
-    char *response = calloc(1, content_len + 1);
-    if (!response) {
-        esp_http_client_cleanup(client);
-        return OTA_CHECK_ERROR;
+/* ── Update Watch ─────────────────────────────────────────────── */
+
+/*
+ * Long-poll on the NOTIFY lane so heartbeats and the main loop's checks
+ * never wait behind it. The watcher keeps the ETag of whatever it saw
+ * last; the server holds the request until that answer changes, so an
+ * offered update arrives within a round trip of the deployment. The
+ * watcher only raises a hint — the main loop still does the real check.
+ *
+ * A server that answers an unchanged state early, or without an ETag,
+ * does not hold requests; that counts as a failure like a network error,
+ * so such a server is polled no faster than the backoff allows.
+ */
+static void update_watch_task(void *arg)
+{
+    char etag[sizeof(s_check_etag)] = "";
+    char seen[sizeof(s_check_etag)];
+    int failures = 0;
+
+    while (failures < OTA_WATCH_MAX_FAILURES) {
+        int64_t t0 = esp_timer_get_time();
+        int retry_after;   /* paces interval checks only */
+        ota_check_result_t res = check_request(s_watch_version, HTTP_POOL_NOTIFY, s_watch_wait_s,
+                                               etag, seen, sizeof(seen), &retry_after,
+                                               &s_watch_info);
+        int64_t held_ms = (esp_timer_get_time() - t0) / 1000;
+
+        bool held = res != OTA_CHECK_ERROR && seen[0] &&
+                    (strcmp(seen, etag) != 0 || held_ms >= s_watch_wait_s * 1000 / 2);
+        if (!held) {
+            failures++;
+            s_watch_active = false;
+            ESP_LOGW(TAG, "Update watch: %s (%d/%d)",
+                     res == OTA_CHECK_ERROR ? "request failed" : "server did not hold",
+                     failures, OTA_WATCH_MAX_FAILURES);
+            /* Random spread: a server restart drops every watch at once */
+            vTaskDelay(pdMS_TO_TICKS(OTA_WATCH_BACKOFF_MS * failures +
+                                     esp_random() % OTA_WATCH_BACKOFF_MS));
+            continue;
+        }
+
+        failures = 0;
+        s_watch_active = true;
+        copy_field(etag, sizeof(etag), seen);
+        if (res == OTA_UPDATE_AVAILABLE) {
+            ESP_LOGI(TAG, "Update watch: v%s offered", s_watch_info.version);
+            s_update_hint = true;
+            if (s_watch_notify) xTaskNotifyGive(s_watch_notify);
+        }
     }
 
-    /* Re-read response body */
-    esp_http_client_cleanup(client);
+    ESP_LOGW(TAG, "Update watch stopped — interval polling only");
+    s_watch_active  = false;
+    s_watch_gave_up = xTaskGetTickCount() | 1;
+    s_watch_task    = NULL;
+    vTaskDelete(NULL);
+}
 
-    /* For simplicity, use a second request with esp_http_client_read */
-    client = esp_http_client_init(&config);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, body, strlen(body));
+/* ── Background Download ──────────────────────────────────────── */
 
-    err = esp_http_client_open(client, strlen(body));
-    if (err != ESP_OK) {
-        free(response);
-        esp_http_client_cleanup(client);
-        return OTA_CHECK_ERROR;
+static void post_event(const ota_event_t *ev, TickType_t wait)
+{
+    if (s_event_q) xQueueSend(s_event_q, ev, wait);
+}
+
+/* Called per flushed sector; progress is best-effort, dropped if the
+ * agent is behind on its queue */
+static void progress_maybe_post(void)
+{
+    if (!s_dl_running || s_flushed - s_progress_posted < OTA_PROGRESS_STEP) return;
+    s_progress_posted = s_flushed;
+    ota_event_t ev = {
+        .type  = OTA_EVENT_PROGRESS,
+        .bytes = s_flushed,
+        .total = s_dl_info.artifact_size,
+    };
+    post_event(&ev, 0);
+}
+
+static void download_task(void *arg)
+{
+    ota_download_result_t res = ota_manager_download(&s_dl_info);
+    ota_event_t ev = {
+        .type   = OTA_EVENT_DONE,
+        .result = res,
+        .bytes  = s_flushed,
+        .total  = s_dl_info.artifact_size,
+    };
+    s_dl_cancel  = false;
+    s_dl_running = false;
+    post_event(&ev, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+/* ── Staged Images ────────────────────────────────────────────── */
+
+static void staged_clear(void)
+{
+    if (!s_has_staged) return;
+    s_has_staged = false;
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_OTA, NVS_READWRITE, &h) == ESP_OK) {
+        if (nvs_erase_key(h, NVS_KEY_STAGED) == ESP_OK) {
+            nvs_commit(h);
+        }
+        nvs_close(h);
     }
-    esp_http_client_write(client, body, strlen(body));
+}
 
-    content_len = esp_http_client_fetch_headers(client);
-    if (content_len > 0) {
-        esp_http_client_read(client, response, content_len);
+static void staged_load(void)
+{
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_OTA, NVS_READONLY, &h) != ESP_OK) return;
+    size_t len = sizeof(s_staged);
+    s_has_staged = nvs_get_blob(h, NVS_KEY_STAGED, &s_staged, &len) == ESP_OK &&
+                   len == sizeof(s_staged);
+    nvs_close(h);
+    if (s_has_staged) {
+        ESP_LOGI(TAG, "Staged image v%s waiting for activation", s_staged.version);
     }
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
+}
 
-    /* Parse JSON response */
-    cJSON *json = cJSON_Parse(response);
-    free(response);
-    if (!json) {
-        ESP_LOGE(TAG, "OTA check: JSON parse failed");
-        return OTA_CHECK_ERROR;
+/* ── Verified Images ──────────────────────────────────────────── */
+
+static void verified_save(const ota_update_info_t *info)
+{
+    memset(&s_verified, 0, sizeof(s_verified));
+    copy_field(s_verified.artifact_hash, sizeof(s_verified.artifact_hash), info->artifact_hash);
+    s_verified.partition_addr = s_update_part->address;
+    s_verified.size           = s_image_bytes;
+    s_verified_state          = 1;   /* just hashed while downloading */
+
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_OTA, NVS_READWRITE, &h) == ESP_OK) {
+        if (nvs_set_blob(h, NVS_KEY_VERIFIED, &s_verified, sizeof(s_verified)) == ESP_OK) {
+            nvs_commit(h);
+        }
+        nvs_close(h);
     }
+}
 
-    cJSON *update_avail = cJSON_GetObjectItem(json, "update_available");
-    if (!cJSON_IsTrue(update_avail)) {
-        cJSON_Delete(json);
-        return OTA_NO_UPDATE;
+/* `part` is about to be overwritten */
+static void verified_forget(const esp_partition_t *part)
+{
+    if (s_verified_state < 0 || s_verified.partition_addr != part->address) return;
+    s_verified_state = -1;
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_OTA, NVS_READWRITE, &h) == ESP_OK) {
+        if (nvs_erase_key(h, NVS_KEY_VERIFIED) == ESP_OK) {
+            nvs_commit(h);
+        }
+        nvs_close(h);
+    }
+}
+
+static void verified_load(void)
+{
+    nvs_handle_t h;
+    size_t len = sizeof(s_verified);
+    bool ok = nvs_open(NVS_NAMESPACE_OTA, NVS_READONLY, &h) == ESP_OK;
+    if (ok) {
+        ok = nvs_get_blob(h, NVS_KEY_VERIFIED, &s_verified, &len) == ESP_OK &&
+             len == sizeof(s_verified);
+        nvs_close(h);
     }
+    s_verified_state = ok ? 0 : -1;
+}
 
-    /* Extract update info */
-    cJSON *ver  = cJSON_GetObjectItem(json, "version");
-    cJSON *hash = cJSON_GetObjectItem(json, "artifact_hash");
-    cJSON *dl   = cJSON_GetObjectItem(json, "download_url");
-    cJSON *did  = cJSON_GetObjectItem(json, "deployment_id");
+static const esp_partition_t *partition_at(uint32_t addr)
+{
+    const esp_partition_t *part = NULL;
+    esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_APP,
+                                                     ESP_PARTITION_SUBTYPE_ANY, NULL);
+    for (; it && !part; it = esp_partition_next(it)) {
+        const esp_partition_t *p = esp_partition_get(it);
+        if (p->address == addr) part = p;
+    }
+    esp_partition_iterator_release(it);
+    return part;
+}
 
-    if (ver && ver->valuestring)
-        strncpy(out_info->version, ver->valuestring, OTA_MAX_VERSION_LEN - 1);
-    if (hash && hash->valuestring)
-        strncpy(out_info->artifact_hash, hash->valuestring, OTA_MAX_HASH_LEN - 1);
-    if (dl && dl->valuestring) {
-        /* Build full download URL */
-        snprintf(out_info->download_url, OTA_MAX_URL_LEN,
-                 "%s%s", OTA_SERVER_BASE_URL, dl->valuestring);
+/* ── Public API ───────────────────────────────────────────────── */
+
+void ota_manager_init(void)
+{
+    staged_load();
+    verified_load();
+    sign_key_load();
+    ESP_LOGI(TAG, "OTA manager initialized");
+    ESP_LOGI(TAG, "Running partition: %s",
+             esp_ota_get_running_partition()->label);
+
+    const esp_partition_t *boot = esp_ota_get_boot_partition();
+    const esp_partition_t *run  = esp_ota_get_running_partition();
+    if (boot != run) {
+        ESP_LOGW(TAG, "Boot partition (%s) != running partition (%s)",
+                 boot->label, run->label);
+    }
+}
+
+ota_check_result_t ota_manager_check_update(const char *current_version,
+                                             ota_update_info_t *out_info)
+{
+    s_update_hint = false;
+
+    char etag[sizeof(s_check_etag)];
+    ota_check_result_t res = check_request(current_version, HTTP_POOL_CONTROL, 0,
+                                           s_check_etag, etag, sizeof(etag),
+                                           &s_retry_after_s, out_info);
+    if (res == OTA_NO_UPDATE) {
+        if (etag[0]) copy_field(s_check_etag, sizeof(s_check_etag), etag);
+    } else if (res == OTA_UPDATE_AVAILABLE) {
+        /* Only "no update" is worth revalidating; an offered update must be
+         * re-sent in full, e.g. to resume an interrupted download */
+        s_check_etag[0] = '\0';
+        ESP_LOGI(TAG, "Update available: v%s", out_info->version);
     }
-    if (did && did->valuestring)
-        strncpy(out_info->deployment_id, did->valuestring, sizeof(out_info->deployment_id) - 1);
+    return res;
+}
 
-    cJSON_Delete(json);
+void ota_manager_watch_start(const char *current_version, int wait_s)
+{
+    if (s_watch_task || wait_s <= 0) return;
+    if (s_watch_gave_up &&
+        (xTaskGetTickCount() - s_watch_gave_up) < pdMS_TO_TICKS(OTA_WATCH_RESTART_MS)) {
+        return;
+    }
 
-    ESP_LOGI(TAG, "Update available: v%s", out_info->version);
-    return OTA_UPDATE_AVAILABLE;
+    s_watch_version = current_version;
+    s_watch_wait_s  = wait_s;
+    s_watch_notify  = xTaskGetCurrentTaskHandle();
+    if (xTaskCreate(update_watch_task, "ota_watch", OTA_WATCH_STACK_SIZE, NULL,
+                    tskIDLE_PRIORITY + 1, &s_watch_task) != pdPASS) {
+        s_watch_task = NULL;
+        return;
+    }
+    ESP_LOGI(TAG, "Watching for updates (long-poll %ds)", wait_s);
 }
 
-ota_download_result_t ota_manager_download(const ota_update_info_t *info)
+ota_check_result_t ota_manager_read_check_response(esp_http_client_handle_t client,
+                                                   int64_t content_len,
+                                                   ota_update_info_t *out_info)
+{
+    ota_check_result_t res = read_check_body(client, content_len, out_info);
+    if (res != OTA_CHECK_ERROR) {
+        s_update_hint = false;
+    }
+    if (res == OTA_UPDATE_AVAILABLE) {
+        ESP_LOGI(TAG, "Update available: v%s", out_info->version);
+    }
+    return res;
+}
+
+int ota_manager_retry_after(void)
+{
+    return s_retry_after_s;
+}
+
+bool ota_manager_watch_active(void)
+{
+    return s_watch_active;
+}
+
+bool ota_manager_update_hinted(void)
+{
+    return s_update_hint;
+}
+
+/* Pick the cheapest transfer that applies; see ota_manager_download() */
+static ota_download_result_t download_best(const ota_update_info_t *info)
 {
     ESP_LOGI(TAG, "Downloading from: %s", info->download_url);
 
@@ -174,78 +2131,160 @@ ota_download_result_t ota_manager_download(const ota_update_info_t *info)
         ESP_LOGE(TAG, "No OTA partition available");
         return OTA_DOWNLOAD_FAIL;
     }
+    if (info->artifact_size > s_update_part->size) {
+        ESP_LOGE(TAG, "Image of %lu bytes does not fit partition %s (%lu)",
+                 (unsigned long)info->artifact_size, s_update_part->label,
+                 (unsigned long)s_update_part->size);
+        return OTA_DOWNLOAD_FAIL;
+    }
+    staged_clear();   /* this download overwrites the slot */
+    verified_forget(s_update_part);
     ESP_LOGI(TAG, "Writing to partition: %s (offset=0x%lx, size=%lu)",
              s_update_part->label,
              (unsigned long)s_update_part->address,
              (unsigned long)s_update_part->size);
 
-    esp_err_t err = esp_ota_begin(s_update_part, OTA_WITH_SEQUENTIAL_WRITES, &s_ota_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
-        return OTA_DOWNLOAD_FAIL;
+    /* Resume an interrupted plain download of this same deployment */
+    ota_checkpoint_t cp;
+    if (checkpoint_load(&cp) &&
+        strcmp(cp.deployment_id, info->deployment_id) == 0 &&
+        strcasecmp(cp.artifact_hash, info->artifact_hash) == 0 &&
+        cp.partition_addr == s_update_part->address) {
+        if (!ota_session_begin()) return OTA_DOWNLOAD_FAIL;
+        if (session_restore(&cp)) {
+            ESP_LOGI(TAG, "Resuming download at %lu bytes", (unsigned long)cp.offset);
+            copy_field(s_timings.method, sizeof(s_timings.method), "resumed");
+            return download_plain(info);
+        }
+        ESP_LOGW(TAG, "Checkpoint does not match flash — restarting download");
+        ota_session_abort();
     }
+    checkpoint_clear();
 
-    /* Initialize SHA-256 context for verification */
-    mbedtls_sha256_init(&s_sha_ctx);
-    mbedtls_sha256_starts(&s_sha_ctx, 0); /* 0 = SHA-256 (not SHA-224) */
-    s_download_active = true;
+    /* Delta first: only if the running image is exactly the patch base */
+    if (info->delta_url[0] &&
+        running_image_matches(info->delta_base_hash, info->delta_base_size)) {
+        if (!ota_session_begin()) return OTA_DOWNLOAD_FAIL;
+        copy_field(s_timings.method, sizeof(s_timings.method), "delta");
+        if (download_delta(info)) {
+            ESP_LOGI(TAG, "Delta applied: %d bytes reconstructed", s_image_bytes);
+            return OTA_DOWNLOAD_OK;
+        }
+        ota_session_abort();
+        if (s_dl_cancel) return OTA_DOWNLOAD_CANCELLED;
+        if (s_image_rejected) return OTA_DOWNLOAD_FAIL;
+        ESP_LOGW(TAG, "Delta update failed — falling back to full image");
+    }
 
-    /* HTTP download */
-    esp_http_client_config_t config = {
-        .url = info->download_url,
-        .timeout_ms = 30000,
-        .buffer_size = 4096,
-    };
+    mirrors_rank(info);
+    if (info->compressed_url[0] && !mirror_preferred()) {
+        if (!ota_session_begin()) return OTA_DOWNLOAD_FAIL;
+        copy_field(s_timings.method, sizeof(s_timings.method), "compressed");
+        if (download_compressed(info)) {
+            return OTA_DOWNLOAD_OK;
+        }
+        ota_session_abort();
+        if (s_dl_cancel) return OTA_DOWNLOAD_CANCELLED;
+        if (s_image_rejected) return OTA_DOWNLOAD_FAIL;
+        ESP_LOGW(TAG, "Compressed download failed — falling back to plain image");
+    }
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    err = esp_http_client_open(client, 0);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "HTTP open failed: %s", esp_err_to_name(err));
-        esp_ota_abort(s_ota_handle);
-        esp_http_client_cleanup(client);
-        s_download_active = false;
-        return OTA_DOWNLOAD_FAIL;
+    if (!ota_session_begin()) return OTA_DOWNLOAD_FAIL;
+    copy_field(s_timings.method, sizeof(s_timings.method), "full");
+    return download_plain(info);
+}
+
+ota_download_result_t ota_manager_download(const ota_update_info_t *info)
+{
+    memset(&s_phase_us, 0, sizeof(s_phase_us));
+    memset(&s_timings, 0, sizeof(s_timings));
+    s_timings_ready = false;
+    rate_limit_begin(rate_limit_for(info));
+    s_timings.rate_limit_bps = s_bucket.rate;
+    stall_watch_setup(s_bucket.rate);
+
+    s_image_info     = info;
+    s_image_rejected = false;
+    s_source_count   = 0;
+
+    int64_t t0 = esp_timer_get_time();
+    http_pool_download_begin();
+    ota_download_result_t res = manifest_verify(info);
+    if (res == OTA_DOWNLOAD_OK) {
+        chunks_load(info);
+        res = download_best(info);
+        chunks_free();
     }
+    http_pool_download_end();   /* frees idle mirror clients and their TLS buffers */
+    s_phase_us.total = esp_timer_get_time() - t0;
+    s_timings.image_bytes = s_image_bytes;
 
-    int content_len = esp_http_client_fetch_headers(client);
-    ESP_LOGI(TAG, "Content length: %d bytes", content_len);
+    /* Verify/apply add their phases; report takes it after either */
+    s_timings_ready = true;
+    return res;
+}
 
-    char *buf = malloc(4096);
-    if (!buf) {
-        esp_ota_abort(s_ota_handle);
-        esp_http_client_cleanup(client);
-        s_download_active = false;
-        return OTA_DOWNLOAD_FAIL;
+bool ota_manager_download_start(const ota_update_info_t *info)
+{
+    if (s_dl_running) return false;
+    if (!s_event_q) {
+        s_event_q = xQueueCreate(OTA_EVENT_QUEUE_LEN, sizeof(ota_event_t));
+        if (!s_event_q) return false;
     }
+    xQueueReset(s_event_q);
 
-    int total = 0;
-    int read_len;
-    while ((read_len = esp_http_client_read(client, buf, 4096)) > 0) {
-        err = esp_ota_write(s_ota_handle, buf, read_len);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "esp_ota_write failed: %s", esp_err_to_name(err));
-            free(buf);
-            esp_ota_abort(s_ota_handle);
-            esp_http_client_cleanup(client);
-            s_download_active = false;
-            return OTA_DOWNLOAD_FAIL;
-        }
+    s_dl_info         = *info;
+    s_dl_cancel       = false;
+    s_progress_posted = 0;
+    s_dl_running      = true;
+    if (xTaskCreate(download_task, "ota_download", OTA_DOWNLOAD_STACK_SIZE, NULL,
+                    OTA_DOWNLOAD_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start download task");
+        s_dl_running = false;
+        return false;
+    }
+    return true;
+}
 
-        /* Update SHA-256 hash */
-        mbedtls_sha256_update(&s_sha_ctx, (uint8_t *)buf, read_len);
+void ota_manager_download_cancel(void)
+{
+    if (s_dl_running) s_dl_cancel = true;
+}
 
-        total += read_len;
-        if (total % (64 * 1024) == 0) {
-            ESP_LOGI(TAG, "Downloaded %d bytes...", total);
+bool ota_manager_next_event(ota_event_t *out, uint32_t timeout_ms)
+{
+    return s_event_q && xQueueReceive(s_event_q, out, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+}
+
+void ota_manager_preerase_start(void)
+{
+    const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+    if (!part || s_preerase_running || s_has_staged) return;
+    verified_forget(part);
+
+    erase_lock_ensure();
+    xSemaphoreTake(s_erase_lock, portMAX_DELAY);
+    if (s_erase_part != part) {
+        /* Never erase below a resume checkpoint */
+        ota_checkpoint_t cp;
+        uint32_t base = 0;
+        if (checkpoint_load(&cp) && cp.partition_addr == part->address) {
+            base = cp.offset;
         }
+        s_erase_part = part;
+        s_erase_base = s_erased_to = base;
     }
+    bool complete = s_erased_to >= part->size;
+    xSemaphoreGive(s_erase_lock);
+    if (complete) return;
 
-    free(buf);
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-
-    ESP_LOGI(TAG, "Download complete: %d bytes total", total);
-    return OTA_DOWNLOAD_OK;
+    s_preerase_running = true;
+    if (xTaskCreate(preerase_task, "ota_preerase", 3072, (void *)part,
+                    tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        s_preerase_running = false;
+        return;
+    }
+    ESP_LOGI(TAG, "Pre-erasing %s from 0x%lx", part->label, (unsigned long)s_erased_to);
 }
 
 bool ota_manager_verify_hash(const ota_update_info_t *info)
@@ -253,8 +2292,10 @@ bool ota_manager_verify_hash(const ota_update_info_t *info)
     if (!s_download_active) return false;
 
     uint8_t hash[32];
+    int64_t t0 = esp_timer_get_time();
     mbedtls_sha256_finish(&s_sha_ctx, hash);
     mbedtls_sha256_free(&s_sha_ctx);
+    s_phase_us.hash += esp_timer_get_time() - t0;
 
     char hex_hash[65];
     hash_to_hex(hash, hex_hash, 32);
@@ -269,53 +2310,168 @@ bool ota_manager_verify_hash(const ota_update_info_t *info)
     return match;
 }
 
-bool ota_manager_apply(void)
+/* Full image check of s_update_part (segments, appended hash, and the
+ * secure boot signature where enabled) for an image that is staged
+ * rather than booted at once */
+static bool image_validate(void)
 {
-    if (!s_download_active || !s_update_part) return false;
-
-    esp_err_t err = esp_ota_end(s_ota_handle);
+    const esp_partition_pos_t pos = {
+        .offset = s_update_part->address,
+        .size   = s_update_part->size,
+    };
+    esp_image_metadata_t meta;
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = esp_image_verify(ESP_IMAGE_VERIFY, &pos, &meta);
+    s_phase_us.image_verify = esp_timer_get_time() - t0;
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_ota_end failed: %s", esp_err_to_name(err));
-        s_download_active = false;
+        ESP_LOGE(TAG, "esp_image_verify failed: %s", esp_err_to_name(err));
         return false;
     }
+    return true;
+}
+
+bool ota_manager_apply(void)
+{
+    if (!s_download_active || !s_update_part) return false;
 
-    err = esp_ota_set_boot_partition(s_update_part);
+    /* Verifies the image itself, so there is no separate image_validate() */
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = esp_ota_set_boot_partition(s_update_part);
+    s_phase_us.set_boot = esp_timer_get_time() - t0;
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_set_boot_partition failed: %s", esp_err_to_name(err));
         s_download_active = false;
         return false;
     }
 
+    checkpoint_clear();
+    verified_save(s_image_info);
     ESP_LOGI(TAG, "OTA applied. Next boot from: %s", s_update_part->label);
     s_download_active = false;
     return true;
 }
 
+bool ota_manager_stage(const ota_update_info_t *info)
+{
+    if (!s_download_active || !s_update_part) return false;
+
+    bool valid = image_validate();
+    s_download_active = false;
+    if (!valid) return false;
+    checkpoint_clear();
+
+    memset(&s_staged, 0, sizeof(s_staged));
+    copy_field(s_staged.deployment_id, sizeof(s_staged.deployment_id), info->deployment_id);
+    copy_field(s_staged.version, sizeof(s_staged.version), info->version);
+    copy_field(s_staged.artifact_hash, sizeof(s_staged.artifact_hash), info->artifact_hash);
+    s_staged.partition_addr = s_update_part->address;
+    s_staged.size           = s_image_bytes;
+
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_OTA, NVS_READWRITE, &h) != ESP_OK) return false;
+    esp_err_t err = nvs_set_blob(h, NVS_KEY_STAGED, &s_staged, sizeof(s_staged));
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    if (err != ESP_OK) return false;
+
+    s_has_staged = true;
+    verified_save(info);
+    ESP_LOGI(TAG, "Image v%s staged in %s", s_staged.version, s_update_part->label);
+    return true;
+}
+
+const char *ota_manager_staged_deployment(void)
+{
+    return s_has_staged ? s_staged.deployment_id : NULL;
+}
+
+bool ota_manager_verified_image(ota_verified_image_t *out)
+{
+    if (s_verified_state < 0) return false;
+    const esp_partition_t *part = partition_at(s_verified.partition_addr);
+    if (s_verified_state == 0) {
+        bool intact = part && partition_hash_matches(part, s_verified.artifact_hash, s_verified.size);
+        s_verified_state = intact ? 1 : -1;
+        ESP_LOGI(TAG, "Verified image %.12s... %s", s_verified.artifact_hash,
+                 intact ? "intact" : "gone");
+    }
+    if (s_verified_state < 0 || !part) return false;
+
+    out->partition = part;
+    out->size      = s_verified.size;
+    copy_field(out->hash, sizeof(out->hash), s_verified.artifact_hash);
+    return true;
+}
+
+bool ota_manager_activate_staged(void)
+{
+    if (!s_has_staged) return false;
+
+    /* Days may have passed: make sure the slot still holds the image */
+    const esp_partition_t *part = esp_ota_get_next_update_partition(NULL);
+    bool ok = part && part->address == s_staged.partition_addr &&
+              partition_hash_matches(part, s_staged.artifact_hash, s_staged.size);
+    if (!ok) {
+        ESP_LOGE(TAG, "Staged image v%s is no longer intact", s_staged.version);
+    } else {
+        int64_t t0 = esp_timer_get_time();
+        esp_err_t err = esp_ota_set_boot_partition(part);
+        s_phase_us.set_boot = esp_timer_get_time() - t0;
+        ok = err == ESP_OK;
+        if (!ok) {
+            ESP_LOGE(TAG, "esp_ota_set_boot_partition failed: %s", esp_err_to_name(err));
+        } else {
+            ESP_LOGI(TAG, "Staged v%s activated. Next boot from: %s",
+                     s_staged.version, part->label);
+        }
+    }
+    staged_clear();
+    return ok;
+}
+
 void ota_manager_abort(void)
 {
-    if (s_download_active && s_ota_handle) {
-        esp_ota_abort(s_ota_handle);
+    if (s_download_active) {
         s_download_active = false;
         ESP_LOGW(TAG, "OTA aborted");
     }
+    /* Whatever is on flash is not worth resuming into */
+    checkpoint_clear();
+}
+
+bool ota_manager_take_timings(ota_timings_t *out)
+{
+    if (!s_timings_ready) return false;
+
+    *out = s_timings;
+    out->connect_ms      = (uint32_t)(s_phase_us.connect / 1000);
+    out->first_byte_ms   = (uint32_t)(s_phase_us.first_byte / 1000);
+    out->receive_ms      = (uint32_t)(s_phase_us.receive / 1000);
+    out->flash_read_ms   = (uint32_t)(s_phase_us.flash_read / 1000);
+    out->flash_erase_ms  = (uint32_t)(s_phase_us.flash_erase / 1000);
+    out->flash_write_ms  = (uint32_t)(s_phase_us.flash_write / 1000);
+    out->hash_ms         = (uint32_t)(s_phase_us.hash / 1000);
+    out->image_verify_ms = (uint32_t)(s_phase_us.image_verify / 1000);
+    out->set_boot_ms     = (uint32_t)(s_phase_us.set_boot / 1000);
+    out->total_ms        = (uint32_t)(s_phase_us.total / 1000);
+    out->throttle_ms     = (uint32_t)(s_phase_us.throttle / 1000);
+    out->manifest_ms     = (uint32_t)(s_phase_us.manifest / 1000);
+    out->probe_ms        = (uint32_t)(s_phase_us.probe / 1000);
+    out->min_window_bps  = s_stall.min_bps == UINT32_MAX ? 0 : s_stall.min_bps;
+    s_timings_ready = false;
+    return true;
 }
 
 bool ota_manager_server_reachable(void)
 {
     char url[256];
-    snprintf(url, sizeof(url), "%s/api/ota/public-key", OTA_SERVER_BASE_URL);
-
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_GET,
-        .timeout_ms = 5000,
-    };
+    snprintf(url, sizeof(url), "%s/api/ota/ping", OTA_SERVER_BASE_URL);
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_err_t err = esp_http_client_perform(client);
+    esp_http_client_handle_t client = http_pool_acquire(url, HTTP_POOL_CONTROL, HTTP_METHOD_GET, 5000);
+    if (!client) return false;
+    esp_err_t err = http_pool_perform(client);
     int status = esp_http_client_get_status_code(client);
-    esp_http_client_cleanup(client);
+    http_pool_release(client, err == ESP_OK);
 
-    return (err == ESP_OK && status == 200);
+    return (err == ESP_OK && status == 204);
 }
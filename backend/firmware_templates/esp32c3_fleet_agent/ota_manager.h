@@ -7,17 +7,45 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "esp_http_client.h"
+#include "esp_partition.h"
 
 #define OTA_MAX_VERSION_LEN  32
 #define OTA_MAX_HASH_LEN     65
 #define OTA_MAX_URL_LEN      256
+#define OTA_MAX_KEY_ID_LEN   24
+#define OTA_MAX_MIRRORS      3
 
 typedef struct {
     char     version[OTA_MAX_VERSION_LEN];
     char     artifact_hash[OTA_MAX_HASH_LEN];   /* SHA-256 hex string */
     char     download_url[OTA_MAX_URL_LEN];
+    char     blob_url[OTA_MAX_URL_LEN];         /* same image, content-addressed */
     char     deployment_id[64];
     uint32_t artifact_size;
+    /* Optional LZSS-compressed image (empty url = none) */
+    char     compressed_url[OTA_MAX_URL_LEN];
+    char     compressed_hash[OTA_MAX_HASH_LEN];  /* SHA-256 of compressed bytes */
+    /* Optional delta patch against the running image (empty url = none) */
+    char     delta_url[OTA_MAX_URL_LEN];
+    char     delta_base_hash[OTA_MAX_HASH_LEN];
+    uint32_t delta_base_size;
+    /* Per-device download cap in bytes/s (0 = none) */
+    uint32_t rate_limit_bps;
+    /* false: stage the verified image and wait for activation */
+    bool     activate;
+    /* Optional per-chunk hash list, checked against chunk_root (empty url = none) */
+    char     chunks_url[OTA_MAX_URL_LEN];
+    char     chunk_root[OTA_MAX_HASH_LEN];       /* SHA-256 of the digest list */
+    uint32_t chunk_size;
+    /* Signed build manifest and the key that signed it (empty = unsigned) */
+    char     manifest_url[OTA_MAX_URL_LEN];
+    char     signing_key_id[OTA_MAX_KEY_ID_LEN];
+    /* esp_app_desc_t project name the build stamped (empty = not stamped) */
+    char     app_project_name[32];
+    /* Other sources of the plain image, ranked against the server's */
+    char     mirrors[OTA_MAX_MIRRORS][OTA_MAX_URL_LEN];
+    uint8_t  mirror_count;
 } ota_update_info_t;
 
 typedef enum {
@@ -29,9 +57,54 @@ typedef enum {
 typedef enum {
     OTA_DOWNLOAD_OK,
     OTA_DOWNLOAD_FAIL,
-    OTA_DOWNLOAD_TIMEOUT,
+    OTA_DOWNLOAD_TIMEOUT,   /* transfer interrupted; a later call resumes it */
+    OTA_DOWNLOAD_CANCELLED, /* ota_manager_download_cancel(); resumable too  */
 } ota_download_result_t;
 
+typedef enum {
+    OTA_EVENT_PROGRESS,     /* periodic: more of the image on flash    */
+    OTA_EVENT_DONE,         /* download task finished; see result      */
+} ota_event_type_t;
+
+typedef struct {
+    ota_event_type_t      type;
+    ota_download_result_t result;   /* OTA_EVENT_DONE only                */
+    uint32_t              bytes;    /* image bytes written so far         */
+    uint32_t              total;    /* expected image size, 0 if unknown  */
+} ota_event_t;
+
+/**
+ * Per-phase cost of the last OTA attempt. Durations are summed over every
+ * HTTP stream and every sector of the attempt. Flash and hash work run
+ * concurrently with receive, so the parts may add up to more than total_ms.
+ */
+typedef struct {
+    uint32_t connect_ms;          /* DNS + TCP + TLS handshake + request  */
+    uint32_t first_byte_ms;       /* request sent -> response headers     */
+    uint32_t receive_ms;          /* response body, wall time             */
+    uint32_t throttle_ms;         /* part of receive spent rate-limited   */
+    uint32_t flash_read_ms;       /* read-back for unchanged-sector check */
+    uint32_t flash_erase_ms;
+    uint32_t flash_write_ms;
+    uint32_t hash_ms;
+    uint32_t image_verify_ms;     /* esp_image_verify of a staged image   */
+    uint32_t set_boot_ms;         /* includes image verification on apply */
+    uint32_t manifest_ms;         /* signed manifest fetch + verification */
+    uint32_t probe_ms;            /* ranking the image's sources          */
+    uint32_t preerase_saved_ms;   /* erase time avoided by pre-erase      */
+    uint32_t total_ms;            /* ota_manager_download wall time       */
+    uint32_t bytes_received;      /* wire bytes over all streams          */
+    uint32_t image_bytes;
+    uint32_t sectors_programmed;
+    uint32_t sectors_skipped;
+    uint32_t rate_limit_bps;      /* cap applied, 0 = none                */
+    uint32_t chunk_retries;       /* chunks re-fetched after a bad hash   */
+    uint32_t stall_aborts;        /* streams dropped below the rate floor */
+    uint32_t min_window_bps;      /* slowest 30 s window, 0 = none full   */
+    uint32_t mirror_switches;     /* source changes mid-download          */
+    char     method[12];          /* delta / compressed / full / resumed  */
+} ota_timings_t;
+
 /**
  * Initialize OTA subsystem.
  */
@@ -46,13 +119,111 @@ void ota_manager_init(void);
 ota_check_result_t ota_manager_check_update(const char *current_version,
                                              ota_update_info_t *out_info);
 
+/**
+ * Parse a check answer carried by another response (the heartbeat reply
+ * has the same fields as /api/ota/check). Reads the body of a 200
+ * response whose headers were fetched, and releases the pooled client.
+ * @return OTA_CHECK_ERROR if the body holds no check answer.
+ */
+ota_check_result_t ota_manager_read_check_response(esp_http_client_handle_t client,
+                                                   int64_t content_len,
+                                                   ota_update_info_t *out_info);
+
+/**
+ * Seconds the server asked to wait before the next check (Retry-After of
+ * the last check response); 0 if it gave none or the check failed.
+ */
+int ota_manager_retry_after(void);
+
+/**
+ * Start the update watch: a background task that long-polls the check
+ * endpoint, which the server holds open for up to `wait_s` seconds and
+ * completes as soon as something changes for this device. It only raises
+ * ota_manager_update_hinted() and wakes the calling task (task
+ * notification); the caller still runs ota_manager_check_update().
+ * After repeated failures the watch stops and may only be restarted
+ * several minutes later. No-op if already running or `wait_s` is 0.
+ * @param current_version  Must stay valid while the watch runs.
+ */
+void ota_manager_watch_start(const char *current_version, int wait_s);
+
+/**
+ * True while the update watch is holding a long-poll, i.e. interval
+ * checks can be relaxed.
+ */
+bool ota_manager_watch_active(void);
+
+/**
+ * True if the watch saw an update offered since the last
+ * ota_manager_check_update().
+ */
+bool ota_manager_update_hinted(void);
+
 /**
  * Download firmware to the next OTA partition.
+ * The build's signed manifest is checked first (info->manifest_url);
+ * an update whose check answer it does not vouch for is not downloaded.
+ * The image head (esp_image_header_t + esp_app_desc_t) is checked as
+ * soon as it arrives: wrong chip, project or version, or a secure
+ * version below the running app's, stops the transfer within the first
+ * few hundred bytes, without falling back to other variants.
+ * If the server offered a delta patch and the running image matches its
+ * base, the patch is applied against the running partition instead of
+ * pulling the full image. Otherwise a compressed image is preferred and
+ * inflated on the fly. Each failed variant falls back to the next one,
+ * ending with the plain image.
+ * Plain-image progress is checkpointed to NVS; a later call for the same
+ * deployment resumes with an HTTP Range request.
+ * With a chunk list (info->chunks_url) every chunk is hashed as soon as
+ * it is on flash; the plain image re-fetches a bad chunk by Range and
+ * the other variants fall back at once.
+ * The transfer is paced to the stricter of info->rate_limit_bps and the
+ * site cap in NVS (device_cfg/ota_rate_bps). A stream averaging below
+ * the throughput floor over 30 s (device_cfg/ota_min_bps, default
+ * 1 KB/s) is dropped.
+ * The plain image comes from info->blob_url when set, else download_url.
+ * With info->mirrors its sources are ranked by a short
+ * probe (cached for an hour), and a stream that stalls, breaks or is
+ * refused resumes by Range from the next source; each source gets three
+ * tries before the call returns OTA_DOWNLOAD_TIMEOUT.
  * @param info  Update info from check_update.
- * @return OTA_DOWNLOAD_OK or OTA_DOWNLOAD_FAIL.
+ * @return OTA_DOWNLOAD_OK, OTA_DOWNLOAD_TIMEOUT / OTA_DOWNLOAD_CANCELLED
+ *         (resumable), or OTA_DOWNLOAD_FAIL.
  */
 ota_download_result_t ota_manager_download(const ota_update_info_t *info);
 
+/**
+ * Run ota_manager_download() in a background task below the caller's
+ * priority. `info` is copied. Progress and the final result arrive as
+ * events from ota_manager_next_event(); verify/apply only after
+ * OTA_EVENT_DONE.
+ * @return false if a download is already running or the task could not
+ *         be created.
+ */
+bool ota_manager_download_start(const ota_update_info_t *info);
+
+/**
+ * Ask the background download to stop. It finishes with
+ * OTA_DOWNLOAD_CANCELLED after the read in progress returns; plain-image
+ * progress stays checkpointed for a later resume.
+ */
+void ota_manager_download_cancel(void);
+
+/**
+ * Wait up to `timeout_ms` for the next background download event.
+ * @return false on timeout.
+ */
+bool ota_manager_next_event(ota_event_t *out, uint32_t timeout_ms);
+
+/**
+ * Start erasing the inactive OTA partition in small background slices,
+ * so a following download only has to program flash. Safe to call while
+ * a download is running; the eraser stays ahead of the writer. No-op if
+ * already running or the partition is fully erased. Destroys the previous
+ * image held in that slot.
+ */
+void ota_manager_preerase_start(void);
+
 /**
  * Verify the downloaded firmware's SHA-256 hash.
  * @param info  Update info containing expected hash.
@@ -67,12 +238,57 @@ bool ota_manager_verify_hash(const ota_update_info_t *info);
  */
 bool ota_manager_apply(void);
 
+/**
+ * Finalize a verified download without switching the boot partition:
+ * the image stays in the inactive slot, recorded in NVS so it survives
+ * reboots, until ota_manager_activate_staged(). A later download for
+ * another deployment discards it; pre-erase leaves it alone.
+ * @return true on success.
+ */
+bool ota_manager_stage(const ota_update_info_t *info);
+
+/**
+ * Deployment ID of the staged image, or NULL if none is staged.
+ */
+const char *ota_manager_staged_deployment(void);
+
+/* An image that passed hash and image verification and is still on flash */
+typedef struct {
+    const esp_partition_t *partition;
+    uint32_t               size;
+    char                   hash[OTA_MAX_HASH_LEN];
+} ota_verified_image_t;
+
+/**
+ * The last verified image, whether running or staged, for serving to
+ * LAN peers. The first call after boot re-hashes it on flash (about a
+ * second per MB). A download into its slot drops it.
+ * @return false if there is none.
+ */
+bool ota_manager_verified_image(ota_verified_image_t *out);
+
+/**
+ * Re-hash the staged image on flash and make it the next boot partition.
+ * The staged record is dropped either way. Caller should reboot after
+ * this returns true.
+ * @return true on success.
+ */
+bool ota_manager_activate_staged(void);
+
 /**
  * Abort a partially downloaded OTA.
  */
 void ota_manager_abort(void);
 
 /**
- * Test if OTA server is reachable (HTTP HEAD).
+ * Hand out the timings of the last finished attempt, once.
+ * An attempt ends with a failed/interrupted download, a failed verify,
+ * or ota_manager_apply().
+ * @return false if there is nothing new since the last call.
+ */
+bool ota_manager_take_timings(ota_timings_t *out);
+
+/**
+ * Test if OTA server is reachable (GET /api/ota/ping, no body).
  */
 bool ota_manager_server_reachable(void);
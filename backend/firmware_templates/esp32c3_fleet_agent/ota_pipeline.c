@@ -0,0 +1,97 @@
+/**
+ * OTA Pipeline — Implementation
+ * With depth 1 the receiver waits on every write; from depth 2 a read
+ * runs while the previous buffer is written, and a third buffer absorbs
+ * a sector erase landing on a fast read.
+ */
+
+#include "ota_pipeline.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "OTA_PIPE";
+
+static void writer_task(void *arg)
+{
+    ota_pipeline_t *p = arg;
+    ota_chunk_t chunk;
+
+    while (xQueueReceive(p->full_q, &chunk, portMAX_DELAY) == pdTRUE && chunk.len > 0) {
+        /* After a failure keep draining so the receiver never blocks */
+        if (!p->failed) {
+            int64_t t0 = esp_timer_get_time();
+            if (!p->consume(p->user, chunk.data, chunk.len)) {
+                p->failed = true;
+            }
+            p->consume_us += esp_timer_get_time() - t0;
+        }
+        xQueueSend(p->free_q, &chunk, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(p->done);
+    vTaskDelete(NULL);
+}
+
+static void pipeline_free(ota_pipeline_t *p)
+{
+    if (p->free_q) vQueueDelete(p->free_q);
+    if (p->full_q) vQueueDelete(p->full_q);
+    if (p->done)   vSemaphoreDelete(p->done);
+    free(p->pool);
+    p->free_q = p->full_q = NULL;
+    p->done = NULL;
+    p->pool = NULL;
+}
+
+bool ota_pipeline_start(ota_pipeline_t *p, int depth, size_t buf_size,
+                        ota_pipeline_consumer_t consume, void *user)
+{
+    memset(p, 0, sizeof(*p));
+    if (depth < 1 || depth > OTA_PIPELINE_MAX_DEPTH) return false;
+    p->consume = consume;
+    p->user    = user;
+    p->pool    = malloc(depth * buf_size);
+    p->free_q  = xQueueCreate(depth, sizeof(ota_chunk_t));
+    p->full_q  = xQueueCreate(depth + 1, sizeof(ota_chunk_t)); /* +1: end marker */
+    p->done    = xSemaphoreCreateBinary();
+    if (!p->pool || !p->free_q || !p->full_q || !p->done) {
+        ESP_LOGE(TAG, "Pipeline allocation failed");
+        pipeline_free(p);
+        return false;
+    }
+
+    for (int i = 0; i < depth; i++) {
+        ota_chunk_t chunk = { .data = p->pool + i * buf_size, .len = 0 };
+        xQueueSend(p->free_q, &chunk, 0);
+    }
+
+    if (xTaskCreate(writer_task, "ota_writer", OTA_WRITER_STACK_SIZE, p,
+                    uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start writer task");
+        pipeline_free(p);
+        return false;
+    }
+    return true;
+}
+
+void ota_pipeline_acquire(ota_pipeline_t *p, ota_chunk_t *chunk)
+{
+    xQueueReceive(p->free_q, chunk, portMAX_DELAY);
+}
+
+void ota_pipeline_submit(ota_pipeline_t *p, const ota_chunk_t *chunk)
+{
+    xQueueSend(chunk->len > 0 ? p->full_q : p->free_q, chunk, portMAX_DELAY);
+}
+
+void ota_pipeline_stop(ota_pipeline_t *p)
+{
+    ota_chunk_t end = { .data = NULL, .len = 0 };
+    xQueueSend(p->full_q, &end, portMAX_DELAY);
+    xSemaphoreTake(p->done, portMAX_DELAY);
+    pipeline_free(p);
+}
@@ -0,0 +1,66 @@
+/**
+ * OTA Pipeline — Header
+ * Overlaps HTTP receive with flash work during a download. The calling
+ * task fills preallocated buffers while a writer task hands full ones to
+ * the consumer (erase/program flash, hash), so the radio is not idle
+ * while flash is busy.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#define OTA_PIPELINE_MAX_DEPTH    4
+#define OTA_WRITER_STACK_SIZE     6144
+
+/* Consumer for received chunks; return false to abort */
+typedef bool (*ota_pipeline_consumer_t)(void *user, const uint8_t *data, size_t len);
+
+typedef struct {
+    uint8_t *data;
+    int      len;                  /* 0 marks end of stream */
+} ota_chunk_t;
+
+/* Buffers circulate between two queues: free_q (ready to receive into)
+ * and full_q (ready to consume) */
+typedef struct {
+    QueueHandle_t            free_q;
+    QueueHandle_t            full_q;
+    SemaphoreHandle_t        done;
+    uint8_t                 *pool;
+    ota_pipeline_consumer_t  consume;
+    void                    *user;
+    volatile bool            failed;      /* consumer rejected data        */
+    int64_t                  consume_us;  /* writer time in the consumer   */
+} ota_pipeline_t;
+
+/**
+ * Allocate `depth` buffers of `buf_size` bytes and start the writer task
+ * at the caller's priority.
+ * @return false if depth is out of range or an allocation failed.
+ */
+bool ota_pipeline_start(ota_pipeline_t *p, int depth, size_t buf_size,
+                        ota_pipeline_consumer_t consume, void *user);
+
+/**
+ * Take a free buffer (of the size given to start) to receive into,
+ * blocking until the writer returns one.
+ */
+void ota_pipeline_acquire(ota_pipeline_t *p, ota_chunk_t *chunk);
+
+/**
+ * Queue `chunk` for the writer if chunk->len > 0; otherwise hand the
+ * buffer back unused.
+ */
+void ota_pipeline_submit(ota_pipeline_t *p, const ota_chunk_t *chunk);
+
+/**
+ * Flush everything queued, wait for the writer to exit, release buffers.
+ * `failed` and `consume_us` stay readable afterwards.
+ */
+void ota_pipeline_stop(ota_pipeline_t *p);
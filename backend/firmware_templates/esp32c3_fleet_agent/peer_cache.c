@@ -0,0 +1,170 @@
+/**
+ * Peer Cache — Implementation
+ * A small esp_http_server on PEER_CACHE_PORT answering GET (with Range)
+ * for the hash of ota_manager_verified_image(), read straight from its
+ * partition. Bodies go out raw with a Content-Length, because
+ * httpd_resp_send_chunk() would chunk them and the downloading side
+ * checks the length it was promised.
+ */
+
+#include "peer_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include "esp_partition.h"
+#include "nvs.h"
+
+#include "ota_manager.h"
+#include "wifi_manager.h"
+
+static const char *TAG = "PEER_CACHE";
+
+/* ── Configuration ────────────────────────────────────────────── */
+#ifndef PEER_CACHE_ENABLED
+#define PEER_CACHE_ENABLED      0       /* NVS device_cfg/peer_cache overrides */
+#endif
+#define PEER_CACHE_PORT         8070
+#define PEER_CACHE_MAX_SOCKETS  3
+#define PEER_CACHE_BUF_SIZE     4096
+
+#define NVS_NAMESPACE_CONFIG    "device_cfg"
+#define NVS_KEY_PEER_CACHE      "peer_cache"
+
+static httpd_handle_t s_server = NULL;
+
+/* ── Helpers ──────────────────────────────────────────────────── */
+
+static bool peer_cache_enabled(void)
+{
+    uint8_t on = PEER_CACHE_ENABLED;
+    nvs_handle_t h;
+    if (nvs_open(NVS_NAMESPACE_CONFIG, NVS_READONLY, &h) == ESP_OK) {
+        nvs_get_u8(h, NVS_KEY_PEER_CACHE, &on);
+        nvs_close(h);
+    }
+    return on != 0;
+}
+
+/* "bytes=a-" or "bytes=a-b"; anything else means the whole image */
+static bool parse_range(httpd_req_t *req, uint32_t size, uint32_t *start, uint32_t *end)
+{
+    char spec[48];
+    *start = 0;
+    *end = size - 1;
+    if (httpd_req_get_hdr_value_str(req, "Range", spec, sizeof(spec)) != ESP_OK ||
+        strncmp(spec, "bytes=", 6) != 0 || spec[6] < '0' || spec[6] > '9') {
+        return false;
+    }
+    char *dash;
+    *start = (uint32_t)strtoul(spec + 6, &dash, 10);
+    if (*dash != '-') {
+        *start = 0;
+        return false;
+    }
+    if (dash[1] >= '0' && dash[1] <= '9') {
+        uint32_t last = (uint32_t)strtoul(dash + 1, NULL, 10);
+        if (last < *end) *end = last;
+    }
+    return true;
+}
+
+/* ── Handler ──────────────────────────────────────────────────── */
+
+static esp_err_t blob_get_handler(httpd_req_t *req)
+{
+    ota_verified_image_t img;
+    const char *hash = strrchr(req->uri, '/') + 1;
+    if (!ota_manager_verified_image(&img) || strcasecmp(hash, img.hash) != 0) {
+        return httpd_resp_send_404(req);
+    }
+
+    uint32_t start, end;
+    bool ranged = parse_range(req, img.size, &start, &end);
+    if (start > end) {
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    uint8_t *buf = malloc(PEER_CACHE_BUF_SIZE);
+    if (!buf) return httpd_resp_send_500(req);
+
+    int n = snprintf((char *)buf, PEER_CACHE_BUF_SIZE,
+                     "HTTP/1.1 %s\r\n"
+                     "Content-Type: application/octet-stream\r\n"
+                     "Content-Length: %lu\r\n"
+                     "Accept-Ranges: bytes\r\n",
+                     ranged ? "206 Partial Content" : "200 OK",
+                     (unsigned long)(end - start + 1));
+    if (ranged) {
+        n += snprintf((char *)buf + n, PEER_CACHE_BUF_SIZE - n,
+                      "Content-Range: bytes %lu-%lu/%lu\r\n",
+                      (unsigned long)start, (unsigned long)end, (unsigned long)img.size);
+    }
+    n += snprintf((char *)buf + n, PEER_CACHE_BUF_SIZE - n, "\r\n");
+
+    ESP_LOGI(TAG, "Serving %lu bytes from %lu", (unsigned long)(end - start + 1),
+             (unsigned long)start);
+    bool ok = httpd_send(req, (const char *)buf, n) == n;
+    for (uint32_t off = start; ok && off <= end; off += PEER_CACHE_BUF_SIZE) {
+        size_t len = end + 1 - off < PEER_CACHE_BUF_SIZE ? end + 1 - off : PEER_CACHE_BUF_SIZE;
+        ok = esp_partition_read(img.partition, off, buf, len) == ESP_OK &&
+             httpd_send(req, (const char *)buf, len) == (int)len;
+    }
+    free(buf);
+
+    /* ESP_FAIL closes the socket: the peer sees a short body and resumes */
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+/* ── Public API ───────────────────────────────────────────────── */
+
+void peer_cache_start(void)
+{
+    if (s_server || !peer_cache_enabled()) return;
+
+    ota_verified_image_t img;
+    if (!ota_manager_verified_image(&img)) {
+        ESP_LOGI(TAG, "No verified image to share");
+        return;
+    }
+
+    httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
+    cfg.server_port      = PEER_CACHE_PORT;
+    cfg.ctrl_port        = PEER_CACHE_PORT + 1;
+    cfg.max_open_sockets = PEER_CACHE_MAX_SOCKETS;
+    cfg.lru_purge_enable = true;
+    cfg.uri_match_fn     = httpd_uri_match_wildcard;
+    if (httpd_start(&s_server, &cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "HTTP server failed to start");
+        s_server = NULL;
+        return;
+    }
+
+    httpd_uri_t uri_blob = {
+        .uri = "/api/ota/blob/*", .method = HTTP_GET, .handler = blob_get_handler};
+    httpd_register_uri_handler(s_server, &uri_blob);
+
+    ESP_LOGI(TAG, "Sharing image %.12s... on port %d", img.hash, PEER_CACHE_PORT);
+}
+
+void peer_cache_stop(void)
+{
+    if (!s_server) return;
+    httpd_stop(s_server);
+    s_server = NULL;
+}
+
+bool peer_cache_advert(char *url, size_t url_size, char *blob, size_t blob_size)
+{
+    ota_verified_image_t img;
+    if (!s_server || !wifi_manager_is_connected() || !ota_manager_verified_image(&img)) {
+        return false;
+    }
+    snprintf(url, url_size, "http://%s:%d", wifi_manager_get_ip(), PEER_CACHE_PORT);
+    snprintf(blob, blob_size, "%s", img.hash);
+    return true;
+}
@@ -0,0 +1,32 @@
+/**
+ * Peer Cache — Header
+ * Optional LAN cache: serves the last verified firmware image to other
+ * agents on the site at /api/ota/blob/{sha256}, the server's own path.
+ * The server learns about it from the heartbeat and lists it among the
+ * mirrors of same-site devices; they rank it like any other mirror and
+ * verify the image hash as they would for any source.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Start serving if peer caching is enabled (PEER_CACHE_ENABLED, or NVS
+ * device_cfg/peer_cache) and a verified image is on flash. Safe to call
+ * again, e.g. once a new image is staged.
+ */
+void peer_cache_start(void);
+
+/**
+ * Stop serving (e.g. while the network is down).
+ */
+void peer_cache_stop(void);
+
+/**
+ * What to announce in the heartbeat: base URL ("http://<ip>:<port>")
+ * and SHA-256 of the image served.
+ * @return false while nothing is being served.
+ */
+bool peer_cache_advert(char *url, size_t url_size, char *blob, size_t blob_size);
@@ -5,27 +5,34 @@ import os
 ROOT_DIR = Path(__file__).parent
 load_dotenv(ROOT_DIR / '.env')
 
-from fastapi import FastAPI, APIRouter, Depends, HTTPException, BackgroundTasks
+from fastapi import FastAPI, APIRouter, Depends, HTTPException, BackgroundTasks, Request
 from starlette.middleware.cors import CORSMiddleware
 from motor.motor_asyncio import AsyncIOMotorClient
 import logging
 import asyncio
 import hashlib
+import ipaddress
+import json
+import time
 import random
+import re
 import string
 from pydantic import BaseModel, Field
 from typing import List, Optional, Dict, Any
 import uuid
-from datetime import datetime, timezone
+from datetime import datetime, timedelta, timezone
 
-from fastapi.responses import FileResponse
+from fastapi.responses import FileResponse, StreamingResponse, JSONResponse, Response
 
 from auth import (
     hash_password, verify_password, create_token,
     get_current_user, require_role
 )
 from pin_rules import validate_pin_config, get_board_profile
-from build_service import real_build_process, get_public_key_pem, ARTIFACTS_DIR
+from build_service import (
+    real_build_process, get_public_key_pem, get_public_key_der, get_public_key_endorsement,
+    get_signing_key_id, canonical_manifest, ARTIFACTS_DIR,
+)
 
 mongo_url = os.environ['MONGO_URL']
 client = AsyncIOMotorClient(mongo_url)
@@ -75,6 +82,11 @@ class DeployCreate(BaseModel):
     target_device_ids: List[str]
     rollout_percent: int = 100
     rollout_strategy: str = "immediate"  # immediate, canary
+    rate_limit_bps: int = 0  # per-device download cap in bytes/s, 0 = unlimited
+    activation: str = "immediate"  # immediate, window, manual
+    window_start: Optional[str] = None  # ISO 8601, for activation == "window"
+    window_end: Optional[str] = None
+    mirrors: List[str] = []  # base URLs of site caches proxying /api/ota/blob
 
 class DeployRollback(BaseModel):
     reason: str = ""
@@ -85,10 +97,49 @@ class TelemetryHeartbeat(BaseModel):
     rssi: int = 0
     free_heap: int = 0
     uptime: int = 0
+    # Agent HTTP connection pool counters since boot
+    conn_hits: int = 0
+    conn_misses: int = 0
+    conn_handshakes: int = 0
+    tls_full: int = 0
+    tls_offered: int = 0
+    ota_progress: int = -1  # percent of a running OTA download, -1 = none
+    peer_url: str = ""  # LAN peer cache base URL, "" = not sharing
+    peer_blob: str = ""  # SHA-256 of the image the peer cache serves
 
 class OTACheckRequest(BaseModel):
     device_id: str
     current_version: str
+    wait: int = 0  # long-poll: seconds to hold an unchanged (If-None-Match) answer
+
+class OTATimings(BaseModel):
+    method: str = ""
+    connect_ms: int = 0
+    first_byte_ms: int = 0
+    receive_ms: int = 0
+    throttle_ms: int = 0
+    flash_read_ms: int = 0
+    flash_erase_ms: int = 0
+    flash_write_ms: int = 0
+    hash_ms: int = 0
+    image_verify_ms: int = 0
+    set_boot_ms: int = 0
+    manifest_ms: int = 0
+    probe_ms: int = 0
+    preerase_saved_ms: int = 0
+    total_ms: int = 0
+    bytes_received: int = 0
+    image_bytes: int = 0
+    sectors_programmed: int = 0
+    sectors_skipped: int = 0
+    rate_limit_bps: int = 0
+    chunk_retries: int = 0
+    stall_aborts: int = 0
+    min_window_bps: int = 0
+    mirror_switches: int = 0
+
+class OTAReportBody(BaseModel):
+    timings: Optional[OTATimings] = None
 
 class UserRoleUpdate(BaseModel):
     role: str
@@ -115,6 +166,71 @@ async def audit_log(user_id: str, user_email: str, action: str, resource_type: s
         "timestamp": now_iso(),
     })
 
+# Check answers are cached per device and tagged with an ETag; devices echo
+# it in If-None-Match and get an empty 304 without touching Mongo. A change
+# to one device's answer calls _invalidate_ota_check(device_id); deployment
+# changes, which may move any device, call _invalidate_ota_checks(). The TTL
+# bounds staleness when several workers each hold their own cache.
+OTA_CHECK_CACHE_TTL = 300  # seconds
+_ota_check_cache: Dict[str, tuple] = {}   # device_id -> (generation, expires, etag, body)
+_ota_check_generation = 0                 # bumped by fleet-wide invalidation
+_ota_check_device_generation: Dict[str, int] = {}
+
+# Long-polling checks park on their device's change event; invalidation sets
+# it and drops it, so the next wait gets a fresh one. Only waiters on this
+# worker are woken — others fall back to their wait timeout.
+OTA_LONG_POLL_MAX = 300  # seconds
+_ota_check_changed: Dict[str, asyncio.Event] = {}
+
+def _ota_check_generation_of(device_id: str) -> tuple:
+    return _ota_check_generation, _ota_check_device_generation.get(device_id, 0)
+
+def _invalidate_ota_check(device_id: str):
+    _ota_check_device_generation[device_id] = _ota_check_device_generation.get(device_id, 0) + 1
+    _ota_check_cache.pop(device_id, None)
+    changed = _ota_check_changed.pop(device_id, None)
+    if changed:
+        changed.set()
+
+def _invalidate_ota_checks():
+    global _ota_check_generation
+    _ota_check_generation += 1
+    _ota_check_cache.clear()
+    for changed in _ota_check_changed.values():
+        changed.set()
+    _ota_check_changed.clear()
+
+# Devices schedule their next heartbeat / OTA check from the Retry-After
+# header of those responses. When device traffic over the last window
+# exceeds DEVICE_POLL_TARGET_RPS, intervals stretch in proportion, so a
+# fleet rebooting at once spreads itself out instead of hammering in step.
+# The traffic seen is already stretched, so each window scales the current
+# stretch rather than replacing it; and each answer gets its own share of
+# POLL_STRETCH_JITTER, otherwise devices told different whole-second
+# intervals in consecutive windows come back in the same second
+# (tests/sim_fleet_polling.py shows both).
+HEARTBEAT_INTERVAL_S = int(os.environ.get('HEARTBEAT_INTERVAL_S', '30'))
+OTA_CHECK_INTERVAL_S = int(os.environ.get('OTA_CHECK_INTERVAL_S', '60'))
+DEVICE_POLL_TARGET_RPS = float(os.environ.get('DEVICE_POLL_TARGET_RPS', '100'))
+POLL_WINDOW_S = 10
+POLL_STRETCH_MAX = 10
+POLL_STRETCH_JITTER = 0.2
+_poll_window = {"start": 0.0, "count": 0, "stretch": 1.0}
+
+def _poll_retry_after(base_s: int) -> Dict[str, str]:
+    now = time.monotonic()
+    if now - _poll_window["start"] >= POLL_WINDOW_S:
+        elapsed = now - _poll_window["start"]
+        rate = _poll_window["count"] / elapsed if elapsed < 2 * POLL_WINDOW_S else 0.0
+        stretch = _poll_window["stretch"] * rate / DEVICE_POLL_TARGET_RPS
+        _poll_window["stretch"] = min(max(stretch, 1.0), POLL_STRETCH_MAX)
+        _poll_window["start"], _poll_window["count"] = now, 0
+    _poll_window["count"] += 1
+    stretch = _poll_window["stretch"]
+    if stretch > 1.0:
+        stretch = max(stretch * random.uniform(1 - POLL_STRETCH_JITTER, 1 + POLL_STRETCH_JITTER), 1.0)
+    return {"Retry-After": str(round(base_s * stretch))}
+
 # ─── AUTH ROUTES ────────────────────────────────────────────────────
 @api_router.post("/auth/register")
 async def register(req: RegisterRequest):
@@ -201,6 +317,7 @@ async def delete_device(device_id: str, user: dict = Depends(require_role("admin
     if user["role"] != "admin" and device.get("owner_id") != user["id"]:
         raise HTTPException(status_code=403, detail="Access denied")
     await db.devices.delete_one({"id": device_id})
+    _invalidate_ota_check(device_id)
     await audit_log(user["id"], user["email"], "delete_device", "device", device_id)
     return {"message": "Device deleted"}
 
@@ -377,8 +494,22 @@ async def _run_build(build_id: str, project_id: str, version: str, board_type: s
         board_type=board_type,
         version=version,
         db=db,
+        base_build=await _current_deployed_build(project_id),
+        project_name=project.get("name", ""),
     )
 
+async def _current_deployed_build(project_id: str):
+    """Most recently deployed (not rolled back) build of a project — the delta OTA base."""
+    builds = await db.builds.find({"project_id": project_id, "status": "success"}, {"_id": 0, "id": 1}).to_list(None)
+    if not builds:
+        return None
+    deploys = await db.deployments.find(
+        {"build_id": {"$in": [b["id"] for b in builds]}, "status": {"$ne": "rolled_back"}},
+        {"_id": 0, "build_id": 1}).sort("created_at", -1).to_list(1)
+    if not deploys:
+        return None
+    return await db.builds.find_one({"id": deploys[0]["build_id"]}, {"_id": 0})
+
 @api_router.post("/builds")
 async def trigger_build(req: BuildTrigger, background_tasks: BackgroundTasks, user: dict = Depends(require_role("admin", "developer"))):
     project = await db.projects.find_one({"id": req.project_id}, {"_id": 0})
@@ -425,6 +556,14 @@ async def get_build(build_id: str, user: dict = Depends(get_current_user)):
     return build
 
 # ─── DEPLOY ROUTES ──────────────────────────────────────────────────
+OTA_MAX_MIRRORS = 3  # matches the device's OTA_MAX_MIRRORS
+OTA_MAX_URL_LEN = 256  # matches the device's OTA_MAX_URL_LEN, NUL included
+# Longest mirror base whose blob URL still fits the device's URL buffer;
+# longer ones would be cut short there. Three such mirrors also keep the
+# check answer under the device's OTA_CHECK_MAX_RESPONSE (2048 bytes) and
+# each URL under its JSON_STREAM_MAX_VALUE (384).
+OTA_MIRROR_BASE_MAX = OTA_MAX_URL_LEN - 1 - len("/api/ota/blob/") - 64
+
 @api_router.post("/deployments")
 async def create_deployment(req: DeployCreate, user: dict = Depends(require_role("admin", "developer"))):
     build = await db.builds.find_one({"id": req.build_id}, {"_id": 0})
@@ -432,6 +571,20 @@ async def create_deployment(req: DeployCreate, user: dict = Depends(require_role
         raise HTTPException(status_code=404, detail="Build not found")
     if build["status"] != "success":
         raise HTTPException(status_code=400, detail="Build not successful")
+    if req.activation not in ("immediate", "window", "manual"):
+        raise HTTPException(status_code=400, detail="activation must be immediate, window or manual")
+    if req.activation == "window":
+        try:
+            start, end = _parse_utc(req.window_start), _parse_utc(req.window_end)
+        except (TypeError, ValueError):
+            raise HTTPException(status_code=400, detail="window_start and window_end must be ISO 8601 times")
+        if end <= start:
+            raise HTTPException(status_code=400, detail="window_end must be after window_start")
+    mirrors = [m.strip().rstrip("/") for m in req.mirrors if m.strip()]
+    if len(mirrors) > OTA_MAX_MIRRORS or not all(m.startswith(("http://", "https://")) for m in mirrors):
+        raise HTTPException(status_code=400, detail=f"mirrors must be up to {OTA_MAX_MIRRORS} http(s) base URLs")
+    if any(len(m) > OTA_MIRROR_BASE_MAX for m in mirrors):
+        raise HTTPException(status_code=400, detail=f"mirror base URLs must be at most {OTA_MIRROR_BASE_MAX} characters")
     deploy_id = gen_id()
     device_statuses = {}
     for did in req.target_device_ids:
@@ -446,14 +599,26 @@ async def create_deployment(req: DeployCreate, user: dict = Depends(require_role
         "device_statuses": device_statuses,
         "rollout_percent": req.rollout_percent,
         "rollout_strategy": req.rollout_strategy,
+        "rate_limit_bps": max(0, req.rate_limit_bps),
+        "activation": req.activation,
+        "window_start": req.window_start if req.activation == "window" else None,
+        "window_end": req.window_end if req.activation == "window" else None,
+        "mirrors": mirrors,
+        "activated_at": None,
         "status": "active",
         "artifact_hash": build.get("artifact_hash", ""),
+        "artifact_size": build.get("artifact_size", 0),
+        "compressed": (build.get("manifest") or {}).get("compressed"),
+        "delta": (build.get("manifest") or {}).get("delta"),
+        "chunks": (build.get("manifest") or {}).get("chunks"),
+        "app_project_name": (build.get("manifest") or {}).get("app_project_name", ""),
         "created_at": now_iso(),
     }
     await db.deployments.insert_one(deploy)
     # Update devices with pending OTA
     for did in req.target_device_ids:
         await db.devices.update_one({"id": did}, {"$set": {"last_ota_status": "pending", "pending_deployment_id": deploy_id}})
+    _invalidate_ota_checks()
     await audit_log(user["id"], user["email"], "create_deployment", "deployment", deploy_id, f"v{build['version']} to {len(req.target_device_ids)} devices")
     result = {k: v for k, v in deploy.items() if k != "_id"}
     return result
@@ -471,6 +636,21 @@ async def get_deployment(deploy_id: str, user: dict = Depends(get_current_user))
         raise HTTPException(status_code=404, detail="Deployment not found")
     return deploy
 
+OTA_TIMING_PHASES = [
+    "connect_ms", "first_byte_ms", "receive_ms", "throttle_ms", "flash_read_ms", "flash_erase_ms",
+    "flash_write_ms", "hash_ms", "image_verify_ms", "set_boot_ms", "manifest_ms", "probe_ms", "preerase_saved_ms", "total_ms",
+]
+
+@api_router.get("/deployments/{deploy_id}/ota-timings")
+async def get_deployment_ota_timings(deploy_id: str, user: dict = Depends(get_current_user)):
+    """Per-device OTA phase timings for a deployment, plus per-phase averages for charting."""
+    records = await db.ota_timings.find({"deployment_id": deploy_id}, {"_id": 0}).sort("created_at", 1).to_list(1000)
+    averages = {}
+    if records:
+        averages = {p: round(sum(r.get(p, 0) for r in records) / len(records), 1)
+                    for p in OTA_TIMING_PHASES + ["achieved_bps", "chunk_retries", "stall_aborts", "mirror_switches"]}
+    return {"deployment_id": deploy_id, "count": len(records), "averages": averages, "records": records}
+
 @api_router.post("/deployments/{deploy_id}/rollback")
 async def rollback_deployment(deploy_id: str, req: DeployRollback, user: dict = Depends(require_role("admin", "developer"))):
     deploy = await db.deployments.find_one({"id": deploy_id}, {"_id": 0})
@@ -479,18 +659,34 @@ async def rollback_deployment(deploy_id: str, req: DeployRollback, user: dict =
     await db.deployments.update_one({"id": deploy_id}, {"$set": {"status": "rolled_back", "rollback_reason": req.reason, "rolled_back_at": now_iso()}})
     for did in deploy.get("target_device_ids", []):
         await db.devices.update_one({"id": did}, {"$set": {"last_ota_status": "rolled_back", "pending_deployment_id": ""}})
+    _invalidate_ota_checks()
     await audit_log(user["id"], user["email"], "rollback_deployment", "deployment", deploy_id, req.reason)
     return {"message": "Deployment rolled back"}
 
+@api_router.post("/deployments/{deploy_id}/activate")
+async def activate_deployment(deploy_id: str, user: dict = Depends(require_role("admin", "developer"))):
+    """Tell devices holding this deployment's staged image to switch to it now."""
+    deploy = await db.deployments.find_one_and_update(
+        {"id": deploy_id}, {"$set": {"activated_at": now_iso()}},
+        projection={"_id": 0, "target_device_ids": 1})
+    if not deploy:
+        raise HTTPException(status_code=404, detail="Deployment not found")
+    for did in deploy.get("target_device_ids", []):
+        _invalidate_ota_check(did)
+    await audit_log(user["id"], user["email"], "activate_deployment", "deployment", deploy_id)
+    return {"message": "Deployment activated"}
+
 @api_router.post("/deployments/{deploy_id}/pause")
 async def pause_deployment(deploy_id: str, user: dict = Depends(require_role("admin", "developer"))):
     await db.deployments.update_one({"id": deploy_id}, {"$set": {"status": "paused"}})
+    _invalidate_ota_checks()
     await audit_log(user["id"], user["email"], "pause_deployment", "deployment", deploy_id)
     return {"message": "Deployment paused"}
 
 @api_router.post("/deployments/{deploy_id}/resume")
 async def resume_deployment(deploy_id: str, user: dict = Depends(require_role("admin", "developer"))):
     await db.deployments.update_one({"id": deploy_id}, {"$set": {"status": "active"}})
+    _invalidate_ota_checks()
     await audit_log(user["id"], user["email"], "resume_deployment", "deployment", deploy_id)
     return {"message": "Deployment resumed"}
 
@@ -503,28 +699,220 @@ async def update_rollout(deploy_id: str, rollout_percent: int, user: dict = Depe
     return {"message": f"Rollout updated to {rollout_percent}%"}
 
 # ─── OTA DEVICE PULL ROUTES ────────────────────────────────────────
-@api_router.post("/ota/check")
-async def ota_check_update(req: OTACheckRequest):
-    """Device polls this to check for pending OTA updates."""
-    device = await db.devices.find_one({"id": req.device_id}, {"_id": 0})
+def _parse_utc(value: str) -> datetime:
+    dt = datetime.fromisoformat(value.replace("Z", "+00:00"))
+    return dt if dt.tzinfo else dt.replace(tzinfo=timezone.utc)
+
+def _deployment_activation(deploy: dict):
+    """Whether devices may switch to the deployment's image now, and for how
+    many seconds that answer holds (None = until the deployment changes)."""
+    mode = deploy.get("activation", "immediate")
+    if mode == "immediate" or deploy.get("activated_at"):
+        return True, None
+    if mode == "window":
+        now = datetime.now(timezone.utc)
+        start, end = _parse_utc(deploy["window_start"]), _parse_utc(deploy["window_end"])
+        if now < start:
+            return False, (start - now).total_seconds()
+        if now < end:
+            return True, (end - now).total_seconds()
+    return False, None
+
+async def _build_ota_check_response(device_id: str):
+    """Check answer for a device, and how many seconds it stays valid (None = until invalidated)."""
+    device = await db.devices.find_one({"id": device_id}, {"_id": 0})
     if not device:
         raise HTTPException(status_code=404, detail="Device not found")
     deploy_id = device.get("pending_deployment_id", "")
     if not deploy_id:
-        return {"update_available": False}
+        return {"update_available": False}, None
     deploy = await db.deployments.find_one({"id": deploy_id}, {"_id": 0})
     if not deploy or deploy["status"] != "active":
-        return {"update_available": False}
-    return {
+        return {"update_available": False}, None
+    resp = {
         "update_available": True,
         "deployment_id": deploy_id,
         "version": deploy["version"],
         "artifact_hash": deploy.get("artifact_hash", ""),
+        "artifact_size": deploy.get("artifact_size", 0),
         "download_url": f"/api/ota/download/{deploy_id}",
     }
+    if deploy.get("artifact_hash"):
+        # Same bytes, named by content: caches in front of us can keep it
+        resp["blob_url"] = f"/api/ota/blob/{deploy['artifact_hash']}"
+    if deploy.get("rate_limit_bps"):
+        resp["rate_limit_bps"] = deploy["rate_limit_bps"]
+    if deploy.get("mirrors") and deploy.get("artifact_hash"):
+        # Site caches of the same blob; the device ranks them with the
+        # server's URLs and fails over between them by Range
+        resp["mirrors"] = [f"{base}/api/ota/blob/{deploy['artifact_hash']}" for base in deploy["mirrors"]]
+    peers = await _site_peers(device, deploy.get("artifact_hash", ""), OTA_MAX_MIRRORS - len(resp.get("mirrors", [])))
+    if peers:
+        # Devices on the same LAN already holding the image; the device
+        # ranks them with the rest and checks the hash as for any source
+        resp["mirrors"] = resp.get("mirrors", []) + [f"{p}/api/ota/blob/{deploy['artifact_hash']}" for p in peers]
+    if deploy.get("app_project_name"):
+        # Device checks the image's esp_app_desc_t against this and the version
+        resp["app_project_name"] = deploy["app_project_name"]
+    valid_for = None
+    if deploy.get("activation", "immediate") != "immediate":
+        # Staged rollout: devices download and verify, then wait for this
+        resp["activate"], valid_for = _deployment_activation(deploy)
+    compressed = deploy.get("compressed")
+    if compressed:
+        resp.update({
+            "compressed_url": f"/api/ota/blob/{compressed['hash_sha256']}",
+            "compressed_hash": compressed["hash_sha256"],
+        })
+    delta = deploy.get("delta")
+    if delta:
+        # Device uses the patch only if its running image hashes to base_hash
+        resp.update({
+            "delta_url": f"/api/ota/blob/{delta['patch_hash_sha256']}",
+            "delta_base_hash": delta["base_hash"],
+            "delta_base_size": delta["base_size"],
+        })
+    key_id = get_signing_key_id()
+    if key_id:
+        # Device verifies the build's signed manifest before downloading
+        resp.update({
+            "manifest_url": f"/api/ota/signed-manifest/{deploy_id}",
+            "signing_key_id": key_id,
+        })
+    chunks = deploy.get("chunks")
+    if chunks:
+        # Device fetches the digest list and checks it against chunk_root
+        resp.update({
+            "chunks_url": f"/api/ota/chunks/{deploy_id}",
+            "chunk_size": chunks["size"],
+            "chunk_root": chunks["root"],
+        })
+    return resp, valid_for
+
+# Peer caches: agents share their last verified image on the LAN and announce
+# it in heartbeats. Devices reaching us from the same address sit behind the
+# same NAT, i.e. on the same site, so they are offered each other's caches.
+PEER_CACHE_MAX_AGE_S = 3 * HEARTBEAT_INTERVAL_S
+# X-Forwarded-For is only believed from these reverse proxy addresses
+TRUSTED_PROXIES = {a.strip() for a in os.environ.get('TRUSTED_PROXIES', '').split(',') if a.strip()}
+# Agents advertise http://<their LAN IPv4>:<port>; nothing else is handed
+# to other devices as a mirror
+_PEER_URL_RE = re.compile(r"http://(\d{1,3}(?:\.\d{1,3}){3}):(\d{1,5})")
+_PEER_CACHE_NETS = [ipaddress.ip_network(n) for n in ("10.0.0.0/8", "172.16.0.0/12", "192.168.0.0/16")]
+
+def _site_addr(request: Request) -> str:
+    addr = request.client.host if request.client else ""
+    forwarded = request.headers.get("x-forwarded-for", "")
+    if forwarded and addr in TRUSTED_PROXIES:
+        # Walk back from the hop our proxy appended; earlier entries are
+        # whatever the client chose to send
+        hops = [h.strip() for h in forwarded.split(",")]
+        while len(hops) > 1 and hops[-1] in TRUSTED_PROXIES:
+            hops.pop()
+        return hops[-1]
+    return addr
+
+def _valid_peer_url(url: str) -> bool:
+    m = _PEER_URL_RE.fullmatch(url)
+    if not m or not 0 < int(m[2]) < 65536:
+        return False
+    try:
+        ip = ipaddress.IPv4Address(m[1])
+    except ValueError:
+        return False
+    return ip.is_private and any(ip in net for net in _PEER_CACHE_NETS)
+
+async def _site_peers(device: dict, blob: str, limit: int) -> List[str]:
+    """Base URLs of fresh same-site, same-owner peer caches holding `blob`, at most `limit`."""
+    if not blob or limit <= 0 or not device.get("site_addr"):
+        return []
+    cutoff = (datetime.now(timezone.utc) - timedelta(seconds=PEER_CACHE_MAX_AGE_S)).isoformat()
+    holders = await db.devices.find({
+        "id": {"$ne": device["id"]},
+        "owner_id": device.get("owner_id"),
+        "site_addr": device["site_addr"],
+        "peer_cache.blob": blob,
+        "last_seen": {"$gte": cutoff},
+    }, {"_id": 0, "peer_cache": 1}).to_list(50)
+    # Spread a site's downloads over its holders; a stable order per device
+    # keeps its check answer (and ETag) unchanged between recomputations
+    urls = [d["peer_cache"]["url"] for d in holders]
+    urls.sort(key=lambda u: hashlib.sha256(f"{device['id']}|{u}".encode()).digest())
+    return urls[:limit]
+
+async def _cached_ota_check(device_id: str):
+    now = time.monotonic()
+    cached = _ota_check_cache.get(device_id)
+    if cached and cached[0] == _ota_check_generation_of(device_id) and cached[1] > now:
+        return cached[2], cached[3]
+    generation = _ota_check_generation_of(device_id)
+    body, valid_for = await _build_ota_check_response(device_id)
+    etag = '"' + hashlib.sha256(json.dumps(body, sort_keys=True).encode()).hexdigest()[:16] + '"'
+    if generation == _ota_check_generation_of(device_id):
+        # A maintenance window opening or closing changes the answer by itself
+        ttl = OTA_CHECK_CACHE_TTL if valid_for is None else min(OTA_CHECK_CACHE_TTL, valid_for)
+        _ota_check_cache[device_id] = (generation, now + ttl, etag, body)
+    return etag, body
+
+@api_router.post("/ota/check")
+async def ota_check_update(req: OTACheckRequest, request: Request):
+    """Device polls this to check for pending OTA updates (honours If-None-Match).
+
+    With `wait` > 0 an unchanged answer is held open until something changes
+    for the device or `wait` seconds pass, whichever comes first."""
+    client_etag = request.headers.get("if-none-match")
+    deadline = time.monotonic() + max(0, min(req.wait, OTA_LONG_POLL_MAX))
+    while True:
+        changed = _ota_check_changed.setdefault(req.device_id, asyncio.Event())
+        etag, body = await _cached_ota_check(req.device_id)
+        if client_etag != etag:
+            return JSONResponse(body, headers={"ETag": etag, **_poll_retry_after(OTA_CHECK_INTERVAL_S)})
+        remaining = deadline - time.monotonic()
+        if remaining <= 0:
+            return Response(status_code=304, headers={"ETag": etag, **_poll_retry_after(OTA_CHECK_INTERVAL_S)})
+        try:
+            await asyncio.wait_for(changed.wait(), timeout=remaining)
+        except asyncio.TimeoutError:
+            pass
+
+RANGE_CHUNK_SIZE = 64 * 1024
+
+def _ranged_file_response(request: Request, path: Path, media_type: str = "application/octet-stream",
+                          filename: Optional[str] = None, headers: Optional[Dict[str, str]] = None):
+    """FileResponse that honours a single `Range: bytes=a-b` so devices can resume downloads."""
+    headers = {**(headers or {}), "Accept-Ranges": "bytes"}
+    size = path.stat().st_size
+    spec = request.headers.get("range", "")
+    if not spec.startswith("bytes=") or "," in spec:
+        return FileResponse(str(path), media_type=media_type, filename=filename, headers=headers)
+    first, _, last = spec[len("bytes="):].strip().partition("-")
+    try:
+        if first:
+            start = int(first)
+            end = min(int(last), size - 1) if last else size - 1
+        else:
+            start, end = max(size - int(last), 0), size - 1   # suffix range
+    except ValueError:
+        return FileResponse(str(path), media_type=media_type, filename=filename, headers=headers)
+    if start >= size or start > end:
+        raise HTTPException(status_code=416, detail="Range not satisfiable", headers={"Content-Range": f"bytes */{size}"})
+
+    def iter_range():
+        with open(path, "rb") as f:
+            f.seek(start)
+            remaining = end - start + 1
+            while remaining > 0:
+                chunk = f.read(min(RANGE_CHUNK_SIZE, remaining))
+                if not chunk:
+                    break
+                remaining -= len(chunk)
+                yield chunk
+
+    headers.update({"Content-Range": f"bytes {start}-{end}/{size}", "Content-Length": str(end - start + 1)})
+    return StreamingResponse(iter_range(), status_code=206, media_type=media_type, headers=headers)
 
 @api_router.get("/ota/download/{deploy_id}")
-async def ota_download(deploy_id: str):
+async def ota_download(deploy_id: str, request: Request):
     """Device downloads firmware binary here."""
     deploy = await db.deployments.find_one({"id": deploy_id}, {"_id": 0})
     if not deploy:
@@ -538,13 +926,109 @@ async def ota_download(deploy_id: str):
     artifact_path = ARTIFACTS_DIR / artifact_file
     if not artifact_path.exists():
         raise HTTPException(status_code=404, detail="Artifact file not found on disk")
-    return FileResponse(
-        str(artifact_path),
-        media_type="application/octet-stream",
+    return _ranged_file_response(
+        request, artifact_path,
         filename=f"firmware_v{deploy.get('version', 'unknown')}.bin",
         headers={"X-Artifact-Hash": build.get("artifact_hash", "")},
     )
 
+# Blobs are named by their SHA-256, so any cache may keep them forever and a
+# binary deployed twice is fetched through the cache once. Uvicorn has no
+# zero-copy file path; behind nginx, OTA_BLOB_ACCEL_PREFIX names an internal
+# location aliasing the artifacts directory and nginx sends the file itself
+# (sendfile, Range) via X-Accel-Redirect.
+OTA_BLOB_CACHE_CONTROL = "public, max-age=31536000, immutable"
+OTA_BLOB_ACCEL_PREFIX = os.environ.get('OTA_BLOB_ACCEL_PREFIX', '').rstrip('/')
+_blob_files: Dict[str, str] = {}   # sha256 -> file in ARTIFACTS_DIR; immutable, never invalidated
+
+async def _blob_file(sha256: str) -> str:
+    """Artifact file with this content hash: an image, compressed image or delta patch."""
+    name = _blob_files.get(sha256)
+    if name:
+        return name
+    build = await db.builds.find_one({"$or": [
+        {"artifact_hash": sha256},
+        {"manifest.compressed.hash_sha256": sha256},
+        {"manifest.delta.patch_hash_sha256": sha256},
+    ]}, {"_id": 0, "artifact_hash": 1, "artifact_file": 1, "manifest": 1})
+    if not build:
+        return ""
+    manifest = build.get("manifest") or {}
+    if build.get("artifact_hash") == sha256:
+        name = build.get("artifact_file", "")
+    elif (manifest.get("compressed") or {}).get("hash_sha256") == sha256:
+        name = manifest["compressed"]["file"]
+    else:
+        name = manifest["delta"]["patch_file"]
+    if name:
+        _blob_files[sha256] = name
+    return name
+
+@api_router.get("/ota/blob/{sha256}")
+async def ota_blob(sha256: str, request: Request):
+    """Content-addressed OTA artifact, cacheable forever (honours Range and If-None-Match)."""
+    sha256 = sha256.lower()
+    if not re.fullmatch(r"[0-9a-f]{64}", sha256):
+        raise HTTPException(status_code=404, detail="Blob not found")
+    headers = {"Cache-Control": OTA_BLOB_CACHE_CONTROL, "ETag": f'"{sha256}"'}
+    if request.headers.get("if-none-match") == headers["ETag"]:
+        return Response(status_code=304, headers=headers)
+    name = await _blob_file(sha256)
+    if not name or not (ARTIFACTS_DIR / name).exists():
+        raise HTTPException(status_code=404, detail="Blob not found")
+    if OTA_BLOB_ACCEL_PREFIX:
+        return Response(headers={**headers, "X-Accel-Redirect": f"{OTA_BLOB_ACCEL_PREFIX}/{name}"})
+    return _ranged_file_response(request, ARTIFACTS_DIR / name, headers=headers)
+
+@api_router.get("/ota/compressed/{deploy_id}")
+async def ota_download_compressed(deploy_id: str, request: Request):
+    """Device downloads the LZSS-compressed firmware and inflates it while writing."""
+    deploy = await db.deployments.find_one({"id": deploy_id}, {"_id": 0})
+    if not deploy:
+        raise HTTPException(status_code=404, detail="Deployment not found")
+    compressed = deploy.get("compressed")
+    if not compressed:
+        raise HTTPException(status_code=404, detail="No compressed artifact for this deployment")
+    packed_path = ARTIFACTS_DIR / compressed["file"]
+    if not packed_path.exists():
+        raise HTTPException(status_code=404, detail="Compressed artifact not found on disk")
+    return _ranged_file_response(
+        request, packed_path,
+        headers={"X-Artifact-Hash": deploy.get("artifact_hash", ""), "X-Compressed-Hash": compressed["hash_sha256"]},
+    )
+
+@api_router.get("/ota/delta/{deploy_id}")
+async def ota_download_delta(deploy_id: str, request: Request):
+    """Device downloads the compressed delta patch against its running image."""
+    deploy = await db.deployments.find_one({"id": deploy_id}, {"_id": 0})
+    if not deploy:
+        raise HTTPException(status_code=404, detail="Deployment not found")
+    delta = deploy.get("delta")
+    if not delta:
+        raise HTTPException(status_code=404, detail="No delta patch for this deployment")
+    patch_path = ARTIFACTS_DIR / delta["patch_file"]
+    if not patch_path.exists():
+        raise HTTPException(status_code=404, detail="Patch file not found on disk")
+    return _ranged_file_response(
+        request, patch_path,
+        headers={"X-Patch-Hash": delta.get("patch_hash_sha256", "")},
+    )
+
+@api_router.get("/ota/chunks/{deploy_id}")
+async def ota_chunk_hashes(deploy_id: str):
+    """Per-chunk SHA-256 digests of the firmware, concatenated as raw 32-byte values."""
+    deploy = await db.deployments.find_one({"id": deploy_id}, {"_id": 0, "chunks": 1})
+    if not deploy:
+        raise HTTPException(status_code=404, detail="Deployment not found")
+    chunks = deploy.get("chunks")
+    if not chunks:
+        raise HTTPException(status_code=404, detail="No chunk hashes for this deployment")
+    return Response(
+        content=bytes.fromhex("".join(chunks["hashes"])),
+        media_type="application/octet-stream",
+        headers={"X-Chunk-Root": chunks["root"]},
+    )
+
 @api_router.get("/ota/manifest/{build_id}")
 async def ota_manifest(build_id: str):
     """Get signed OTA manifest for a build."""
@@ -556,24 +1040,71 @@ async def ota_manifest(build_id: str):
         raise HTTPException(status_code=404, detail="No manifest available for this build")
     return manifest
 
+@api_router.get("/ota/signed-manifest/{deploy_id}")
+async def ota_signed_manifest(deploy_id: str):
+    """Manifest of the deployment's build as the exact signed bytes; signature in X-Manifest-Signature."""
+    deploy = await db.deployments.find_one({"id": deploy_id}, {"_id": 0, "build_id": 1})
+    if not deploy:
+        raise HTTPException(status_code=404, detail="Deployment not found")
+    build = await db.builds.find_one({"id": deploy.get("build_id", "")}, {"_id": 0, "manifest": 1})
+    manifest = (build or {}).get("manifest")
+    if not manifest or not manifest.get("signature"):
+        raise HTTPException(status_code=404, detail="No signed manifest for this deployment")
+    return Response(
+        content=canonical_manifest(manifest),
+        media_type="application/json",
+        headers={"X-Manifest-Signature": manifest["signature"]},
+    )
+
 @api_router.get("/ota/public-key")
-async def ota_public_key():
-    """Return the OTA signing public key for ESP32 verification."""
+async def ota_public_key(format: str = "pem"):
+    """Return the OTA signing public key for ESP32 verification (format=der: raw DER for devices)."""
     pem = get_public_key_pem()
     if not pem:
         raise HTTPException(status_code=404, detail="Public key not configured")
-    return {"public_key_pem": pem}
+    key_id = get_signing_key_id()
+    if format == "der":
+        # A rotated key carries the previous key's signature over its DER
+        headers = {"X-Key-Id": key_id}
+        endorsement = get_public_key_endorsement()
+        if endorsement:
+            headers["X-Key-Signature"] = endorsement
+        return Response(content=get_public_key_der(), media_type="application/octet-stream",
+                        headers=headers)
+    return {"public_key_pem": pem, "key_id": key_id}
+
+@api_router.get("/ota/ping", status_code=204)
+async def ota_ping():
+    """Cheap reachability probe for device health checks."""
+    return Response(status_code=204)
 
 @api_router.post("/ota/report")
-async def ota_report_status(device_id: str, status: str, version: str = ""):
-    """Device reports OTA status (downloading, applied, success, failed)."""
+async def ota_report_status(device_id: str, status: str, version: str = "", body: Optional[OTAReportBody] = None):
+    """Device reports OTA status (downloading, staged, applied, success, failed, interrupted, cancelled)."""
     update = {"last_ota_status": status}
+    if body and body.timings:
+        device = await db.devices.find_one({"id": device_id}, {"_id": 0, "pending_deployment_id": 1})
+        timings = body.timings.model_dump()
+        # Achieved transfer rate while receiving, throttling included
+        receive_ms = timings["receive_ms"]
+        timings["achieved_bps"] = timings["bytes_received"] * 1000 // receive_ms if receive_ms else 0
+        await db.ota_timings.insert_one({
+            "id": gen_id(),
+            "device_id": device_id,
+            "deployment_id": (device or {}).get("pending_deployment_id", ""),
+            "status": status,
+            "created_at": now_iso(),
+            **timings,
+        })
+        update["last_ota_timings"] = timings
     if status == "success" and version:
         update["firmware_version"] = version
         update["pending_deployment_id"] = ""
     elif status == "failed":
         update["pending_deployment_id"] = ""
     await db.devices.update_one({"id": device_id}, {"$set": update})
+    if "pending_deployment_id" in update:
+        _invalidate_ota_check(device_id)
     # Update deployment device status
     deploys = await db.deployments.find({"target_device_ids": device_id, "status": "active"}, {"_id": 0}).to_list(10)
     for d in deploys:
@@ -585,9 +1116,15 @@ async def ota_report_status(device_id: str, status: str, version: str = ""):
 
 # ─── TELEMETRY ROUTES ───────────────────────────────────────────────
 @api_router.post("/telemetry/heartbeat")
-async def telemetry_heartbeat(req: TelemetryHeartbeat):
-    """Device sends periodic heartbeat with telemetry data."""
-    await db.devices.update_one(
+async def telemetry_heartbeat(req: TelemetryHeartbeat, request: Request, response: Response):
+    """Device sends periodic heartbeat with telemetry data; answers its OTA check too."""
+    peer_cache = {"url": req.peer_url, "blob": req.peer_blob.lower()} if req.peer_url and req.peer_blob else None
+    if peer_cache and not _valid_peer_url(req.peer_url):
+        # Not handed to other devices, but the heartbeat itself still counts
+        logger.warning(f"Ignoring peer_url {req.peer_url!r} from device {req.device_id}")
+        peer_cache = None
+    site_addr = _site_addr(request)
+    previous = await db.devices.find_one_and_update(
         {"id": req.device_id},
         {"$set": {
             "status": "online",
@@ -595,8 +1132,26 @@ async def telemetry_heartbeat(req: TelemetryHeartbeat):
             "rssi": req.rssi,
             "free_heap": req.free_heap,
             "firmware_version": req.firmware_version,
-        }}
+            "ota_progress": req.ota_progress,
+            "conn_stats": {
+                "hits": req.conn_hits, "misses": req.conn_misses, "handshakes": req.conn_handshakes,
+                "tls_full": req.tls_full, "tls_offered": req.tls_offered,
+            },
+            "site_addr": site_addr,
+            "peer_cache": peer_cache,
+        }},
+        projection={"_id": 0, "owner_id": 1, "site_addr": 1, "peer_cache": 1},
     )
+    if previous and (previous.get("peer_cache") != peer_cache or
+                     (peer_cache and previous.get("site_addr") != site_addr)):
+        # A cache appeared, moved or went away: check answers change for the
+        # owner's devices on the site it left and the site it is on now
+        sites = list({a for a in (previous.get("site_addr"), site_addr) if a})
+        neighbours = await db.devices.find(
+            {"owner_id": previous.get("owner_id"), "site_addr": {"$in": sites}},
+            {"_id": 0, "id": 1}).to_list(1000)
+        for did in {req.device_id, *(d["id"] for d in neighbours)}:
+            _invalidate_ota_check(did)
     telemetry = {
         "id": gen_id(),
         "device_id": req.device_id,
@@ -604,10 +1159,22 @@ async def telemetry_heartbeat(req: TelemetryHeartbeat):
         "free_heap": req.free_heap,
         "uptime": req.uptime,
         "firmware_version": req.firmware_version,
+        "conn_hits": req.conn_hits,
+        "conn_misses": req.conn_misses,
+        "conn_handshakes": req.conn_handshakes,
+        "tls_full": req.tls_full,
+        "tls_offered": req.tls_offered,
         "timestamp": now_iso(),
     }
     await db.telemetry.insert_one(telemetry)
-    return {"message": "Heartbeat received"}
+    response.headers.update(_poll_retry_after(HEARTBEAT_INTERVAL_S))
+    # The reply doubles as an OTA check (same fields as /ota/check), so
+    # devices do not need a separate check round trip
+    try:
+        _, check = await _cached_ota_check(req.device_id)
+    except HTTPException:
+        check = {}
+    return {"message": "Heartbeat received", **check}
 
 @api_router.get("/telemetry/dashboard")
 async def telemetry_dashboard(user: dict = Depends(get_current_user)):
@@ -685,6 +1252,7 @@ async def startup():
     await db.devices.create_index("owner_id")
     await db.projects.create_index("id", unique=True)
     await db.builds.create_index("id", unique=True)
+    await db.builds.create_index("artifact_hash")
     await db.deployments.create_index("id", unique=True)
     await db.audit_logs.create_index("timestamp")
     await db.telemetry.create_index([("device_id", 1), ("timestamp", -1)])
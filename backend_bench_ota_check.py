@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""
+ESP32 Fleet Manager OTA Check Load Benchmark
+A fleet polling /api/ota/check in-process: backend/server.py runs on the
+in-memory Mongo stand-in from backend_test_ota_check.py, with a simulated
+round trip per query, and every device polls once per round with the ETag
+it last saw. Compares the check cache off (TTL 0, every poll recomputed)
+with on, over a cold round, a steady round and a round after a fleet-wide
+invalidation that changed nothing.
+
+    python3 backend_bench_ota_check.py [--devices 10000] [--concurrency 200]
+        [--mongo-ms 1.0] [--pending 0.1]
+"""
+
+import argparse
+import asyncio
+import statistics
+import sys
+import time
+
+from backend_test_ota_check import FakeDB, make_deployment, poll, reset_ota_check_state, server
+
+
+async def run_round(device_ids, etags, concurrency):
+    """Poll every device once; returns (wall s, 304 count, per-poll latencies)."""
+    gate = asyncio.Semaphore(concurrency)
+    latencies = []
+    not_modified = 0
+
+    async def one(device_id):
+        nonlocal not_modified
+        async with gate:
+            t0 = time.perf_counter()
+            status, etag, _ = await poll(device_id, etags.get(device_id))
+            latencies.append(time.perf_counter() - t0)
+            etags[device_id] = etag
+            not_modified += status == 304
+
+    t0 = time.perf_counter()
+    await asyncio.gather(*(one(d) for d in device_ids))
+    return time.perf_counter() - t0, not_modified, latencies
+
+
+async def run_fleet(args, ttl):
+    db = FakeDB(latency=args.mongo_ms / 1000)
+    reset_ota_check_state(db)
+    device_ids = [f"dev-{i:05d}" for i in range(args.devices)]
+    pending = set(device_ids[:int(args.devices * args.pending)])
+    db.deployments.docs.append(make_deployment(targets=sorted(pending)))
+    db.devices.docs += [{"id": d, "owner_id": "owner-1",
+                         "pending_deployment_id": "dep-1" if d in pending else ""}
+                        for d in device_ids]
+    # Linear scans would dominate the fake; index devices and deployments by id
+    for coll in (db.devices, db.deployments):
+        by_id = {doc["id"]: doc for doc in coll.docs}
+
+        async def find_one(query, projection=None, coll=coll, by_id=by_id):
+            await coll.round_trip()
+            return dict(by_id.get(query.get("id"), {})) or None
+        coll.find_one = find_one
+
+    etags = {}
+    rows = []
+    with _cache_ttl(ttl):
+        for label in ("cold", "steady", "invalidated"):
+            if label == "invalidated":
+                server._invalidate_ota_checks()
+            db.queries = 0
+            wall, not_modified, lat = await run_round(device_ids, etags, args.concurrency)
+            lat.sort()
+            rows.append((label, args.devices / wall, db.queries / args.devices,
+                         100 * not_modified / args.devices,
+                         1000 * statistics.median(lat), 1000 * lat[int(0.99 * len(lat))]))
+    return rows
+
+
+class _cache_ttl:
+    def __init__(self, ttl):
+        self.ttl = ttl
+
+    def __enter__(self):
+        self.saved, server.OTA_CHECK_CACHE_TTL = server.OTA_CHECK_CACHE_TTL, self.ttl
+
+    def __exit__(self, *exc):
+        server.OTA_CHECK_CACHE_TTL = self.saved
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--devices", type=int, default=10000)
+    ap.add_argument("--concurrency", type=int, default=200)
+    ap.add_argument("--mongo-ms", type=float, default=1.0)
+    ap.add_argument("--pending", type=float, default=0.1, help="share of devices with an update")
+    args = ap.parse_args()
+
+    print(f"{args.devices} devices, {args.concurrency} in flight, {args.mongo_ms} ms per query, "
+          f"{args.pending:.0%} with an update")
+    print(f"{'cache':<6}{'round':<13}{'polls/s':>9}{'queries/poll':>14}{'304 %':>7}"
+          f"{'p50 ms':>8}{'p99 ms':>8}")
+    for label, ttl in (("off", 0), ("on", server.OTA_CHECK_CACHE_TTL)):
+        for rnd, rate, qpp, nm, p50, p99 in asyncio.run(run_fleet(args, ttl)):
+            print(f"{label:<6}{rnd:<13}{rate:>9.0f}{qpp:>14.2f}{nm:>7.1f}{p50:>8.2f}{p99:>8.2f}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
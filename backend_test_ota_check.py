@@ -0,0 +1,535 @@
+#!/usr/bin/env python3
+"""
+ESP32 Fleet Manager OTA Check Cache Tests
+In-process tests of /api/ota/check: backend/server.py is imported with an
+in-memory stand-in for Mongo and its handlers are awaited directly, so no
+server, database or network is needed. Covers ETag / If-None-Match / 304,
+per-device and fleet-wide invalidation, the cache TTL and long-polling,
+staged activation (maintenance windows, manual mode), the size of the
+check answer, and Range requests on downloads.
+
+    python3 backend_test_ota_check.py
+"""
+
+import asyncio
+import copy
+import json
+import os
+import sys
+import tempfile
+import unittest
+from datetime import datetime, timedelta, timezone
+from pathlib import Path
+from unittest import mock
+
+os.environ.setdefault("MONGO_URL", "mongodb://localhost:27017")
+os.environ.setdefault("DB_NAME", "ota_check_test")
+sys.path.insert(0, str(Path(__file__).resolve().parent / "backend"))
+import server  # noqa: E402
+
+ADMIN = {"id": "admin-1", "email": "admin@test.com", "role": "admin"}
+
+
+# ─── In-memory Mongo ────────────────────────────────────────────────
+def _matches(doc: dict, query: dict) -> bool:
+    for key, want in query.items():
+        value = doc
+        for part in key.split("."):
+            value = value.get(part) if isinstance(value, dict) else None
+        if isinstance(want, dict):
+            if "$ne" in want and value == want["$ne"]:
+                return False
+            if "$gte" in want and (value is None or value < want["$gte"]):
+                return False
+        elif value != want:
+            return False
+    return True
+
+
+def _project(doc: dict, projection: dict) -> dict:
+    keep = [k for k, v in (projection or {}).items() if v and k != "_id"]
+    return copy.deepcopy({k: doc[k] for k in keep if k in doc} if keep else doc)
+
+
+class FakeCursor:
+    def __init__(self, collection, docs):
+        self.collection, self.docs = collection, docs
+
+    async def to_list(self, length):
+        await self.collection.round_trip()
+        return self.docs[:length]
+
+
+class FakeCollection:
+    def __init__(self, db):
+        self.db = db
+        self.docs = []
+
+    async def round_trip(self):
+        self.db.queries += 1
+        if self.db.latency:
+            await asyncio.sleep(self.db.latency)
+
+    async def find_one(self, query, projection=None):
+        await self.round_trip()
+        return next((_project(d, projection) for d in self.docs if _matches(d, query)), None)
+
+    def find(self, query, projection=None):
+        return FakeCursor(self, [_project(d, projection) for d in self.docs if _matches(d, query)])
+
+    async def insert_one(self, doc):
+        await self.round_trip()
+        self.docs.append(copy.deepcopy(doc))
+
+    async def update_one(self, query, update):
+        await self.round_trip()
+        for d in self.docs:
+            if _matches(d, query):
+                d.update(update.get("$set", {}))
+                return
+
+    async def find_one_and_update(self, query, update, projection=None):
+        await self.round_trip()
+        for d in self.docs:
+            if _matches(d, query):
+                d.update(update.get("$set", {}))
+                return _project(d, projection)
+        return None
+
+
+class FakeDB:
+    """Enough of motor's collection API for the OTA check and deployment routes."""
+
+    def __init__(self, latency: float = 0.0):
+        self.latency = latency
+        self.queries = 0
+        self.collections = {}
+
+    def __getattr__(self, name):
+        return self.collections.setdefault(name, FakeCollection(self))
+
+
+class FakeRequest:
+    def __init__(self, headers=None, host="203.0.113.7"):
+        self.headers = {k.lower(): v for k, v in (headers or {}).items()}
+        self.client = type("Client", (), {"host": host})()
+
+
+def reset_ota_check_state(db: FakeDB):
+    server.db = db
+    server._ota_check_cache.clear()
+    server._ota_check_device_generation.clear()
+    server._ota_check_changed.clear()
+
+
+def make_deployment(deploy_id="dep-1", version="1.4.2", targets=(), **extra) -> dict:
+    return {"id": deploy_id, "status": "active", "version": version,
+            "artifact_hash": "ab" * 32, "artifact_size": 1_204_512,
+            "target_device_ids": list(targets), **extra}
+
+
+class frozen_clock:
+    """Pins server's wall clock (datetime.now) and monotonic clock; advance()
+    moves both."""
+
+    def __init__(self, now: datetime):
+        self.now, self.mono = now, 1000.0
+
+    def advance(self, seconds: float):
+        self.now += timedelta(seconds=seconds)
+        self.mono += seconds
+
+    def __enter__(self):
+        clock = self
+
+        class FrozenDatetime(datetime):
+            @classmethod
+            def now(cls, tz=None):
+                return clock.now.astimezone(tz) if tz else clock.now.replace(tzinfo=None)
+
+        self.patches = [mock.patch.object(server, "datetime", FrozenDatetime),
+                        mock.patch.object(server.time, "monotonic", lambda: clock.mono)]
+        for p in self.patches:
+            p.start()
+        return self
+
+    def __exit__(self, *exc):
+        for p in reversed(self.patches):
+            p.stop()
+
+
+async def poll(device_id, etag=None, wait=0):
+    """One device check; returns (status, etag, body or None)."""
+    headers = {"If-None-Match": etag} if etag else {}
+    resp = await server.ota_check_update(
+        server.OTACheckRequest(device_id=device_id, current_version="1.0.0", wait=wait),
+        FakeRequest(headers))
+    body = json.loads(resp.body) if resp.status_code == 200 else None
+    return resp.status_code, resp.headers["ETag"], body
+
+
+# ─── Tests ──────────────────────────────────────────────────────────
+class OTACheckCacheTests(unittest.IsolatedAsyncioTestCase):
+
+    def setUp(self):
+        self.db = FakeDB()
+        reset_ota_check_state(self.db)
+        self.db.deployments.docs.append(make_deployment(targets=["dev-1"]))
+        self.db.devices.docs += [
+            {"id": "dev-1", "owner_id": "admin-1", "pending_deployment_id": "dep-1"},
+            {"id": "dev-2", "owner_id": "admin-1", "pending_deployment_id": ""},
+        ]
+
+    async def test_first_poll_returns_answer_and_etag(self):
+        status, etag, body = await poll("dev-1")
+        self.assertEqual(status, 200)
+        self.assertTrue(etag.startswith('"') and etag.endswith('"'))
+        self.assertTrue(body["update_available"])
+        self.assertEqual(body["version"], "1.4.2")
+
+    async def test_matching_etag_gets_304_without_queries(self):
+        _, etag, _ = await poll("dev-1")
+        queries = self.db.queries
+        status, etag2, body = await poll("dev-1", etag)
+        self.assertEqual((status, etag2, body), (304, etag, None))
+        self.assertEqual(self.db.queries, queries)
+
+    async def test_stale_etag_gets_full_answer(self):
+        _, etag, _ = await poll("dev-1")
+        status, etag2, body = await poll("dev-1", '"0000000000000000"')
+        self.assertEqual(status, 200)
+        self.assertEqual(etag2, etag)
+        self.assertEqual(body["deployment_id"], "dep-1")
+
+    async def test_etag_follows_the_answer(self):
+        _, etag1, _ = await poll("dev-1")
+        _, etag2, body2 = await poll("dev-2")
+        self.assertNotEqual(etag1, etag2)
+        self.assertEqual(body2, {"update_available": False})
+
+    async def test_device_invalidation_only_recomputes_that_device(self):
+        _, etag1, _ = await poll("dev-1")
+        _, etag2, _ = await poll("dev-2")
+        self.db.devices.docs[1]["pending_deployment_id"] = "dep-1"
+        server._invalidate_ota_check("dev-2")
+
+        queries = self.db.queries
+        self.assertEqual((await poll("dev-1", etag1))[0], 304)
+        self.assertEqual(self.db.queries, queries)
+        status, _, body = await poll("dev-2", etag2)
+        self.assertEqual(status, 200)
+        self.assertTrue(body["update_available"])
+
+    async def test_pause_invalidates_the_fleet(self):
+        _, etag, _ = await poll("dev-1")
+        await server.pause_deployment("dep-1", user=ADMIN)
+        status, _, body = await poll("dev-1", etag)
+        self.assertEqual(status, 200)
+        self.assertEqual(body, {"update_available": False})
+
+    async def test_activate_invalidates_target_devices(self):
+        self.db.deployments.docs[0]["activation"] = "manual"
+        _, etag1, body = await poll("dev-1")
+        _, etag2, _ = await poll("dev-2")
+        self.assertFalse(body["activate"])
+        await server.activate_deployment("dep-1", user=ADMIN)
+
+        status, _, body = await poll("dev-1", etag1)
+        self.assertEqual(status, 200)
+        self.assertTrue(body["activate"])
+        queries = self.db.queries
+        self.assertEqual((await poll("dev-2", etag2))[0], 304)
+        self.assertEqual(self.db.queries, queries)
+
+    async def test_answer_computed_across_an_invalidation_is_not_cached(self):
+        real_find_one = self.db.devices.find_one
+
+        async def find_one_then_invalidate(query, projection=None):
+            doc = await real_find_one(query, projection)
+            server._invalidate_ota_check(query["id"])
+            return doc
+
+        self.db.devices.find_one = find_one_then_invalidate
+        await poll("dev-1")
+        self.db.devices.find_one = real_find_one
+        self.assertNotIn("dev-1", server._ota_check_cache)
+
+    async def test_ttl_expiry_recomputes_with_the_same_etag(self):
+        clock = [1000.0]
+        with mock.patch.object(server.time, "monotonic", lambda: clock[0]):
+            _, etag, _ = await poll("dev-1")
+            queries = self.db.queries
+            clock[0] += server.OTA_CHECK_CACHE_TTL - 1
+            self.assertEqual((await poll("dev-1", etag))[0], 304)
+            self.assertEqual(self.db.queries, queries)
+
+            # Expired: recomputed from Mongo, unchanged, so still a 304
+            clock[0] += 2
+            self.assertEqual((await poll("dev-1", etag))[0], 304)
+            self.assertGreater(self.db.queries, queries)
+
+    async def test_ttl_expiry_picks_up_changes_made_elsewhere(self):
+        # Another worker changed the device without invalidating our cache
+        clock = [1000.0]
+        with mock.patch.object(server.time, "monotonic", lambda: clock[0]):
+            _, etag, _ = await poll("dev-2")
+            self.db.devices.docs[1]["pending_deployment_id"] = "dep-1"
+            self.assertEqual((await poll("dev-2", etag))[0], 304)
+            clock[0] += server.OTA_CHECK_CACHE_TTL + 1
+            status, _, body = await poll("dev-2", etag)
+        self.assertEqual(status, 200)
+        self.assertTrue(body["update_available"])
+
+    async def test_long_poll_returns_304_after_wait(self):
+        _, etag, _ = await poll("dev-1")
+        loop = asyncio.get_running_loop()
+        t0 = loop.time()
+        self.assertEqual((await poll("dev-1", etag, wait=1))[0], 304)
+        self.assertGreaterEqual(loop.time() - t0, 0.9)
+
+    async def test_long_poll_wakes_on_invalidation(self):
+        _, etag, _ = await poll("dev-2")
+        waiter = asyncio.create_task(poll("dev-2", etag, wait=30))
+        await asyncio.sleep(0.05)
+        self.assertFalse(waiter.done())
+        self.db.devices.docs[1]["pending_deployment_id"] = "dep-1"
+        server._invalidate_ota_check("dev-2")
+        status, _, body = await asyncio.wait_for(waiter, timeout=2)
+        self.assertEqual(status, 200)
+        self.assertTrue(body["update_available"])
+
+
+class OTACheckAnswerSizeTests(unittest.IsolatedAsyncioTestCase):
+    """Mirror URLs must fit the device: OTA_MAX_URL_LEN per URL (NUL
+    included), JSON_STREAM_MAX_VALUE per string, OTA_CHECK_MAX_RESPONSE
+    for the whole answer."""
+
+    DEVICE_MAX_RESPONSE = 2048
+    DEVICE_MAX_VALUE = 384
+
+    def setUp(self):
+        self.db = FakeDB()
+        reset_ota_check_state(self.db)
+        self.db.builds.docs.append({
+            "id": "build-1", "status": "success", "version": "10.20.30-rc.1+build.1234",
+            "artifact_hash": "ab" * 32, "artifact_size": 4_000_000,
+            "manifest": {
+                "compressed": {"hash_sha256": "cd" * 32},
+                "delta": {"patch_hash_sha256": "ef" * 32, "base_hash": "01" * 32, "base_size": 4_000_000},
+                "chunks": {"size": 65536, "root": "23" * 32},
+                "app_project_name": "p" * 31,
+            },
+        })
+        self.db.devices.docs.append({"id": "dev-1", "owner_id": "admin-1"})
+
+    async def deploy(self, mirrors):
+        return await server.create_deployment(server.DeployCreate(
+            build_id="build-1", target_device_ids=["dev-1"], rate_limit_bps=4_000_000_000,
+            activation="window", window_start="2020-01-01T00:00:00Z",
+            window_end="2099-01-01T00:00:00Z", mirrors=mirrors), user=ADMIN)
+
+    async def test_overlong_mirror_base_is_rejected(self):
+        base = "https://" + "m" * (server.OTA_MIRROR_BASE_MAX - 7)
+        with self.assertRaises(server.HTTPException) as ctx:
+            await self.deploy([base])
+        self.assertEqual(ctx.exception.status_code, 400)
+
+    async def test_longest_mirrors_fit_the_device(self):
+        base = "https://" + "m" * (server.OTA_MIRROR_BASE_MAX - 8)
+        await self.deploy([base] * server.OTA_MAX_MIRRORS)
+        with mock.patch.object(server, "get_signing_key_id", lambda: "9d2f6a1b0c3e4d5f"):
+            resp = await server.ota_check_update(
+                server.OTACheckRequest(device_id="dev-1", current_version="1.0.0"), FakeRequest())
+        body = json.loads(resp.body)
+        self.assertEqual(len(body["mirrors"]), server.OTA_MAX_MIRRORS)
+        for url in body["mirrors"]:
+            self.assertEqual(len(url), server.OTA_MAX_URL_LEN - 1)
+            self.assertLess(len(url), self.DEVICE_MAX_VALUE)
+        self.assertLessEqual(len(json.dumps(body)), self.DEVICE_MAX_RESPONSE)
+
+
+class OTAActivationTests(unittest.IsolatedAsyncioTestCase):
+    """Staged deployments: "activate" in the check answer, and how long the
+    answer may be cached before a window opening or closing changes it."""
+
+    NOW = datetime(2026, 3, 1, 12, 0, tzinfo=timezone.utc)
+
+    def setUp(self):
+        self.db = FakeDB()
+        reset_ota_check_state(self.db)
+        self.db.devices.docs.append({"id": "dev-1", "owner_id": "admin-1", "pending_deployment_id": "dep-1"})
+
+    def window(self, opens_in, closes_in):
+        at = lambda s: (self.NOW + timedelta(seconds=s)).isoformat().replace("+00:00", "Z")
+        self.db.deployments.docs.append(make_deployment(
+            targets=["dev-1"], activation="window", window_start=at(opens_in), window_end=at(closes_in)))
+
+    def cached_ttl(self, clock):
+        return server._ota_check_cache["dev-1"][1] - clock.mono
+
+    async def test_immediate_answer_has_no_activate_field(self):
+        self.db.deployments.docs.append(make_deployment(targets=["dev-1"]))
+        with frozen_clock(self.NOW) as clock:
+            _, _, body = await poll("dev-1")
+            self.assertNotIn("activate", body)
+            self.assertEqual(self.cached_ttl(clock), server.OTA_CHECK_CACHE_TTL)
+
+    async def test_before_window_waits_and_caches_until_it_opens(self):
+        self.window(opens_in=30, closes_in=3600)
+        with frozen_clock(self.NOW) as clock:
+            _, _, body = await poll("dev-1")
+            self.assertFalse(body["activate"])
+            self.assertEqual(self.cached_ttl(clock), 30)
+
+    async def test_inside_window_activates_and_caches_until_it_closes(self):
+        self.window(opens_in=-60, closes_in=120)
+        with frozen_clock(self.NOW) as clock:
+            _, _, body = await poll("dev-1")
+            self.assertTrue(body["activate"])
+            self.assertEqual(self.cached_ttl(clock), 120)
+
+    async def test_long_window_is_capped_at_the_cache_ttl(self):
+        self.window(opens_in=-60, closes_in=10 * server.OTA_CHECK_CACHE_TTL)
+        with frozen_clock(self.NOW) as clock:
+            await poll("dev-1")
+            self.assertEqual(self.cached_ttl(clock), server.OTA_CHECK_CACHE_TTL)
+
+    async def test_after_window_waits_for_a_manual_activation(self):
+        self.window(opens_in=-3600, closes_in=-60)
+        with frozen_clock(self.NOW) as clock:
+            _, _, body = await poll("dev-1")
+            self.assertFalse(body["activate"])
+            self.assertEqual(self.cached_ttl(clock), server.OTA_CHECK_CACHE_TTL)
+
+    async def test_answer_flips_when_the_window_opens_and_closes(self):
+        self.window(opens_in=30, closes_in=90)
+        with frozen_clock(self.NOW) as clock:
+            _, etag, body = await poll("dev-1")
+            self.assertFalse(body["activate"])
+            clock.advance(29)
+            self.assertEqual((await poll("dev-1", etag))[0], 304)
+
+            clock.advance(1)
+            status, etag, body = await poll("dev-1", etag)
+            self.assertEqual(status, 200)
+            self.assertTrue(body["activate"])
+
+            clock.advance(60)
+            status, _, body = await poll("dev-1", etag)
+            self.assertEqual(status, 200)
+            self.assertFalse(body["activate"])
+
+    async def test_manual_mode_waits_for_activate(self):
+        self.db.deployments.docs.append(make_deployment(targets=["dev-1"], activation="manual"))
+        with frozen_clock(self.NOW) as clock:
+            _, etag, body = await poll("dev-1")
+            self.assertFalse(body["activate"])
+            self.assertEqual(self.cached_ttl(clock), server.OTA_CHECK_CACHE_TTL)
+            await server.activate_deployment("dep-1", user=ADMIN)
+            status, _, body = await poll("dev-1", etag)
+        self.assertEqual(status, 200)
+        self.assertTrue(body["activate"])
+
+    def test_activated_at_overrides_a_closed_window(self):
+        deploy = make_deployment(activation="window", window_start="2020-01-01T00:00:00Z",
+                                 window_end="2020-01-02T00:00:00Z", activated_at="2020-01-03T00:00:00Z")
+        self.assertEqual(server._deployment_activation(deploy), (True, None))
+
+
+class RangedFileResponseTests(unittest.IsolatedAsyncioTestCase):
+    """_ranged_file_response: single byte ranges for resumed downloads."""
+
+    SIZE = 1000
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.path = Path(self.tmp.name) / "firmware.bin"
+        self.data = bytes(i % 251 for i in range(self.SIZE))
+        self.path.write_bytes(self.data)
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def respond(self, range_header=None, path=None):
+        headers = {"Range": range_header} if range_header else {}
+        return server._ranged_file_response(FakeRequest(headers), path or self.path,
+                                            headers={"X-Artifact-Hash": "ab" * 32})
+
+    async def read_range(self, range_header):
+        resp = self.respond(range_header)
+        self.assertEqual(resp.status_code, 206)
+        body = b""
+        if hasattr(resp.body_iterator, "__aiter__"):
+            async for chunk in resp.body_iterator:
+                body += chunk
+        else:
+            body = b"".join(resp.body_iterator)
+        return resp, body
+
+    def assert_unsatisfiable(self, range_header, size=SIZE, path=None):
+        with self.assertRaises(server.HTTPException) as ctx:
+            self.respond(range_header, path)
+        self.assertEqual(ctx.exception.status_code, 416)
+        self.assertEqual(ctx.exception.headers, {"Content-Range": f"bytes */{size}"})
+
+    def test_no_range_serves_the_whole_file(self):
+        resp = self.respond()
+        self.assertIsInstance(resp, server.FileResponse)
+        self.assertEqual(resp.headers["Accept-Ranges"], "bytes")
+        self.assertEqual(resp.headers["X-Artifact-Hash"], "ab" * 32)
+
+    def test_multiple_or_malformed_ranges_serve_the_whole_file(self):
+        for spec in ("bytes=0-1,5-6", "bytes=a-b", "items=0-10"):
+            with self.subTest(spec=spec):
+                self.assertIsInstance(self.respond(spec), server.FileResponse)
+
+    async def test_closed_range(self):
+        resp, body = await self.read_range("bytes=100-199")
+        self.assertEqual(body, self.data[100:200])
+        self.assertEqual(resp.headers["Content-Range"], f"bytes 100-199/{self.SIZE}")
+        self.assertEqual(resp.headers["Content-Length"], "100")
+        self.assertEqual(resp.headers["X-Artifact-Hash"], "ab" * 32)
+
+    async def test_open_range_runs_to_the_end(self):
+        resp, body = await self.read_range("bytes=900-")
+        self.assertEqual(body, self.data[900:])
+        self.assertEqual(resp.headers["Content-Range"], f"bytes 900-999/{self.SIZE}")
+
+    async def test_end_past_the_file_is_clamped(self):
+        resp, body = await self.read_range("bytes=990-5000")
+        self.assertEqual(body, self.data[990:])
+        self.assertEqual(resp.headers["Content-Length"], "10")
+
+    async def test_suffix_range_serves_the_last_bytes(self):
+        resp, body = await self.read_range("bytes=-100")
+        self.assertEqual(body, self.data[-100:])
+        self.assertEqual(resp.headers["Content-Range"], f"bytes 900-999/{self.SIZE}")
+
+    async def test_suffix_longer_than_the_file_serves_all_of_it(self):
+        resp, body = await self.read_range("bytes=-5000")
+        self.assertEqual(body, self.data)
+        self.assertEqual(resp.headers["Content-Range"], f"bytes 0-999/{self.SIZE}")
+
+    async def test_range_larger_than_a_read_chunk(self):
+        big = self.path.with_name("big.bin")
+        data = os.urandom(3 * server.RANGE_CHUNK_SIZE + 17)
+        big.write_bytes(data)
+        self.path, self.data = big, data
+        _, body = await self.read_range("bytes=5-")
+        self.assertEqual(body, data[5:])
+
+    def test_start_at_or_past_the_end_is_416(self):
+        self.assert_unsatisfiable(f"bytes={self.SIZE}-")
+        self.assert_unsatisfiable(f"bytes={self.SIZE + 10}-{self.SIZE + 20}")
+
+    def test_start_after_end_is_416(self):
+        self.assert_unsatisfiable("bytes=500-400")
+
+    def test_suffix_of_an_empty_file_is_416(self):
+        empty = self.path.with_name("empty.bin")
+        empty.write_bytes(b"")
+        self.assert_unsatisfiable("bytes=-10", size=0, path=empty)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -81,7 +81,9 @@ export const deploymentsAPI = {
   rollback: (id, reason) => api.post(`/deployments/${id}/rollback`, { reason }),
   pause: (id) => api.post(`/deployments/${id}/pause`),
   resume: (id) => api.post(`/deployments/${id}/resume`),
+  activate: (id) => api.post(`/deployments/${id}/activate`),
   updateRollout: (id, percent) => api.put(`/deployments/${id}/rollout?rollout_percent=${percent}`),
+  otaTimings: (id) => api.get(`/deployments/${id}/ota-timings`),
 };
 
 // Telemetry
@@ -25,6 +25,11 @@ export default function DeployPage() {
   const [selectedBuild, setSelectedBuild] = useState("");
   const [selectedDevices, setSelectedDevices] = useState([]);
   const [rolloutPercent, setRolloutPercent] = useState("100");
+  const [rateLimit, setRateLimit] = useState("0");
+  const [activation, setActivation] = useState("immediate");
+  const [windowStart, setWindowStart] = useState("");
+  const [windowEnd, setWindowEnd] = useState("");
+  const [mirrors, setMirrors] = useState("");
   const [deploying, setDeploying] = useState(false);
   const terminalRef = useRef(null);
 
@@ -81,6 +86,10 @@ export default function DeployPage() {
 
   const handleDeploy = async () => {
     if (!selectedBuild || selectedDevices.length === 0) return;
+    if (activation === "window" && (!windowStart || !windowEnd)) {
+      toast.error("Set both maintenance window times");
+      return;
+    }
     setDeploying(true);
     try {
       await deploymentsAPI.create({
@@ -88,6 +97,13 @@ export default function DeployPage() {
         target_device_ids: selectedDevices,
         rollout_percent: parseInt(rolloutPercent),
         rollout_strategy: parseInt(rolloutPercent) < 100 ? "canary" : "immediate",
+        rate_limit_bps: parseInt(rateLimit),
+        mirrors: mirrors.split(/[\s,]+/).filter(Boolean),
+        activation,
+        ...(activation === "window" && {
+          window_start: new Date(windowStart).toISOString(),
+          window_end: new Date(windowEnd).toISOString(),
+        }),
       });
       toast.success("Deployment created");
       setSelectedDevices([]);
@@ -236,7 +252,9 @@ export default function DeployPage() {
                       <p className="text-muted-foreground mb-0.5">OTA Manifest</p>
                       <div className="flex items-center gap-1">
                         <div className="w-1.5 h-1.5 rounded-full bg-[#00ff9d]" />
-                        <span className="font-mono text-[10px] text-[#00ff9d]">Signed (RSA-2048 + SHA-256)</span>
+                        <span className="font-mono text-[10px] text-[#00ff9d]">
+                          Signed ({activeBuild.manifest.signature_alg === "ecdsa-p256-sha256" ? "ECDSA P-256" : "RSA"} + SHA-256)
+                        </span>
                       </div>
                     </div>
                   )}
@@ -286,6 +304,64 @@ export default function DeployPage() {
                 </Select>
               </div>
 
+              <div className="space-y-2">
+                <Label className="text-xs uppercase tracking-wider text-muted-foreground">Bandwidth Cap (per device)</Label>
+                <Select value={rateLimit} onValueChange={setRateLimit}>
+                  <SelectTrigger data-testid="rate-limit-select" className="bg-transparent border-border/50 rounded-sm font-mono text-xs">
+                    <SelectValue />
+                  </SelectTrigger>
+                  <SelectContent className="bg-[#121212] border-border/50">
+                    <SelectItem value="0" className="font-mono text-xs">Unlimited</SelectItem>
+                    <SelectItem value="8192" className="font-mono text-xs">8 KB/s</SelectItem>
+                    <SelectItem value="32768" className="font-mono text-xs">32 KB/s</SelectItem>
+                    <SelectItem value="131072" className="font-mono text-xs">128 KB/s</SelectItem>
+                  </SelectContent>
+                </Select>
+              </div>
+
+              <div className="space-y-2">
+                <Label className="text-xs uppercase tracking-wider text-muted-foreground">Site Caches (optional)</Label>
+                <Input
+                  value={mirrors}
+                  onChange={(e) => setMirrors(e.target.value)}
+                  placeholder="http://ota-cache.site.lan:8080"
+                  data-testid="mirrors-input"
+                  className="bg-transparent border-border/50 rounded-sm font-mono text-xs"
+                />
+              </div>
+
+              <div className="space-y-2">
+                <Label className="text-xs uppercase tracking-wider text-muted-foreground">Activation</Label>
+                <Select value={activation} onValueChange={setActivation}>
+                  <SelectTrigger data-testid="activation-select" className="bg-transparent border-border/50 rounded-sm font-mono text-xs">
+                    <SelectValue />
+                  </SelectTrigger>
+                  <SelectContent className="bg-[#121212] border-border/50">
+                    <SelectItem value="immediate" className="font-mono text-xs">Reboot when verified</SelectItem>
+                    <SelectItem value="window" className="font-mono text-xs">Stage, reboot in window</SelectItem>
+                    <SelectItem value="manual" className="font-mono text-xs">Stage, reboot on activate</SelectItem>
+                  </SelectContent>
+                </Select>
+                {activation === "window" && (
+                  <div className="grid grid-cols-2 gap-2">
+                    <Input
+                      type="datetime-local"
+                      value={windowStart}
+                      onChange={(e) => setWindowStart(e.target.value)}
+                      data-testid="window-start-input"
+                      className="bg-transparent border-border/50 rounded-sm font-mono text-xs"
+                    />
+                    <Input
+                      type="datetime-local"
+                      value={windowEnd}
+                      onChange={(e) => setWindowEnd(e.target.value)}
+                      data-testid="window-end-input"
+                      className="bg-transparent border-border/50 rounded-sm font-mono text-xs"
+                    />
+                  </div>
+                )}
+              </div>
+
               <div className="space-y-2">
                 <Label className="text-xs uppercase tracking-wider text-muted-foreground">Target Devices</Label>
                 <ScrollArea className="h-[180px] border border-border/30 rounded-sm p-2">
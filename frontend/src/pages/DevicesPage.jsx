@@ -235,6 +235,7 @@ export default function DevicesPage() {
                     "border-border text-muted-foreground"
                   }`}>
                     OTA: {device.last_ota_status || "none"}
+                    {device.last_ota_status === "downloading" && device.ota_progress >= 0 && ` ${device.ota_progress}%`}
                   </Badge>
                   {canEdit && (
                     <Button
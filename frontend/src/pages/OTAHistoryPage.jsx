@@ -8,7 +8,7 @@ import { Dialog, DialogContent, DialogHeader, DialogTitle, DialogTrigger } from
 import { Select, SelectContent, SelectItem, SelectTrigger, SelectValue } from "../components/ui/select";
 import { Input } from "../components/ui/input";
 import { Label } from "../components/ui/label";
-import { History, RotateCcw, PauseCircle, Play, ChevronRight, Package } from "lucide-react";
+import { History, RotateCcw, PauseCircle, Play, ChevronRight, Package, Timer, Power } from "lucide-react";
 import { toast } from "sonner";
 
 const STATUS_COLORS = {
@@ -18,11 +18,60 @@ const STATUS_COLORS = {
   completed: { border: "border-primary/50", text: "text-primary" },
 };
 
+const TIMING_PHASES = [
+  ["connect_ms", "Connect + TLS"],
+  ["first_byte_ms", "First byte"],
+  ["receive_ms", "Receive"],
+  ["throttle_ms", "Rate-limited"],
+  ["flash_read_ms", "Flash read"],
+  ["flash_erase_ms", "Flash erase"],
+  ["flash_write_ms", "Flash write"],
+  ["hash_ms", "Hash"],
+  ["image_verify_ms", "Image verify"],
+  ["set_boot_ms", "Set boot"],
+  ["manifest_ms", "Manifest verify"],
+  ["probe_ms", "Mirror probe"],
+  ["total_ms", "Total"],
+];
+
+function OTATimingsChart({ timings }) {
+  if (!timings) {
+    return <p className="text-xs text-muted-foreground font-mono">Loading...</p>;
+  }
+  if (timings.count === 0) {
+    return <p className="text-xs text-muted-foreground">No timing reports yet</p>;
+  }
+  const avg = timings.averages;
+  const max = Math.max(1, ...TIMING_PHASES.map(([key]) => avg[key] || 0));
+  return (
+    <div className="space-y-2">
+      <p className="text-xs text-muted-foreground">
+        Average over {timings.count} report{timings.count !== 1 ? "s" : ""}
+        {avg.preerase_saved_ms > 0 && ` · pre-erase saved ${avg.preerase_saved_ms} ms`}
+        {avg.achieved_bps > 0 && ` · ${(avg.achieved_bps / 1024).toFixed(1)} KB/s achieved`}
+        {avg.chunk_retries > 0 && ` · ${avg.chunk_retries} chunk re-fetches per device`}
+        {avg.stall_aborts > 0 && ` · ${avg.stall_aborts} stalled streams per device`}
+        {avg.mirror_switches > 0 && ` · ${avg.mirror_switches} mirror switches per device`}
+      </p>
+      {TIMING_PHASES.map(([key, label]) => (
+        <div key={key} className="flex items-center gap-3 text-xs" data-testid={`timing-${key}`}>
+          <span className="w-28 text-muted-foreground">{label}</span>
+          <div className="flex-1 h-2 bg-border/30 rounded-sm">
+            <div className="h-2 bg-primary rounded-sm" style={{ width: `${((avg[key] || 0) / max) * 100}%` }} />
+          </div>
+          <span className="w-20 text-right font-mono">{avg[key] || 0} ms</span>
+        </div>
+      ))}
+    </div>
+  );
+}
+
 export default function OTAHistoryPage() {
   const [deployments, setDeployments] = useState([]);
   const [loading, setLoading] = useState(true);
   const [selectedDeploy, setSelectedDeploy] = useState(null);
   const [rollbackReason, setRollbackReason] = useState("");
+  const [timings, setTimings] = useState(null);
 
   useEffect(() => { loadDeployments(); }, []);
 
@@ -69,6 +118,26 @@ export default function OTAHistoryPage() {
     }
   };
 
+  const handleActivate = async (id) => {
+    try {
+      await deploymentsAPI.activate(id);
+      toast.success("Staged devices will switch now");
+      loadDeployments();
+    } catch {
+      toast.error("Failed to activate");
+    }
+  };
+
+  const loadTimings = async (id) => {
+    setTimings(null);
+    try {
+      const res = await deploymentsAPI.otaTimings(id);
+      setTimings(res.data);
+    } catch {
+      toast.error("Failed to load OTA timings");
+    }
+  };
+
   const handleUpdateRollout = async (id, percent) => {
     try {
       await deploymentsAPI.updateRollout(id, parseInt(percent));
@@ -104,6 +173,8 @@ export default function OTAHistoryPage() {
             const deviceCount = deploy.target_device_ids?.length || 0;
             const deviceStatuses = deploy.device_statuses || {};
             const successCount = Object.values(deviceStatuses).filter((s) => s === "success").length;
+            const stagedCount = Object.values(deviceStatuses).filter((s) => s === "staged").length;
+            const awaitingActivation = deploy.activation && deploy.activation !== "immediate" && !deploy.activated_at;
 
             return (
               <Card key={deploy.id} className="bg-[#121212] border-border/50" data-testid={`deploy-card-${deploy.id}`}>
@@ -122,7 +193,14 @@ export default function OTAHistoryPage() {
                           <span className="font-mono">{new Date(deploy.created_at).toLocaleString()}</span>
                           <span>{deviceCount} device{deviceCount !== 1 ? "s" : ""}</span>
                           <span>Rollout: {deploy.rollout_percent}%</span>
+                          {deploy.rate_limit_bps > 0 && <span>Cap: {Math.round(deploy.rate_limit_bps / 1024)} KB/s</span>}
                           {successCount > 0 && <span className="text-[#00ff9d]">{successCount} applied</span>}
+                          {stagedCount > 0 && <span className="text-[#ffb000]">{stagedCount} staged</span>}
+                          {deploy.activation === "window" && !deploy.activated_at && (
+                            <span className="font-mono">
+                              Window: {new Date(deploy.window_start).toLocaleString()} – {new Date(deploy.window_end).toLocaleString()}
+                            </span>
+                          )}
                           {deploy.artifact_hash && (
                             <span className="font-mono text-[10px]" title={deploy.artifact_hash}>
                               SHA: {deploy.artifact_hash.substring(0, 12)}...
@@ -137,6 +215,25 @@ export default function OTAHistoryPage() {
                         {deploy.status}
                       </Badge>
 
+                      <Dialog onOpenChange={(open) => open && loadTimings(deploy.id)}>
+                        <DialogTrigger asChild>
+                          <Button
+                            variant="ghost"
+                            size="icon"
+                            data-testid={`timings-deploy-${deploy.id}`}
+                            className="h-7 w-7 text-muted-foreground hover:bg-primary/10"
+                          >
+                            <Timer className="w-4 h-4" strokeWidth={1.5} />
+                          </Button>
+                        </DialogTrigger>
+                        <DialogContent className="bg-[#121212] border-border/50">
+                          <DialogHeader>
+                            <DialogTitle>OTA Phase Timings</DialogTitle>
+                          </DialogHeader>
+                          <OTATimingsChart timings={timings} />
+                        </DialogContent>
+                      </Dialog>
+
                       {deploy.status === "active" && (
                         <>
                           <Select onValueChange={(v) => handleUpdateRollout(deploy.id, v)}>
@@ -150,6 +247,18 @@ export default function OTAHistoryPage() {
                               <SelectItem value="100" className="font-mono text-xs">100%</SelectItem>
                             </SelectContent>
                           </Select>
+                          {awaitingActivation && (
+                            <Button
+                              variant="ghost"
+                              size="icon"
+                              onClick={() => handleActivate(deploy.id)}
+                              data-testid={`activate-deploy-${deploy.id}`}
+                              title="Activate staged image now"
+                              className="h-7 w-7 text-primary hover:bg-primary/10"
+                            >
+                              <Power className="w-4 h-4" strokeWidth={1.5} />
+                            </Button>
+                          )}
                           <Button
                             variant="ghost"
                             size="icon"
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""
+Host benchmark of the agent's manifest signature check, RSA-2048 against
+ECDSA P-256. firmware_verify_bench.c is built with gcc against the host's
+mbedtls and runs the calls ota_manager.c makes on a manifest-sized
+document signed the way build_service.py signs (SHA-256, PKCS#1 v1.5 for
+RSA, DER for ECDSA). Keys and signatures come from the openssl CLI.
+
+    python3 tests/bench_manifest_verify.py [iterations]
+
+MBEDTLS_CFLAGS / MBEDTLS_LIBS point the build at another mbedtls
+(default: system headers, -lmbedcrypto). Host figures rank the two
+algorithms in software only: the ESP32-C3 has an RSA accelerator that
+IDF's mbedtls uses for the public-key exponentiation and no ECC
+accelerator, so on the device the gap in RSA's favour is wider.
+"""
+
+import json
+import os
+import shlex
+import shutil
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+
+BENCH_SRC = Path(__file__).resolve().parent / "firmware_verify_bench.c"
+
+KEY_TYPES = (
+    ("rsa-pkcs1v15-sha256", ["-algorithm", "RSA", "-pkeyopt", "rsa_keygen_bits:2048"]),
+    ("ecdsa-p256-sha256", ["-algorithm", "EC", "-pkeyopt", "ec_paramgen_curve:P-256"]),
+)
+
+
+def _manifest() -> bytes:
+    """A canonical manifest of typical size (one chunk entry per 64 KB)."""
+    doc = {
+        "artifact_hash": "ab" * 32,
+        "artifact_size": 1_200_000,
+        "chunks": {"size": 65536, "count": 19, "root": "cd" * 32, "root_signature": "A" * 344},
+        "deployment_id": "0f8e1c2a-8d4b-4e55-9a0e-3b9f7c6d5e41",
+        "project": "fleet_agent",
+        "version": "1.4.2",
+    }
+    return json.dumps(doc, sort_keys=True).encode()
+
+
+def _openssl(*args):
+    subprocess.run(["openssl", *args], check=True, capture_output=True)
+
+
+def main() -> int:
+    iterations = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+    if not shutil.which("gcc") or not shutil.which("openssl"):
+        print("gcc and openssl are required", file=sys.stderr)
+        return 2
+
+    with tempfile.TemporaryDirectory() as tmp:
+        tmp = Path(tmp)
+        bench = tmp / "firmware_verify_bench"
+        cflags = shlex.split(os.environ.get("MBEDTLS_CFLAGS", ""))
+        libs = shlex.split(os.environ.get("MBEDTLS_LIBS", "-lmbedcrypto"))
+        subprocess.run(["gcc", "-std=gnu11", "-Wall", "-Wextra", "-O2", *cflags,
+                        "-o", str(bench), str(BENCH_SRC), *libs, "-lpthread"], check=True)
+
+        manifest = tmp / "manifest.json"
+        manifest.write_bytes(_manifest())
+        print(f"manifest {manifest.stat().st_size} bytes, {iterations} iterations")
+        print(f"{'algorithm':<22}{'sig B':>7}{'parse µs':>10}{'verify µs':>11}"
+              f"{'heap B':>9}{'stack B':>9}")
+        for alg, genopts in KEY_TYPES:
+            key, der, sig = tmp / f"{alg}.pem", tmp / f"{alg}.der", tmp / f"{alg}.sig"
+            _openssl("genpkey", *genopts, "-out", str(key))
+            _openssl("pkey", "-in", str(key), "-pubout", "-outform", "DER", "-out", str(der))
+            _openssl("dgst", "-sha256", "-sign", str(key), "-out", str(sig), str(manifest))
+            with open(manifest, "rb") as f:
+                result = subprocess.run([str(bench), str(der), str(sig), str(iterations)],
+                                        stdin=f, capture_output=True, text=True)
+            if result.returncode != 0:
+                print(f"{alg}: {result.stderr.strip()}", file=sys.stderr)
+                return 1
+            fields = dict(kv.split("=") for kv in result.stdout.split())
+            print(f"{alg:<22}{sig.stat().st_size:>7}{fields['parse_us']:>10}"
+                  f"{fields['verify_us']:>11}{fields['heap_peak']:>9}{fields['stack_used']:>9}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
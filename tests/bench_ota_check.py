@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""
+Host benchmark of one OTA check poll: the old cJSON double-POST against
+the json_stream path. firmware_check_bench.c is built with gcc against
+json_stream.c and polls a local stand-in for /api/ota/check that answers
+a full update offer and counts requests and connections.
+
+    python3 tests/bench_ota_check.py [--polls 200] [--rtt-ms 0]
+
+--rtt-ms adds a simulated round trip per request and three per new
+connection (TCP plus a full TLS handshake), so wall time reflects a
+device on a real network rather than loopback. CJSON_CFLAGS / CJSON_LIBS
+point the build at cJSON (e.g. -I$IDF_PATH/components/json/cJSON and
+its cJSON.c); `pkg-config libcjson` is tried otherwise. Without cJSON
+the legacy poll still makes its requests and allocates its buffer but
+skips the parse, so its heap figures are a lower bound.
+"""
+
+import argparse
+import json
+import os
+import shlex
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from pathlib import Path
+
+REPO_DIR = Path(__file__).resolve().parent.parent
+FIRMWARE_DIR = REPO_DIR / "backend" / "firmware_templates" / "esp32c3_fleet_agent"
+BENCH_SRC = Path(__file__).resolve().parent / "firmware_check_bench.c"
+
+BLOB = "3f" * 32
+CHECK_ANSWER = json.dumps({
+    "update_available": True,
+    "version": "1.4.2",
+    "deployment_id": "0f8e1c2a-8d4b-4e55-9a0e-3b9f7c6d5e41",
+    "artifact_hash": BLOB,
+    "artifact_size": 1_204_512,
+    "download_url": "/api/ota/download/5b0d9f3e-2c6a-4f1b-8e7d-9a4c3b2e1f00",
+    "blob_url": f"/api/ota/blob/{BLOB}",
+    "compressed_url": "/api/ota/download/5b0d9f3e-2c6a-4f1b-8e7d-9a4c3b2e1f00?variant=lzss",
+    "compressed_hash": "7a" * 32,
+    "chunks_url": "/api/ota/chunks/5b0d9f3e-2c6a-4f1b-8e7d-9a4c3b2e1f00",
+    "chunk_size": 65536,
+    "chunk_root": "c4" * 32,
+    "manifest_url": "/api/ota/signed-manifest/0f8e1c2a-8d4b-4e55-9a0e-3b9f7c6d5e41",
+    "signing_key_id": "9d2f6a1b0c3e4d5f",
+    "activate": True,
+    "mirrors": [f"http://192.168.1.20:8070/api/ota/blob/{BLOB}"],
+}).encode()
+
+
+class CheckServer:
+    def __init__(self, rtt: float):
+        self.rtt = rtt
+        self.requests = 0
+        self.connections = 0
+        self.lock = threading.Lock()
+        self.httpd = ThreadingHTTPServer(("127.0.0.1", 0), self._handler())
+        self.port = self.httpd.server_port
+        threading.Thread(target=self.httpd.serve_forever, daemon=True).start()
+
+    def reset(self):
+        with self.lock:
+            self.requests = self.connections = 0
+
+    def _handler(self):
+        server = self
+
+        class Handler(BaseHTTPRequestHandler):
+            protocol_version = "HTTP/1.1"
+
+            def log_message(self, *args):
+                pass
+
+            def setup(self):
+                super().setup()
+                self.connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                with server.lock:
+                    server.connections += 1
+                time.sleep(3 * server.rtt)
+
+            def do_POST(self):
+                self.rfile.read(int(self.headers["Content-Length"]))
+                with server.lock:
+                    server.requests += 1
+                time.sleep(server.rtt)
+                self.send_response(200)
+                self.send_header("Content-Type", "application/json")
+                self.send_header("Content-Length", str(len(CHECK_ANSWER)))
+                self.end_headers()
+                self.wfile.write(CHECK_ANSWER)
+
+        return Handler
+
+
+def _cjson_flags():
+    cflags = shlex.split(os.environ.get("CJSON_CFLAGS", ""))
+    libs = shlex.split(os.environ.get("CJSON_LIBS", ""))
+    if not (cflags or libs) and shutil.which("pkg-config"):
+        probe = subprocess.run(["pkg-config", "--cflags", "--libs", "libcjson"],
+                               capture_output=True, text=True)
+        if probe.returncode == 0:
+            flags = shlex.split(probe.stdout)
+            cflags = [f + "/cjson" if f.startswith("-I") else f
+                      for f in flags if not f.startswith("-l")]
+            libs = [f for f in flags if f.startswith("-l")]
+    return (["-DBENCH_CJSON", *cflags], libs) if cflags or libs else ([], [])
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--polls", type=int, default=200)
+    ap.add_argument("--rtt-ms", type=float, default=0.0)
+    args = ap.parse_args()
+    if not shutil.which("gcc"):
+        print("gcc is required", file=sys.stderr)
+        return 2
+
+    with tempfile.TemporaryDirectory() as tmp:
+        bench = Path(tmp) / "firmware_check_bench"
+        cflags, libs = _cjson_flags()
+        subprocess.run(["gcc", "-std=gnu11", "-Wall", "-Wextra", "-O1", f"-I{FIRMWARE_DIR}",
+                        *cflags, "-o", str(bench), str(BENCH_SRC),
+                        str(FIRMWARE_DIR / "json_stream.c"), *libs], check=True)
+        server = CheckServer(args.rtt_ms / 1000)
+        print(f"answer {len(CHECK_ANSWER)} bytes, {args.polls} polls, rtt {args.rtt_ms} ms, "
+              f"cJSON {'linked' if cflags else 'not available (legacy parse skipped)'}")
+        print(f"{'path':<8}{'req/poll':>9}{'conn/poll':>10}{'alloc B/poll':>13}"
+              f"{'peak B':>8}{'ms/poll':>9}  parsed")
+        for mode in ("legacy", "stream"):
+            server.reset()
+            result = subprocess.run([str(bench), mode, str(server.port), str(args.polls)],
+                                    capture_output=True, text=True)
+            if result.returncode != 0:
+                print(f"{mode}: {result.stderr.strip()}", file=sys.stderr)
+                return 1
+            f = dict(kv.split("=") for kv in result.stdout.split())
+            print(f"{mode:<8}{server.requests / args.polls:>9.2f}"
+                  f"{server.connections / args.polls:>10.2f}{f['alloc_per_poll']:>13}"
+                  f"{f['heap_peak']:>8}{float(f['wall_us']) / 1000:>9.2f}  "
+                  f"{'v' + f['version'] if f['parsed'] == '1' else 'no'}")
+        server.httpd.shutdown()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""
+Host benchmark of the agent's TLS reconnects: a full handshake against
+one that offers the session saved from an earlier connection, as
+http_pool.c does with save_client_session. A local TLS server (Python's
+ssl module, certificate from the openssl CLI) answers one small HTTP
+response per connection and closes it, the way an idle keep-alive
+connection is dropped between heartbeats.
+
+    python3 tests/bench_tls_resume.py [--connections 200] [--key rsa|ec]
+        [--tls 1.2|1.3]
+
+Rows:
+  full       no session offered
+  accepted   session offered and resumed by the server
+  refused    session offered to a server that can no longer resume it
+             (new ticket keys and session cache per connection, as after
+             a restart or behind a balancer without shared keys)
+
+The refused row is why the pool's counter is tls_offered: mbedTLS does
+not tell the client whether its offer was taken, and a refused offer
+costs a full handshake. Host times rank the handshakes only: the
+ESP32-C3 runs the ECDHE key exchange in software (it has SHA, AES and
+RSA accelerators, no ECC one), so a full handshake costs it far more.
+"""
+
+import argparse
+import shutil
+import socket
+import ssl
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from pathlib import Path
+
+RESPONSE = b"HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok"
+
+KEY_ARGS = {
+    "rsa": ["-newkey", "rsa:2048"],
+    "ec": ["-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:P-256"],
+}
+
+
+def make_cert(tmp: Path, key: str):
+    cert, keyfile = tmp / "cert.pem", tmp / "key.pem"
+    subprocess.run(["openssl", "req", "-x509", "-nodes", "-days", "1", "-subj", "/CN=localhost",
+                    "-addext", "subjectAltName=DNS:localhost", *KEY_ARGS[key],
+                    "-keyout", str(keyfile), "-out", str(cert)],
+                   check=True, capture_output=True)
+    return cert, keyfile
+
+
+def server_context(cert, keyfile, version):
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    ctx.minimum_version = ctx.maximum_version = version
+    ctx.load_cert_chain(cert, keyfile)
+    return ctx
+
+
+class Server(threading.Thread):
+    """Answers one request per connection. With `refuse`, every connection
+    gets a fresh context (built beforehand, outside the timing), so no
+    earlier session can be resumed."""
+
+    def __init__(self, cert, keyfile, version, connections, refuse):
+        super().__init__(daemon=True)
+        self.contexts = [server_context(cert, keyfile, version)
+                         for _ in range(connections if refuse else 1)]
+        self.sock = socket.create_server(("127.0.0.1", 0))
+        self.port = self.sock.getsockname()[1]
+
+    def run(self):
+        while True:
+            try:
+                conn, _ = self.sock.accept()
+            except OSError:
+                return
+            ctx = self.contexts.pop() if len(self.contexts) > 1 else self.contexts[0]
+            try:
+                with ctx.wrap_socket(conn, server_side=True) as tls:
+                    tls.recv(1024)
+                    tls.sendall(RESPONSE)
+            except (ssl.SSLError, OSError):
+                pass
+
+    def close(self):
+        self.sock.close()
+
+
+def connect(client_ctx, port, session):
+    """One request on a new connection; returns (handshake s, resumed, session)."""
+    raw = socket.create_connection(("127.0.0.1", port))
+    raw.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    t0 = time.perf_counter()
+    tls = client_ctx.wrap_socket(raw, server_hostname="localhost", session=session)
+    elapsed = time.perf_counter() - t0
+    with tls:
+        tls.sendall(b"GET /api/health HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        while tls.recv(1024):
+            pass
+        # TLS 1.3 tickets arrive after the handshake; take the session last
+        return elapsed, tls.session_reused, tls.session
+
+
+def run(label, cert, keyfile, version, refuse, offer, n):
+    server = Server(cert, keyfile, version, n + 1, refuse)
+    server.start()
+    client_ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    client_ctx.minimum_version = client_ctx.maximum_version = version
+    client_ctx.load_verify_locations(cert)
+    try:
+        _, _, session = connect(client_ctx, server.port, None)   # first handshake
+        times, resumed = [], 0
+        for _ in range(n):
+            elapsed, reused, new_session = connect(client_ctx, server.port,
+                                                   session if offer else None)
+            times.append(elapsed)
+            resumed += reused
+            if new_session is not None:
+                session = new_session
+    finally:
+        server.close()
+    times.sort()
+    return (label, 1000 * statistics.median(times), 1000 * times[int(0.99 * len(times))],
+            100 * resumed / n)
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--connections", type=int, default=200)
+    ap.add_argument("--key", choices=sorted(KEY_ARGS), default="rsa")
+    ap.add_argument("--tls", choices=("1.2", "1.3"), default="1.2")
+    args = ap.parse_args()
+    if not shutil.which("openssl"):
+        print("needs the openssl CLI", file=sys.stderr)
+        return 2
+    version = ssl.TLSVersion.TLSv1_2 if args.tls == "1.2" else ssl.TLSVersion.TLSv1_3
+
+    with tempfile.TemporaryDirectory() as tmp:
+        cert, keyfile = make_cert(Path(tmp), args.key)
+        print(f"{args.connections} connections, TLS {args.tls}, {args.key} server key, "
+              f"{ssl.OPENSSL_VERSION}")
+        print(f"{'handshake':<10}{'p50 ms':>8}{'p99 ms':>8}{'resumed %':>11}")
+        for label, refuse, offer in (("full", False, False),
+                                     ("accepted", False, True),
+                                     ("refused", True, True)):
+            row = run(label, cert, keyfile, version, refuse, offer, args.connections)
+            print(f"{row[0]:<10}{row[1]:>8.2f}{row[2]:>8.2f}{row[3]:>11.0f}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,320 @@
+/**
+ * Firmware Check Bench
+ * Host benchmark of one OTA check poll for bench_ota_check.py, old path
+ * against new, over plain TCP to a local stand-in server:
+ *
+ *   legacy  the pre-stream ota_manager_check_update(): POST the check on a
+ *           fresh connection, drop the body, calloc a response buffer, POST
+ *           again on another fresh connection to read it, cJSON_Parse
+ *   stream  one POST on a kept-alive connection, the body fed through
+ *           json_stream.c as it arrives
+ *
+ *   firmware_check_bench legacy|stream <port> <polls>
+ *
+ * Prints one line of key=value pairs: heap bytes allocated per poll,
+ * peak heap held during a poll, wall µs per poll, and the version parsed.
+ * Request and connection counts are taken by the server. Without
+ * BENCH_CJSON (cJSON headers and library) the legacy poll does its two
+ * requests and its buffer but skips the parse and reports parsed=0.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "json_stream.h"
+#ifdef BENCH_CJSON
+#include "cJSON.h"
+#endif
+
+#define BENCH_READ_BUF      512     /* esp_http_client default buffer */
+#define BENCH_MAX_RESPONSE  2048    /* legacy content length cap      */
+
+static const char *CHECK_BODY =
+    "{\"device_id\":\"bench-device\",\"current_version\":\"1.0.0\"}";
+
+typedef struct {
+    char version[32];
+    char artifact_hash[65];
+    char download_url[256];
+    char deployment_id[64];
+    bool update_available;
+} check_info_t;
+
+/* ── Heap Accounting ──────────────────────────────────────────── */
+
+static size_t s_heap_live;
+static size_t s_heap_peak;
+static size_t s_heap_total;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void  __libc_free(void *ptr);
+
+static void heap_add(void *ptr)
+{
+    if (!ptr) return;
+    size_t n = malloc_usable_size(ptr);
+    s_heap_total += n;
+    s_heap_live += n;
+    if (s_heap_live > s_heap_peak) s_heap_peak = s_heap_live;
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *ptr = __libc_calloc(n, size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (ptr) s_heap_live -= malloc_usable_size(ptr);
+    void *out = __libc_realloc(ptr, size);
+    heap_add(out ? out : ptr);
+    return out;
+}
+
+void free(void *ptr)
+{
+    if (ptr) s_heap_live -= malloc_usable_size(ptr);
+    __libc_free(ptr);
+}
+#endif
+
+/* ── HTTP ─────────────────────────────────────────────────────── */
+
+typedef bool (*body_fn)(void *user, const char *data, size_t len);
+
+static int http_connect(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* POST the check on `fd` and hand the body to `on_body` as it is read.
+ * Returns the content length, or -1 on an error or non-200 answer. */
+static int http_post_check(int fd, bool keep_alive, body_fn on_body, void *user)
+{
+    char buf[BENCH_READ_BUF + 1];
+    int n = snprintf(buf, sizeof(buf),
+                     "POST /api/ota/check HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                     "Content-Type: application/json\r\nContent-Length: %zu\r\n"
+                     "Connection: %s\r\n\r\n%s",
+                     strlen(CHECK_BODY), keep_alive ? "keep-alive" : "close", CHECK_BODY);
+    if (send(fd, buf, n, MSG_NOSIGNAL) != n) return -1;
+
+    /* Headers; whatever follows them is the start of the body */
+    size_t got = 0;
+    char *end = NULL;
+    while (!end && got < BENCH_READ_BUF) {
+        ssize_t r = recv(fd, buf + got, BENCH_READ_BUF - got, 0);
+        if (r <= 0) return -1;
+        got += (size_t)r;
+        buf[got] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+    }
+    const char *cl = end ? strcasestr(buf, "\r\nContent-Length:") : NULL;
+    if (!cl || strncmp(buf, "HTTP/1.1 200", 12) != 0) return -1;
+    int content_len = atoi(cl + 17);
+
+    size_t have = got - (size_t)(end + 4 - buf);
+    if (have && !on_body(user, end + 4, have)) return -1;
+    while ((int)have < content_len) {
+        size_t want = (size_t)content_len - have < BENCH_READ_BUF
+                    ? (size_t)content_len - have : BENCH_READ_BUF;
+        ssize_t r = recv(fd, buf, want, 0);
+        if (r <= 0 || !on_body(user, buf, (size_t)r)) return -1;
+        have += (size_t)r;
+    }
+    return content_len;
+}
+
+/* ── Legacy Poll ──────────────────────────────────────────────── */
+
+typedef struct {
+    char  *dst;
+    size_t len;
+    size_t cap;
+} copy_ctx_t;
+
+static bool discard_body(void *user, const char *data, size_t len)
+{
+    (void)user; (void)data; (void)len;
+    return true;
+}
+
+static bool copy_body(void *user, const char *data, size_t len)
+{
+    copy_ctx_t *c = (copy_ctx_t *)user;
+    if (len > c->cap - c->len) len = c->cap - c->len;
+    memcpy(c->dst + c->len, data, len);
+    c->len += len;
+    return true;
+}
+
+#ifdef BENCH_CJSON
+static void legacy_copy(char *dst, size_t size, const cJSON *item)
+{
+    if (item && item->valuestring) {
+        strncpy(dst, item->valuestring, size - 1);
+        dst[size - 1] = '\0';
+    }
+}
+#endif
+
+static bool poll_legacy(int port, check_info_t *info)
+{
+    int fd = http_connect(port);
+    int content_len = fd >= 0 ? http_post_check(fd, false, discard_body, NULL) : -1;
+    if (fd >= 0) close(fd);
+    if (content_len <= 0 || content_len > BENCH_MAX_RESPONSE) return false;
+
+    char *response = calloc(1, content_len + 1);
+    if (!response) return false;
+    copy_ctx_t copy = { response, 0, (size_t)content_len };
+    fd = http_connect(port);
+    bool ok = fd >= 0 && http_post_check(fd, false, copy_body, &copy) == content_len;
+    if (fd >= 0) close(fd);
+
+#ifdef BENCH_CJSON
+    cJSON *json = ok ? cJSON_Parse(response) : NULL;
+    free(response);
+    if (!json) return false;
+    info->update_available = cJSON_IsTrue(cJSON_GetObjectItem(json, "update_available"));
+    legacy_copy(info->version, sizeof(info->version), cJSON_GetObjectItem(json, "version"));
+    legacy_copy(info->artifact_hash, sizeof(info->artifact_hash),
+                cJSON_GetObjectItem(json, "artifact_hash"));
+    legacy_copy(info->download_url, sizeof(info->download_url),
+                cJSON_GetObjectItem(json, "download_url"));
+    legacy_copy(info->deployment_id, sizeof(info->deployment_id),
+                cJSON_GetObjectItem(json, "deployment_id"));
+    cJSON_Delete(json);
+#else
+    (void)info;
+    free(response);
+#endif
+    return ok;
+}
+
+/* ── Stream Poll ──────────────────────────────────────────────── */
+
+static void stream_copy(char *dst, size_t size, const char *value)
+{
+    strncpy(dst, value, size - 1);
+    dst[size - 1] = '\0';
+}
+
+/* The top-level members the legacy poll reads, as check_response_cb does */
+static void check_event(void *user, const json_stream_t *js, json_stream_event_t ev,
+                        const char *value, size_t len)
+{
+    check_info_t *info = (check_info_t *)user;
+    (void)len;
+    if (json_stream_depth(js) != 1) return;
+    const char *key = json_stream_key(js, 0);
+    if (strcmp(key, "update_available") == 0) {
+        info->update_available = ev == JSON_STREAM_TRUE;
+    } else if (ev != JSON_STREAM_STRING) {
+        return;
+    } else if (strcmp(key, "version") == 0) {
+        stream_copy(info->version, sizeof(info->version), value);
+    } else if (strcmp(key, "artifact_hash") == 0) {
+        stream_copy(info->artifact_hash, sizeof(info->artifact_hash), value);
+    } else if (strcmp(key, "download_url") == 0) {
+        stream_copy(info->download_url, sizeof(info->download_url), value);
+    } else if (strcmp(key, "deployment_id") == 0) {
+        stream_copy(info->deployment_id, sizeof(info->deployment_id), value);
+    }
+}
+
+static bool feed_stream(void *user, const char *data, size_t len)
+{
+    return json_stream_feed((json_stream_t *)user, data, len);
+}
+
+static bool poll_stream(int port, int *fd, check_info_t *info)
+{
+    if (*fd < 0) *fd = http_connect(port);
+    if (*fd < 0) return false;
+    json_stream_t js;
+    json_stream_init(&js, check_event, info);
+    bool ok = http_post_check(*fd, true, feed_stream, &js) > 0 && json_stream_finish(&js);
+    if (!ok) {
+        close(*fd);
+        *fd = -1;
+    }
+    return ok;
+}
+
+/* ── Main ─────────────────────────────────────────────────────── */
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    const char *mode = argc > 3 ? argv[1] : "";
+    bool legacy = strcmp(mode, "legacy") == 0;
+    int port = argc > 3 ? atoi(argv[2]) : 0;
+    long polls = argc > 3 ? strtol(argv[3], NULL, 10) : 0;
+    if ((!legacy && strcmp(mode, "stream") != 0) || port <= 0 || polls <= 0) {
+        fprintf(stderr, "usage: %s legacy|stream <port> <polls>\n", argv[0]);
+        return 2;
+    }
+
+    check_info_t info;
+    int fd = -1;
+    size_t peak = 0;
+    s_heap_total = 0;
+    int64_t t0 = now_ns();
+    for (long i = 0; i < polls; i++) {
+        memset(&info, 0, sizeof(info));
+        size_t live = s_heap_live;
+        s_heap_peak = live;
+        bool ok = legacy ? poll_legacy(port, &info) : poll_stream(port, &fd, &info);
+        if (!ok) {
+            fprintf(stderr, "poll %ld failed\n", i);
+            return 1;
+        }
+        if (s_heap_peak - live > peak) peak = s_heap_peak - live;
+    }
+    int64_t elapsed = now_ns() - t0;
+    if (fd >= 0) close(fd);
+
+    printf("alloc_per_poll=%zu heap_peak=%zu wall_us=%.1f parsed=%d version=%s\n",
+           s_heap_total / (size_t)polls, peak, elapsed / 1000.0 / polls,
+           info.update_available, info.version[0] ? info.version : "-");
+    return 0;
+}
@@ -0,0 +1,141 @@
+/**
+ * Firmware Codec Harness
+ * Host build of the agent's stream decoders for test_firmware_codecs.py.
+ * Reads stdin in chunks of the given size, the way the HTTP read loop
+ * feeds them on the device, and writes what the decoders produce:
+ *
+ *   firmware_codec_harness lzss  <chunk>         compressed image -> image
+ *   firmware_codec_harness delta <chunk> <base>  compressed patch -> target
+ *   firmware_codec_harness json  <chunk>         document -> one line per event
+ *
+ * Exit status 1 means the decoder rejected its input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lzss_stream.h"
+#include "delta_patch.h"
+#include "json_stream.h"
+
+/* Must match build_service.py's LZSS parameters */
+#define LZSS_WINDOW_BITS     10
+#define LZSS_LOOKAHEAD_BITS  5
+
+static lzss_stream_t s_lzss;
+static delta_patch_t s_delta;
+static json_stream_t s_json;
+static uint8_t      *s_base;
+static size_t        s_base_len;
+
+/* ── Callbacks ────────────────────────────────────────────────── */
+
+static bool write_out(void *user, const uint8_t *data, size_t len)
+{
+    (void)user;
+    return fwrite(data, 1, len, stdout) == len;
+}
+
+static bool read_base(void *user, uint32_t offset, uint8_t *buf, size_t len)
+{
+    (void)user;
+    if (offset > s_base_len || len > s_base_len - offset) return false;
+    memcpy(buf, s_base + offset, len);
+    return true;
+}
+
+static bool to_delta(void *user, const uint8_t *data, size_t len)
+{
+    (void)user;
+    return delta_patch_feed(&s_delta, data, len);
+}
+
+static const char *const EVENT_NAMES[] = {
+    "string", "number", "true", "false", "null", "{", "}", "[", "]",
+};
+
+/* depth <TAB> key <TAB> index <TAB> event [<TAB> value] */
+static void print_event(void *user, const json_stream_t *js, json_stream_event_t ev,
+                        const char *value, size_t len)
+{
+    (void)user;
+    int depth = json_stream_depth(js);
+    printf("%d\t%s\t%d\t%s", depth, json_stream_key(js, depth - 1),
+           json_stream_index(js, depth - 1), EVENT_NAMES[ev]);
+    if (value) {
+        putchar('\t');
+        fwrite(value, 1, len, stdout);
+    }
+    putchar('\n');
+}
+
+/* ── Helpers ──────────────────────────────────────────────────── */
+
+static bool load_base(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    bool ok = fseek(f, 0, SEEK_END) == 0;
+    long size = ok ? ftell(f) : -1;
+    ok = size >= 0 && fseek(f, 0, SEEK_SET) == 0;
+    s_base_len = ok ? (size_t)size : 0;
+    s_base = malloc(s_base_len + 1);
+    ok = ok && s_base && fread(s_base, 1, s_base_len, f) == s_base_len;
+    fclose(f);
+    return ok;
+}
+
+static bool feed(const char *mode, const uint8_t *data, size_t len)
+{
+    if (strcmp(mode, "json") == 0) {
+        return json_stream_feed(&s_json, (const char *)data, len);
+    }
+    return lzss_stream_feed(&s_lzss, data, len, mode[0] == 'd' ? to_delta : write_out, NULL);
+}
+
+static bool finish(const char *mode)
+{
+    if (strcmp(mode, "json") == 0) return json_stream_finish(&s_json);
+    if (strcmp(mode, "lzss") == 0) return lzss_stream_finish(&s_lzss, write_out, NULL);
+    return lzss_stream_finish(&s_lzss, to_delta, NULL) && delta_patch_finish(&s_delta);
+}
+
+/* ── Main ─────────────────────────────────────────────────────── */
+
+int main(int argc, char **argv)
+{
+    const char *mode = argc > 2 ? argv[1] : "";
+    size_t chunk = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+    bool delta = strcmp(mode, "delta") == 0;
+    if (chunk == 0 || (strcmp(mode, "lzss") != 0 && strcmp(mode, "json") != 0 &&
+                       !(delta && argc > 3))) {
+        fprintf(stderr, "usage: %s lzss|json <chunk> | delta <chunk> <base>\n", argv[0]);
+        return 2;
+    }
+
+    if (strcmp(mode, "json") == 0) {
+        json_stream_init(&s_json, print_event, NULL);
+    } else {
+        lzss_stream_init(&s_lzss, LZSS_WINDOW_BITS, LZSS_LOOKAHEAD_BITS);
+    }
+    if (delta) {
+        if (!load_base(argv[3])) {
+            fprintf(stderr, "cannot read %s\n", argv[3]);
+            return 2;
+        }
+        delta_patch_init(&s_delta, read_base, write_out, NULL);
+    }
+
+    uint8_t *buf = malloc(chunk);
+    if (!buf) return 2;
+    bool ok = true;
+    size_t n;
+    while (ok && (n = fread(buf, 1, chunk, stdin)) > 0) {
+        ok = feed(mode, buf, n);
+    }
+    ok = ok && finish(mode);
+    free(buf);
+    free(s_base);
+    return ok ? 0 : 1;
+}
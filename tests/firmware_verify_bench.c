@@ -0,0 +1,223 @@
+/**
+ * Firmware Verify Bench
+ * Host build of the agent's manifest signature check for
+ * bench_manifest_verify.py: the same mbedtls calls ota_manager.c makes
+ * (mbedtls_pk_parse_public_key on the cached DER key, mbedtls_sha256 over
+ * the manifest bytes, mbedtls_pk_verify), timed and measured:
+ *
+ *   firmware_verify_bench <key.der> <sig> <iterations>  < manifest
+ *
+ * Prints one line of key=value pairs: mean µs per parse and per verify,
+ * peak heap held during parse + verify, and the stack it used. Exit
+ * status 1 means the signature did not verify.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <malloc.h>
+
+#include "mbedtls/pk.h"
+#include "mbedtls/sha256.h"
+
+#define BENCH_STACK_SIZE   (256 * 1024)
+#define BENCH_STACK_FILL   0xA5
+
+static uint8_t *s_key;
+static size_t   s_key_len;
+static uint8_t *s_sig;
+static size_t   s_sig_len;
+static uint8_t *s_doc;
+static size_t   s_doc_len;
+
+/* ── Heap Accounting ──────────────────────────────────────────── */
+/*
+ * mbedtls allocates through calloc/free; on glibc these wrappers sit in
+ * front of the allocator and track the bytes held, as
+ * heap_caps_get_minimum_free_size would around the same calls on the
+ * device. Elsewhere the heap figure reads 0.
+ */
+
+static size_t s_heap_live;
+static size_t s_heap_peak;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void  __libc_free(void *ptr);
+
+static void heap_add(void *ptr)
+{
+    if (!ptr) return;
+    s_heap_live += malloc_usable_size(ptr);
+    if (s_heap_live > s_heap_peak) s_heap_peak = s_heap_live;
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *ptr = __libc_calloc(n, size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (ptr) s_heap_live -= malloc_usable_size(ptr);
+    void *out = __libc_realloc(ptr, size);
+    heap_add(out ? out : ptr);
+    return out;
+}
+
+void free(void *ptr)
+{
+    if (ptr) s_heap_live -= malloc_usable_size(ptr);
+    __libc_free(ptr);
+}
+#endif
+
+/* ── Verify Path ──────────────────────────────────────────────── */
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* sign_key_set() + the manifest check in ota_manager.c */
+static bool verify_once(mbedtls_pk_context *key, bool parse)
+{
+    uint8_t hash[32];
+    if (parse) {
+        mbedtls_pk_init(key);
+        if (mbedtls_pk_parse_public_key(key, s_key, s_key_len) != 0) return false;
+    }
+    mbedtls_sha256(s_doc, s_doc_len, hash, 0);
+    return mbedtls_pk_verify(key, MBEDTLS_MD_SHA256, hash, sizeof(hash),
+                             s_sig, s_sig_len) == 0;
+}
+
+typedef struct {
+    uint8_t *stack_entry;
+    size_t   heap_peak;
+    bool     ok;
+} probe_t;
+
+/* One cold parse + verify on the painted stack, as the OTA task runs it */
+static void *probe_run(void *arg)
+{
+    probe_t *p = (probe_t *)arg;
+    volatile uint8_t marker = 0;
+    p->stack_entry = (uint8_t *)&marker;
+
+    mbedtls_pk_context key;
+    size_t live = s_heap_live;
+    s_heap_peak = live;
+    p->ok = verify_once(&key, true);
+    p->heap_peak = s_heap_peak - live;
+    mbedtls_pk_free(&key);
+    return NULL;
+}
+
+/* ── Helpers ──────────────────────────────────────────────────── */
+
+static bool load_file(const char *path, uint8_t **out, size_t *len)
+{
+    FILE *f = path ? fopen(path, "rb") : stdin;
+    if (!f) return false;
+    size_t cap = 4096, n = 0, r;
+    uint8_t *buf = malloc(cap);
+    while (buf && (r = fread(buf + n, 1, cap - n, f)) > 0) {
+        n += r;
+        if (n == cap) {
+            uint8_t *grown = realloc(buf, cap *= 2);
+            if (!grown) free(buf);
+            buf = grown;
+        }
+    }
+    if (path) fclose(f);
+    *out = buf;
+    *len = n;
+    return buf && n > 0;
+}
+
+/* Bytes of the painted stack below `entry` that the probe touched */
+static size_t stack_used(const uint8_t *stack, const uint8_t *entry)
+{
+    const uint8_t *p = stack;
+    while (p < entry && *p == BENCH_STACK_FILL) p++;
+    return (size_t)(entry - p);
+}
+
+/* ── Main ─────────────────────────────────────────────────────── */
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 3 ? strtol(argv[3], NULL, 10) : 0;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s <key.der> <sig> <iterations> < manifest\n", argv[0]);
+        return 2;
+    }
+    if (!load_file(argv[1], &s_key, &s_key_len) || !load_file(argv[2], &s_sig, &s_sig_len) ||
+        !load_file(NULL, &s_doc, &s_doc_len)) {
+        fprintf(stderr, "cannot read key, signature or manifest\n");
+        return 2;
+    }
+
+    /* Stack and heap: one cold run on a thread with a painted stack */
+    uint8_t *stack = aligned_alloc(4096, BENCH_STACK_SIZE);
+    if (!stack) return 2;
+    memset(stack, BENCH_STACK_FILL, BENCH_STACK_SIZE);
+    pthread_attr_t attr;
+    pthread_t thread;
+    probe_t probe = {0};
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, BENCH_STACK_SIZE);
+    if (pthread_create(&thread, &attr, probe_run, &probe) != 0) return 2;
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (!probe.ok) {
+        fprintf(stderr, "signature does not verify\n");
+        return 1;
+    }
+
+    /* Time: key parse (first use, rotation) and verify (every manifest) */
+    mbedtls_pk_context key;
+    int64_t t0 = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        mbedtls_pk_init(&key);
+        mbedtls_pk_parse_public_key(&key, s_key, s_key_len);
+        if (i + 1 < iterations) mbedtls_pk_free(&key);
+    }
+    int64_t parse_ns = now_ns() - t0;
+
+    bool ok = true;
+    t0 = now_ns();
+    for (long i = 0; ok && i < iterations; i++) {
+        ok = verify_once(&key, false);
+    }
+    int64_t verify_ns = now_ns() - t0;
+    mbedtls_pk_free(&key);
+
+    printf("parse_us=%.1f verify_us=%.1f heap_peak=%zu stack_used=%zu\n",
+           parse_ns / 1000.0 / iterations, verify_ns / 1000.0 / iterations,
+           probe.heap_peak, stack_used(stack, probe.stack_entry));
+    free(stack);
+    free(s_key);
+    free(s_sig);
+    free(s_doc);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,4 @@
+/* Host shim: only the handle type, for ota_manager.h */
+#pragma once
+
+typedef struct esp_http_client *esp_http_client_handle_t;
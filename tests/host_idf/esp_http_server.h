@@ -0,0 +1,55 @@
+/* Host shim: the esp_http_server subset peer_cache.c uses, over POSIX
+ * sockets (host_httpd.c). One connection at a time, closed after each
+ * response. */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "esp_err.h"
+
+typedef struct host_httpd *httpd_handle_t;
+typedef enum { HTTP_GET } httpd_method_t;
+
+typedef struct {
+    httpd_handle_t handle;
+    int            method;
+    char           uri[512];
+    /* host only */
+    int            fd;
+    const char    *headers;
+    const char    *status;
+} httpd_req_t;
+
+typedef struct {
+    const char     *uri;
+    httpd_method_t  method;
+    esp_err_t     (*handler)(httpd_req_t *req);
+    void           *user_ctx;
+} httpd_uri_t;
+
+typedef bool (*httpd_uri_match_func_t)(const char *tmpl, const char *uri, size_t len);
+
+typedef struct {
+    uint16_t               server_port;
+    uint16_t               ctrl_port;
+    uint16_t               max_open_sockets;
+    bool                   lru_purge_enable;
+    httpd_uri_match_func_t uri_match_fn;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() { .server_port = 80, .ctrl_port = 32768, .max_open_sockets = 7 }
+
+bool      httpd_uri_match_wildcard(const char *tmpl, const char *uri, size_t len);
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+esp_err_t httpd_stop(httpd_handle_t handle);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *val, size_t size);
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status);
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len);
+esp_err_t httpd_resp_send_404(httpd_req_t *req);
+esp_err_t httpd_resp_send_500(httpd_req_t *req);
+int       httpd_send(httpd_req_t *req, const char *buf, size_t len);
+
+/* Host only: the address the server binds to (wifi_manager_get_ip()) */
+extern const char *host_httpd_bind_addr;
@@ -0,0 +1,10 @@
+/* Host shim: ESP_LOGx to stderr */
+#pragma once
+#include <stdio.h>
+
+#define ESP_LOG_HOST(level, tag, fmt, ...) \
+    fprintf(stderr, level " (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, fmt, ...) ESP_LOG_HOST("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_LOG_HOST("W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ESP_LOG_HOST("I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) ((void)0)
@@ -0,0 +1,14 @@
+/* Host shim: a partition is a file; the host harness implements the reads */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+    uint32_t    address;
+    uint32_t    size;
+    char        label[17];
+    int         fd;             /* host only: backing file */
+} esp_partition_t;
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset, void *dst, size_t len);
@@ -0,0 +1,10 @@
+/* Host shim: fixed-size copy queues; timeouts are 0 or portMAX_DELAY */
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t    xQueueSend(QueueHandle_t q, const void *item, TickType_t wait);
+BaseType_t    xQueueReceive(QueueHandle_t q, void *item, TickType_t wait);
+void          vQueueDelete(QueueHandle_t q);
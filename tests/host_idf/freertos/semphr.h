@@ -0,0 +1,10 @@
+/* Host shim: a binary semaphore is a queue of one empty item, as in FreeRTOS */
+#pragma once
+#include "freertos/queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#define xSemaphoreCreateBinary()    xQueueCreate(1, 0)
+#define xSemaphoreGive(s)           xQueueSend((s), NULL, 0)
+#define xSemaphoreTake(s, wait)     xQueueReceive((s), NULL, (wait))
+#define vSemaphoreDelete(s)         vQueueDelete(s)
@@ -0,0 +1,11 @@
+/* Host shim: a task is a detached pthread; priorities are ignored */
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *arg);
+typedef void *TaskHandle_t;
+
+BaseType_t  xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size,
+                        void *arg, UBaseType_t priority, TaskHandle_t *handle);
+void        vTaskDelete(TaskHandle_t task);   /* NULL only: ends the calling thread */
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
@@ -0,0 +1,19 @@
+/* Host shim: an empty NVS, so compile-time defaults apply */
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+static inline esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *h)
+{
+    (void)ns; (void)mode; (void)h;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+static inline esp_err_t nvs_get_u8(nvs_handle_t h, const char *key, uint8_t *out)
+{
+    (void)h; (void)key; (void)out;
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+static inline void nvs_close(nvs_handle_t h) { (void)h; }
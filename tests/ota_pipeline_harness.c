@@ -0,0 +1,267 @@
+/**
+ * OTA Pipeline Harness
+ * Host build of ota_pipeline.c (unchanged) for test_ota_pipeline.py and
+ * bench_ota_pipeline.py. FreeRTOS queues and tasks run on pthreads; the
+ * receiver stands in for esp_http_client at a fixed link rate and the
+ * consumer for flash, sleeping an erase per new 4 KB sector and a program
+ * time per byte written:
+ *
+ *   ota_pipeline_harness <depth> <bytes> <read_us> <program_us> <erase_us> [fail_at]
+ *
+ * read_us and program_us are per 4096 bytes. The consumer rejects the
+ * chunk that takes it past fail_at (default: never). Reads are mostly
+ * full buffers with some short ones, as TCP delivers them, and one in
+ * sixteen waits out a Wi-Fi retry burst of three read times. Prints one
+ * line of key=value pairs: bytes received and consumed, an FNV-1a hash
+ * of each side's byte stream, whether the pipeline failed, and wall and
+ * consumer time in µs. Build with -I tests/host_idf and the firmware
+ * template directory.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "ota_pipeline.h"
+
+#define HARNESS_BUF_SIZE     4096    /* OTA_DOWNLOAD_BUF_SIZE */
+#define HARNESS_SECTOR_SIZE  4096    /* SPI_FLASH_SEC_SIZE    */
+
+/* ── FreeRTOS on pthreads ─────────────────────────────────────── */
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    size_t          item_size;
+    size_t          length;
+    size_t          head;
+    size_t          count;
+    uint8_t        *items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t q = calloc(1, sizeof(*q));
+    if (!q) return NULL;
+    q->items = calloc(length, item_size ? item_size : 1);
+    if (!q->items) {
+        free(q);
+        return NULL;
+    }
+    q->item_size = item_size;
+    q->length = length;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t wait)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->length && wait == portMAX_DELAY) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    BaseType_t ok = q->count < q->length;
+    if (ok) {
+        size_t tail = (q->head + q->count) % q->length;
+        if (q->item_size) memcpy(q->items + tail * q->item_size, item, q->item_size);
+        q->count++;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && wait == portMAX_DELAY) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    BaseType_t ok = q->count > 0;
+    if (ok) {
+        if (q->item_size) memcpy(item, q->items + q->head * q->item_size, q->item_size);
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    pthread_cond_destroy(&q->changed);
+    pthread_mutex_destroy(&q->lock);
+    free(q->items);
+    free(q);
+}
+
+typedef struct {
+    TaskFunction_t fn;
+    void          *arg;
+} host_task_t;
+
+static void *task_trampoline(void *arg)
+{
+    host_task_t task = *(host_task_t *)arg;
+    free(arg);
+    task.fn(task.arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size,
+                       void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+    (void)name; (void)priority;
+    host_task_t *task = malloc(sizeof(*task));
+    if (!task) return pdFALSE;
+    task->fn = fn;
+    task->arg = arg;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, stack_size < 16384 ? 16384 : stack_size);
+    int rc = pthread_create(&thread, &attr, task_trampoline, task);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        free(task);
+        return pdFALSE;
+    }
+    if (handle) *handle = NULL;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    (void)task;
+    pthread_exit(NULL);
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    (void)task;
+    return 0;
+}
+
+/* ── Simulated Link and Flash ─────────────────────────────────── */
+
+typedef struct {
+    int64_t  program_us;
+    int64_t  erase_us;
+    uint32_t fail_at;
+    uint32_t written;
+    uint32_t erased_to;
+    uint32_t hash;
+} sim_flash_t;
+
+static void sleep_us(int64_t us)
+{
+    if (us <= 0) return;
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) != 0) {}
+}
+
+static uint32_t fnv1a(uint32_t h, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static uint32_t xorshift(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+/* The writer's side: erase each sector on first touch, then program */
+static bool flash_consume(void *user, const uint8_t *data, size_t len)
+{
+    sim_flash_t *f = (sim_flash_t *)user;
+    if (f->written + len > f->fail_at) return false;
+    while (f->erased_to < f->written + len) {
+        sleep_us(f->erase_us);
+        f->erased_to += HARNESS_SECTOR_SIZE;
+    }
+    sleep_us(f->program_us * (int64_t)len / HARNESS_SECTOR_SIZE);
+    f->hash = fnv1a(f->hash, data, len);
+    f->written += (uint32_t)len;
+    return true;
+}
+
+/* The receiver's side: esp_http_client_read() at the link rate */
+static int link_read(uint8_t *dst, uint32_t remaining, int64_t read_us, uint32_t *rng)
+{
+    uint32_t len = xorshift(rng) % 8 == 0 ? 1 + xorshift(rng) % HARNESS_BUF_SIZE
+                                          : HARNESS_BUF_SIZE;
+    if (len > remaining) len = remaining;
+    for (uint32_t i = 0; i < len; i++) dst[i] = (uint8_t)xorshift(rng);
+    int64_t us = read_us * (int64_t)len / HARNESS_BUF_SIZE;
+    if (xorshift(rng) % 16 == 0) us += 3 * read_us;
+    sleep_us(us);
+    return (int)len;
+}
+
+/* ── Main ─────────────────────────────────────────────────────── */
+
+int main(int argc, char **argv)
+{
+    if (argc < 6) {
+        fprintf(stderr, "usage: %s <depth> <bytes> <read_us> <program_us> <erase_us> "
+                        "[fail_at]\n", argv[0]);
+        return 2;
+    }
+    int depth = atoi(argv[1]);
+    uint32_t bytes = (uint32_t)strtoul(argv[2], NULL, 10);
+    int64_t read_us = strtoll(argv[3], NULL, 10);
+    sim_flash_t flash = {
+        .program_us = strtoll(argv[4], NULL, 10),
+        .erase_us   = strtoll(argv[5], NULL, 10),
+        .fail_at    = argc > 6 ? (uint32_t)strtoul(argv[6], NULL, 10) : UINT32_MAX,
+        .hash       = 2166136261u,
+    };
+
+    ota_pipeline_t pipe;
+    if (!ota_pipeline_start(&pipe, depth, HARNESS_BUF_SIZE, flash_consume, &flash)) {
+        printf("started=0\n");
+        return 3;
+    }
+
+    /* Same loop shape as http_stream() */
+    uint32_t rng = 0x9e3779b9u;
+    uint32_t received = 0;
+    uint32_t sent_hash = 2166136261u;
+    ota_chunk_t chunk;
+    int64_t t0 = esp_timer_get_time();
+    while (!pipe.failed) {
+        ota_pipeline_acquire(&pipe, &chunk);
+        chunk.len = link_read(chunk.data, bytes - received, read_us, &rng);
+        if (chunk.len > 0) sent_hash = fnv1a(sent_hash, chunk.data, chunk.len);
+        ota_pipeline_submit(&pipe, &chunk);
+        if (chunk.len <= 0) break;
+        received += (uint32_t)chunk.len;
+    }
+    ota_pipeline_stop(&pipe);
+    int64_t elapsed = esp_timer_get_time() - t0;
+
+    printf("started=1 received=%u consumed=%u sent_hash=%08x consumed_hash=%08x failed=%d "
+           "wall_us=%lld consume_us=%lld\n",
+           received, flash.written, sent_hash, flash.hash, pipe.failed,
+           (long long)elapsed, (long long)pipe.consume_us);
+    return 0;
+}
@@ -0,0 +1,248 @@
+/**
+ * Peer Cache Agent
+ * Host build of the agent's LAN cache (peer_cache.c, unchanged) for
+ * peer_cache_demo.py. esp_http_server runs over POSIX sockets, the
+ * "partition" is a file, and ota_manager / wifi_manager are reduced to
+ * what peer_cache.c asks of them:
+ *
+ *   peer_cache_agent <image> <sha256> <lan-ip>
+ *
+ * Prints the heartbeat advert ("<url> <blob>") once serving, then serves
+ * until stdin closes. Build with -I tests/host_idf and the firmware
+ * template directory.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "esp_http_server.h"
+#include "ota_manager.h"
+#include "wifi_manager.h"
+#include "peer_cache.h"
+
+#define HOST_HTTPD_MAX_HANDLERS  4
+#define HOST_HTTPD_HEAD_MAX      2048
+#define HOST_HTTPD_SNDBUF        8192    /* about lwIP's TCP_SND_BUF */
+
+const char *host_httpd_bind_addr = "127.0.0.1";
+
+static esp_partition_t s_part = { .label = "ota_host" };
+static char            s_hash[OTA_MAX_HASH_LEN];
+
+/* ── ota_manager / wifi_manager ───────────────────────────────── */
+
+bool ota_manager_verified_image(ota_verified_image_t *out)
+{
+    if (s_part.size == 0) return false;
+    out->partition = &s_part;
+    out->size = s_part.size;
+    snprintf(out->hash, sizeof(out->hash), "%s", s_hash);
+    return true;
+}
+
+bool wifi_manager_is_connected(void)
+{
+    return true;
+}
+
+const char *wifi_manager_get_ip(void)
+{
+    return host_httpd_bind_addr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset, void *dst, size_t len)
+{
+    return pread(part->fd, dst, len, (off_t)offset) == (ssize_t)len ? ESP_OK : ESP_FAIL;
+}
+
+/* ── esp_http_server over POSIX sockets ───────────────────────── */
+
+struct host_httpd {
+    int                    listen_fd;
+    pthread_t              thread;
+    httpd_uri_match_func_t match;
+    httpd_uri_t            handlers[HOST_HTTPD_MAX_HANDLERS];
+    int                    handler_count;
+};
+
+bool httpd_uri_match_wildcard(const char *tmpl, const char *uri, size_t len)
+{
+    size_t prefix = strcspn(tmpl, "*");
+    if (tmpl[prefix] != '*') return strlen(tmpl) == len && strncmp(tmpl, uri, len) == 0;
+    return len >= prefix && strncmp(tmpl, uri, prefix) == 0;
+}
+
+/* Read the request head; the blob endpoint takes no body */
+static bool read_head(int fd, char *head, size_t size)
+{
+    size_t n = 0;
+    while (n + 1 < size) {
+        ssize_t r = recv(fd, head + n, size - 1 - n, 0);
+        if (r <= 0) return false;
+        n += (size_t)r;
+        head[n] = '\0';
+        if (strstr(head, "\r\n\r\n")) return true;
+    }
+    return false;
+}
+
+static void serve_one(struct host_httpd *hd, int fd)
+{
+    char head[HOST_HTTPD_HEAD_MAX];
+    httpd_req_t req = { .handle = hd, .method = HTTP_GET, .fd = fd };
+    if (!read_head(fd, head, sizeof(head)) || strncmp(head, "GET ", 4) != 0) return;
+    size_t len = strcspn(head + 4, " \r\n");
+    if (len >= sizeof(req.uri)) return;
+    memcpy(req.uri, head + 4, len);
+    req.headers = strstr(head, "\r\n");
+
+    for (int i = 0; i < hd->handler_count; i++) {
+        if (hd->match(hd->handlers[i].uri, req.uri, len)) {
+            hd->handlers[i].handler(&req);
+            return;
+        }
+    }
+    httpd_resp_send_404(&req);
+}
+
+static void *httpd_loop(void *arg)
+{
+    struct host_httpd *hd = (struct host_httpd *)arg;
+    for (;;) {
+        int fd = accept(hd->listen_fd, NULL, NULL);
+        if (fd < 0) break;
+        int sndbuf = HOST_HTTPD_SNDBUF;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        serve_one(hd, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    struct host_httpd *hd = calloc(1, sizeof(*hd));
+    if (!hd) return ESP_ERR_NO_MEM;
+    hd->match = config->uri_match_fn;
+    hd->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(hd->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(config->server_port) };
+    inet_pton(AF_INET, host_httpd_bind_addr, &addr.sin_addr);
+    if (bind(hd->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(hd->listen_fd, config->max_open_sockets) != 0 ||
+        pthread_create(&hd->thread, NULL, httpd_loop, hd) != 0) {
+        close(hd->listen_fd);
+        free(hd);
+        return ESP_FAIL;
+    }
+    *handle = hd;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t hd)
+{
+    shutdown(hd->listen_fd, SHUT_RDWR);
+    pthread_join(hd->thread, NULL);
+    close(hd->listen_fd);
+    free(hd);
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t hd, const httpd_uri_t *uri)
+{
+    if (hd->handler_count == HOST_HTTPD_MAX_HANDLERS) return ESP_FAIL;
+    hd->handlers[hd->handler_count++] = *uri;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *req, const char *field, char *val, size_t size)
+{
+    size_t flen = strlen(field);
+    for (const char *line = req->headers; line && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, field, flen) == 0 && line[2 + flen] == ':') {
+            const char *v = line + 3 + flen;
+            v += strspn(v, " ");
+            size_t n = strcspn(v, "\r");
+            if (n >= size) return ESP_FAIL;
+            memcpy(val, v, n);
+            val[n] = '\0';
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+int httpd_send(httpd_req_t *req, const char *buf, size_t len)
+{
+    return (int)send(req->fd, buf, len, MSG_NOSIGNAL);
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status)
+{
+    req->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len)
+{
+    char head[128];
+    size_t body = buf ? (size_t)len : 0;
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Length: %zu\r\n\r\n",
+                     req->status ? req->status : "200 OK", body);
+    return httpd_send(req, head, n) == n && httpd_send(req, buf, body) == (int)body
+               ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpd_resp_send_404(httpd_req_t *req)
+{
+    httpd_resp_set_status(req, "404 Not Found");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+esp_err_t httpd_resp_send_500(httpd_req_t *req)
+{
+    httpd_resp_set_status(req, "500 Internal Server Error");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/* ── Main ─────────────────────────────────────────────────────── */
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s <image> <sha256> <lan-ip>\n", argv[0]);
+        return 2;
+    }
+    struct stat st;
+    s_part.fd = open(argv[1], O_RDONLY);
+    if (s_part.fd < 0 || fstat(s_part.fd, &st) != 0) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 2;
+    }
+    s_part.size = (uint32_t)st.st_size;
+    snprintf(s_hash, sizeof(s_hash), "%s", argv[2]);
+    host_httpd_bind_addr = argv[3];
+
+    char url[64], blob[OTA_MAX_HASH_LEN];
+    peer_cache_start();
+    if (!peer_cache_advert(url, sizeof(url), blob, sizeof(blob))) return 1;
+    printf("%s %s\n", url, blob);
+    fflush(stdout);
+
+    char c;
+    while (read(STDIN_FILENO, &c, 1) > 0) {}
+    peer_cache_stop();
+    close(s_part.fd);
+    return 0;
+}
@@ -0,0 +1,373 @@
+#!/usr/bin/env python3
+"""
+Linux demo of LAN peer caching with several agents and a local stand-in
+for the fleet server.
+
+Each agent's cache is the firmware's peer_cache.c, built for the host by
+peer_cache_agent.c and bound to its own loopback address (127.0.0.11,
+.12, ...) on PEER_CACHE_PORT. The rest of the agent is played by this
+script, following the firmware: a heartbeat carrying the cache advert,
+an OTA check, a 16 KB Range probe of every source, ranking by estimated
+time for the rest of the image, streaming from the best source, failing
+over by Range to the next one, and a SHA-256 check before the image is
+taken (and then shared).
+
+The stand-in server keeps the parts of server.py this exercises:
+site grouping by client address, peer_url validation (adverts that fail
+it are dropped and the heartbeat still succeeds), fresh same-site holders
+listed in a stable per-device order after the deployment's own sources,
+and the blob endpoint with Range. Its blob endpoint is throttled to a
+simulated WAN rate, so peers on the "LAN" win the probe. Unlike the real
+server it also takes loopback peer URLs, because every agent here lives
+on 127.0.0.0/8.
+
+    python3 tests/peer_cache_demo.py [--devices 5] [--image-kb 1024] [--wan-kbps 2048]
+
+The peer serving the fourth device is killed mid-download to show failover.
+"""
+
+import argparse
+import hashlib
+import http.client
+import ipaddress
+import json
+import os
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from pathlib import Path
+
+REPO_DIR = Path(__file__).resolve().parent.parent
+FIRMWARE_DIR = REPO_DIR / "backend" / "firmware_templates" / "esp32c3_fleet_agent"
+TESTS_DIR = Path(__file__).resolve().parent
+
+PEER_CACHE_PORT = 8070
+OTA_MAX_MIRRORS = 3
+OTA_MIRROR_PROBE_LEN = 16 * 1024
+OTA_MIRROR_MAX_FAILS = 3
+READ_SIZE = 4096
+
+_PEER_URL_RE = re.compile(r"http://(\d{1,3}(?:\.\d{1,3}){3}):(\d{1,5})")
+# server.py takes RFC1918 only; the demo's agents all sit on loopback
+_PEER_CACHE_NETS = [ipaddress.ip_network(n) for n in
+                    ("10.0.0.0/8", "172.16.0.0/12", "192.168.0.0/16", "127.0.0.0/8")]
+
+
+# ── Stand-in Server ──────────────────────────────────────────────
+
+class StandInServer:
+    def __init__(self, image: bytes, wan_bps: int):
+        self.image = image
+        self.blob = hashlib.sha256(image).hexdigest()
+        self.wan_bps = wan_bps
+        self.devices = {}           # device_id -> {"site": ..., "peer_cache": ...}
+        self.origin_bytes = 0
+        self.lock = threading.Lock()
+        self.httpd = ThreadingHTTPServer(("127.0.0.1", 0), self._handler())
+        self.url = f"http://127.0.0.1:{self.httpd.server_port}"
+        threading.Thread(target=self.httpd.serve_forever, daemon=True).start()
+
+    def stop(self):
+        self.httpd.shutdown()
+
+    def heartbeat(self, site: str, req: dict) -> dict:
+        peer = {"url": req.get("peer_url", ""), "blob": req.get("peer_blob", "").lower()}
+        if not (peer["url"] and peer["blob"]):
+            peer = None
+        elif not _valid_peer_url(peer["url"]):
+            print(f"  server: ignoring peer_url {peer['url']!r} from {req['device_id']}")
+            peer = None
+        with self.lock:
+            self.devices[req["device_id"]] = {"site": site, "peer_cache": peer}
+        return {"message": "ok"}
+
+    def check(self, req: dict) -> dict:
+        device_id = req["device_id"]
+        with self.lock:
+            me = self.devices.get(device_id, {})
+            holders = [d["peer_cache"]["url"] for did, d in self.devices.items()
+                       if did != device_id and d["site"] == me.get("site") and
+                       d["peer_cache"] and d["peer_cache"]["blob"] == self.blob]
+        holders.sort(key=lambda u: hashlib.sha256(f"{device_id}|{u}".encode()).digest())
+        return {
+            "update_available": True,
+            "artifact_hash": self.blob,
+            "artifact_size": len(self.image),
+            "blob_url": f"{self.url}/api/ota/blob/{self.blob}",
+            "mirrors": [f"{p}/api/ota/blob/{self.blob}" for p in holders[:OTA_MAX_MIRRORS]],
+        }
+
+    def _handler(self):
+        server = self
+
+        class Handler(BaseHTTPRequestHandler):
+            protocol_version = "HTTP/1.1"
+
+            def log_message(self, *args):
+                pass
+
+            def _json(self, body: dict):
+                data = json.dumps(body).encode()
+                self.send_response(200)
+                self.send_header("Content-Type", "application/json")
+                self.send_header("Content-Length", str(len(data)))
+                self.end_headers()
+                self.wfile.write(data)
+
+            def do_POST(self):
+                req = json.loads(self.rfile.read(int(self.headers["Content-Length"])))
+                if self.path == "/api/telemetry/heartbeat":
+                    self._json(server.heartbeat(self.client_address[0], req))
+                elif self.path == "/api/ota/check":
+                    self._json(server.check(req))
+                else:
+                    self.send_error(404)
+
+            def do_GET(self):
+                if self.path != f"/api/ota/blob/{server.blob}":
+                    self.send_error(404)
+                    return
+                size = len(server.image)
+                start, end = 0, size - 1
+                m = re.fullmatch(r"bytes=(\d+)-(\d*)", self.headers.get("Range", ""))
+                if m:
+                    start = int(m[1])
+                    end = min(int(m[2]), end) if m[2] else end
+                self.send_response(206 if m else 200)
+                self.send_header("Content-Length", str(end - start + 1))
+                self.send_header("Accept-Ranges", "bytes")
+                if m:
+                    self.send_header("Content-Range", f"bytes {start}-{end}/{size}")
+                self.end_headers()
+                time.sleep(0.04)   # WAN round trip
+                for off in range(start, end + 1, READ_SIZE):
+                    chunk = server.image[off:min(off + READ_SIZE, end + 1)]
+                    time.sleep(len(chunk) / server.wan_bps)
+                    self.wfile.write(chunk)
+                    with server.lock:
+                        server.origin_bytes += len(chunk)
+
+        return Handler
+
+
+def _valid_peer_url(url: str) -> bool:
+    m = _PEER_URL_RE.fullmatch(url)
+    if not m or not 0 < int(m[2]) < 65536:
+        return False
+    try:
+        ip = ipaddress.IPv4Address(m[1])
+    except ValueError:
+        return False
+    return any(ip in net for net in _PEER_CACHE_NETS)
+
+
+# ── Agent ────────────────────────────────────────────────────────
+
+def _post(base: str, path: str, body: dict):
+    """(status, JSON answer); all agents reach the server from one address, as behind NAT."""
+    host, port = base[len("http://"):].split(":")
+    conn = http.client.HTTPConnection(host, int(port), timeout=10)
+    conn.request("POST", path, json.dumps(body), {"Content-Type": "application/json"})
+    resp = conn.getresponse()
+    data = json.loads(resp.read())
+    conn.close()
+    return resp.status, data
+
+
+class DeviceConnection(http.client.HTTPConnection):
+    """A TCP receive window about the size of lwIP's (TCP_WND) on the device,
+    so a source that dies mid-stream leaves the download short."""
+
+    def connect(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 8192)
+        self.sock.settimeout(self.timeout)
+        self.sock.connect((self.host, self.port))
+
+
+def _get(url: str, start: int, end: int = None):
+    host, rest = url[len("http://"):].split("/", 1)
+    name, port = host.split(":")
+    conn = DeviceConnection(name, int(port), timeout=5)
+    rng = f"bytes={start}-" + ("" if end is None else str(end))
+    conn.request("GET", "/" + rest, headers={"Range": rng})
+    return conn, conn.getresponse()
+
+
+class Agent:
+    def __init__(self, device_id: str, lan_ip: str, binary: Path, workdir: Path):
+        self.device_id = device_id
+        self.lan_ip = lan_ip
+        self.binary = binary
+        self.image_path = workdir / f"{device_id}.bin"
+        self.cache = None
+        self.advert = ("", "")
+        self.sources_used = {}
+
+    def heartbeat(self, server: StandInServer):
+        url, blob = self.advert
+        _post(server.url, "/api/telemetry/heartbeat",
+              {"device_id": self.device_id, "peer_url": url, "peer_blob": blob})
+
+    def check(self, server: StandInServer) -> dict:
+        return _post(server.url, "/api/ota/check", {"device_id": self.device_id})[1]
+
+    def start_cache(self):
+        blob = hashlib.sha256(self.image_path.read_bytes()).hexdigest()
+        self.cache = subprocess.Popen([str(self.binary), str(self.image_path), blob, self.lan_ip],
+                                      stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                                      stderr=subprocess.DEVNULL, text=True)
+        self.advert = tuple(self.cache.stdout.readline().split())
+
+    def stop_cache(self, crash=False):
+        if not self.cache:
+            return
+        if crash:
+            self.cache.kill()
+        else:
+            self.cache.stdin.close()
+        self.cache.wait()
+        self.cache = None
+
+    def probe(self, url: str):
+        """(rtt s, bytes/s) from a 16 KB Range request; bps 0 = unusable."""
+        try:
+            t0 = time.monotonic()
+            conn, resp = _get(url, 0, OTA_MIRROR_PROBE_LEN - 1)
+            t1 = time.monotonic()
+            body = resp.read() if resp.status == 206 else b""
+            t2 = time.monotonic()
+            conn.close()
+        except OSError:
+            return 0.0, 0
+        bps = len(body) / (t2 - t1) if len(body) == OTA_MIRROR_PROBE_LEN and t2 > t1 else 0
+        return t1 - t0, bps
+
+    def download(self, answer: dict, on_progress=None) -> bytes:
+        sources = [answer["blob_url"], *answer["mirrors"]]
+        size = answer["artifact_size"]
+        if answer["mirrors"]:
+            stats = {u: self.probe(u) for u in sources}
+            cost = lambda u: (stats[u][0] + size / stats[u][1]) if stats[u][1] else float("inf")
+            sources.sort(key=cost)
+        fails = dict.fromkeys(sources, 0)
+        image = bytearray()
+        current = 0
+        while len(image) < size:
+            url = sources[current]
+            got = 0
+            try:
+                conn, resp = _get(url, len(image))
+                if resp.status not in (200, 206):
+                    raise OSError(f"HTTP {resp.status}")
+                while len(image) < size:
+                    chunk = resp.read(READ_SIZE)
+                    if not chunk:
+                        raise OSError("short body")
+                    image += chunk
+                    got += len(chunk)
+                    if on_progress:
+                        on_progress(url, got)
+                conn.close()
+            except (OSError, http.client.HTTPException) as exc:
+                fails[url] += 1
+                nxt = [i for i in range(1, len(sources) + 1)
+                       if fails[sources[(current + i) % len(sources)]] < OTA_MIRROR_MAX_FAILS]
+                if not nxt:
+                    raise
+                current = (current + nxt[0]) % len(sources)
+                print(f"  {self.device_id}: {_origin(url)} failed at {len(image)} bytes ({exc}); "
+                      f"resuming from {_origin(sources[current])}")
+            finally:
+                self.sources_used[_origin(url)] = self.sources_used.get(_origin(url), 0) + got
+        if hashlib.sha256(image).hexdigest() != answer["artifact_hash"]:
+            raise ValueError("image hash mismatch")
+        return bytes(image)
+
+
+def _origin(url: str) -> str:
+    return url.split("/api/")[0]
+
+
+# ── Main ─────────────────────────────────────────────────────────
+
+def build_agent(out: Path):
+    subprocess.run(["gcc", "-std=gnu11", "-Wall", "-Wextra", "-O1", "-DPEER_CACHE_ENABLED=1",
+                    f"-I{TESTS_DIR / 'host_idf'}", f"-I{FIRMWARE_DIR}", "-o", str(out),
+                    str(TESTS_DIR / "peer_cache_agent.c"), str(FIRMWARE_DIR / "peer_cache.c"),
+                    "-lpthread"], check=True)
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--devices", type=int, default=5)
+    ap.add_argument("--image-kb", type=int, default=1024)
+    ap.add_argument("--wan-kbps", type=int, default=2048)
+    args = ap.parse_args()
+    if not shutil.which("gcc") or sys.platform != "linux":
+        print("needs gcc on Linux", file=sys.stderr)
+        return 2
+
+    with tempfile.TemporaryDirectory() as tmp:
+        tmp = Path(tmp)
+        binary = tmp / "peer_cache_agent"
+        build_agent(binary)
+        image = os.urandom(args.image_kb * 1024)
+        server = StandInServer(image, args.wan_kbps * 1024)
+        agents = [Agent(f"dev-{i + 1}", f"127.0.0.{11 + i}", binary, tmp)
+                  for i in range(args.devices)]
+        print(f"server {server.url}, image {len(image)} bytes, WAN {args.wan_kbps} KB/s")
+
+        # An advert that fails validation is dropped, the heartbeat still counts
+        status, _ = _post(server.url, "/api/telemetry/heartbeat", {
+            "device_id": "rogue", "peer_url": "http://8.8.8.8:8070", "peer_blob": server.blob})
+        print(f"  rogue heartbeat answered {status}")
+
+        try:
+            for n, agent in enumerate(agents):
+                agent.heartbeat(server)
+                answer = agent.check(server)
+                killer = _crash_after(agents, 256 * 1024) if n == 3 else None
+                origin0 = server.origin_bytes
+                t0 = time.monotonic()
+                data = agent.download(answer, killer)
+                elapsed = time.monotonic() - t0
+                agent.image_path.write_bytes(data)
+                agent.start_cache()
+                agent.heartbeat(server)
+                used = ", ".join(f"{o} {b // 1024} KB" for o, b in agent.sources_used.items() if b)
+                print(f"{agent.device_id}: {len(answer['mirrors'])} peers offered, "
+                      f"{elapsed:.2f} s, origin {(server.origin_bytes - origin0) // 1024} KB "
+                      f"[{used}]")
+        finally:
+            for agent in agents:
+                agent.stop_cache()
+            server.stop()
+
+        total = len(image) * len(agents)
+        print(f"origin served {server.origin_bytes // 1024} KB of {total // 1024} KB "
+              f"delivered ({100 * server.origin_bytes / total:.0f}%), probes included")
+    return 0
+
+
+def _crash_after(agents, at: int):
+    """Progress hook that kills the serving peer's cache once `at` bytes came from it."""
+    done = []
+
+    def hook(url, got):
+        victim = next((a for a in agents if a.cache and url.startswith(a.advert[0] + "/")), None)
+        if victim and got >= at and not done:
+            print(f"  killing {victim.device_id}'s cache mid-stream")
+            victim.stop_cache(crash=True)
+            done.append(victim)
+    return hook
+
+
+if __name__ == "__main__":
+    sys.exit(main())
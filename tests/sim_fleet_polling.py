@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""
+Simulation of a fleet's heartbeat and OTA check traffic after a site power
+cut: every device boots at t=0 and the server is unreachable for the first
+--outage seconds. Compares the agent's polling before and after per-device
+phases, backoff and Retry-After, and the Retry-After stretch as first
+shipped against its current form:
+
+  before  timers count from boot (last_* = 0), so the first heartbeat and
+          check fall one interval after boot on every device; a failed
+          check retries one interval later
+  first   device_phase() offsets the first heartbeat / check into its
+          interval, a failed check waits next_backoff_ms(), and the server's
+          Retry-After (_poll_retry_after) stretches intervals under load by
+          last window's rate / target, the same for every device
+  after   as first, with the stretch scaled from its current value each
+          window and spread by POLL_STRETCH_JITTER per answer
+
+device_phase, next_backoff_ms, server_interval_ms and PollWindow below
+mirror main.c and server.py. Heartbeats and checks are independent
+streams and the update watch is off, as in the firmware with
+OTA_LONG_POLL_WAIT_S 0.
+
+    python3 tests/sim_fleet_polling.py [--devices 5000] [--minutes 30]
+        [--outage 120] [--seed 1]
+"""
+
+import argparse
+import heapq
+import random
+import sys
+
+HEARTBEAT_INTERVAL_MS = 30 * 1000
+OTA_CHECK_INTERVAL_MS = 60 * 1000
+OTA_CHECK_BACKOFF_MAX_MS = 30 * 60 * 1000
+RETRY_AFTER_MAX_S = 3600
+
+DEVICE_POLL_TARGET_RPS = 100.0
+POLL_WINDOW_S = 10
+POLL_STRETCH_MAX = 10
+POLL_STRETCH_JITTER = 0.2
+
+HEARTBEAT, CHECK = 0, 1
+
+
+# ─── main.c ─────────────────────────────────────────────────────────
+def device_phase(device_id: str, interval_ms: int) -> int:
+    h = 2166136261
+    for c in device_id.encode():
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return h % interval_ms
+
+
+def server_interval_ms(retry_after_s: int, default_ms: int) -> int:
+    if retry_after_s <= 0 or retry_after_s > RETRY_AFTER_MAX_S:
+        return default_ms
+    return retry_after_s * 1000
+
+
+def next_backoff_ms(ceiling_ms: int, rng: random.Random):
+    """Returns (delay, new ceiling)."""
+    ceiling_ms = ceiling_ms * 2 if ceiling_ms else OTA_CHECK_INTERVAL_MS * 2
+    ceiling_ms = min(ceiling_ms, OTA_CHECK_BACKOFF_MAX_MS)
+    return ceiling_ms // 2 + rng.randrange(ceiling_ms // 2), ceiling_ms
+
+
+# ─── server.py ──────────────────────────────────────────────────────
+class PollWindow:
+    def __init__(self, rng: random.Random):
+        self.rng = rng
+        self.start, self.count, self.stretch = 0.0, 0, 1.0
+
+    def retry_after(self, now: float, base_s: int) -> int:
+        if now - self.start >= POLL_WINDOW_S:
+            elapsed = now - self.start
+            rate = self.count / elapsed if elapsed < 2 * POLL_WINDOW_S else 0.0
+            stretch = self.stretch * rate / DEVICE_POLL_TARGET_RPS
+            self.stretch = min(max(stretch, 1.0), POLL_STRETCH_MAX)
+            self.start, self.count = now, 0
+        self.count += 1
+        stretch = self.stretch
+        if stretch > 1.0:
+            stretch = max(stretch * self.rng.uniform(1 - POLL_STRETCH_JITTER,
+                                                     1 + POLL_STRETCH_JITTER), 1.0)
+        return round(base_s * stretch)
+
+
+class FirstPollWindow(PollWindow):
+    """As first shipped: stretch = last window's rate / target, same for all."""
+
+    def retry_after(self, now: float, base_s: int) -> int:
+        if now - self.start >= POLL_WINDOW_S:
+            elapsed = now - self.start
+            rate = self.count / elapsed if elapsed < 2 * POLL_WINDOW_S else 0.0
+            self.stretch = min(max(rate / DEVICE_POLL_TARGET_RPS, 1.0), POLL_STRETCH_MAX)
+            self.start, self.count = now, 0
+        self.count += 1
+        return round(base_s * self.stretch)
+
+
+# ─── Fleet ──────────────────────────────────────────────────────────
+def simulate(args, spread: bool, window_type=PollWindow):
+    rng = random.Random(args.seed)
+    end = args.minutes * 60
+    per_second = [0] * (end + 1)
+    window = window_type(random.Random(args.seed + 1))
+    events = []   # (time s, device index, kind)
+    backoff = [0] * args.devices
+
+    for i in range(args.devices):
+        device_id = f"esp32c3-{i:06d}"
+        boot = rng.uniform(0, 1)
+        wifi_up = boot + rng.uniform(2, 6)
+        if spread:
+            hb = wifi_up + device_phase(device_id, HEARTBEAT_INTERVAL_MS) / 1000
+            ck = wifi_up + device_phase(device_id, OTA_CHECK_INTERVAL_MS) / 1000
+        else:
+            hb = max(wifi_up, boot + HEARTBEAT_INTERVAL_MS / 1000)
+            ck = max(wifi_up, boot + OTA_CHECK_INTERVAL_MS / 1000)
+        events += [(hb, i, HEARTBEAT), (ck, i, CHECK)]
+    heapq.heapify(events)
+
+    while events:
+        t, i, kind = heapq.heappop(events)
+        if t > end:
+            break
+        per_second[int(t)] += 1
+        ok = t >= args.outage
+        base_ms = HEARTBEAT_INTERVAL_MS if kind == HEARTBEAT else OTA_CHECK_INTERVAL_MS
+        if not spread:
+            next_ms = base_ms
+        elif not ok:
+            if kind == CHECK:
+                next_ms, backoff[i] = next_backoff_ms(backoff[i], rng)
+            else:
+                next_ms = base_ms
+        else:
+            if kind == CHECK:
+                backoff[i] = 0
+            next_ms = server_interval_ms(window.retry_after(t, base_ms // 1000), base_ms)
+        heapq.heappush(events, (t + next_ms / 1000, i, kind))
+    return per_second
+
+
+def summarize(per_second, outage):
+    after = per_second[outage:outage + 120]
+    steady = per_second[-300:]
+    return {
+        "peak": max(per_second),
+        "p99": sorted(per_second)[int(0.99 * len(per_second))],
+        "peak_recovery": max(after) if after else 0,
+        "steady": sum(steady) / len(steady),
+        "over_2x": sum(1 for n in per_second if n > 2 * DEVICE_POLL_TARGET_RPS),
+        "total": sum(per_second),
+    }
+
+
+def main() -> int:
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--devices", type=int, default=5000)
+    ap.add_argument("--minutes", type=int, default=30)
+    ap.add_argument("--outage", type=int, default=120, help="seconds the server is down after t=0")
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    print(f"{args.devices} devices, {args.minutes} min, server down for {args.outage} s, "
+          f"target {DEVICE_POLL_TARGET_RPS:.0f} req/s")
+    print(f"{'agent':<8}{'peak req/s':>11}{'p99 req/s':>11}{'peak after outage':>19}"
+          f"{'steady req/s':>14}{'s over 2x target':>18}{'requests':>10}")
+    for label, spread, window_type in (("before", False, PollWindow),
+                                       ("first", True, FirstPollWindow),
+                                       ("after", True, PollWindow)):
+        s = summarize(simulate(args, spread, window_type), args.outage)
+        print(f"{label:<8}{s['peak']:>11}{s['p99']:>11}{s['peak_recovery']:>19}"
+              f"{s['steady']:>14.0f}{s['over_2x']:>18}{s['total']:>10}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
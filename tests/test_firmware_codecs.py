@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+Host tests for the agent's stream decoders (lzss_stream.c, delta_patch.c,
+json_stream.c). firmware_codec_harness.c is built with gcc against the
+firmware template sources and fed build_service.py's output in chunks of
+1, 7 and 4096 bytes; every split must decode to the same bytes.
+"""
+
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+from pathlib import Path
+
+REPO_DIR = Path(__file__).resolve().parent.parent
+BACKEND_DIR = REPO_DIR / "backend"
+FIRMWARE_DIR = BACKEND_DIR / "firmware_templates" / "esp32c3_fleet_agent"
+HARNESS_SRC = Path(__file__).resolve().parent / "firmware_codec_harness.c"
+
+sys.path.insert(0, str(BACKEND_DIR))
+from build_service import _lzss_compress, _make_delta_patch  # noqa: E402
+
+CHUNK_SIZES = (1, 7, 4096)
+JSON_STREAM_MAX_VALUE = 384
+JSON_STREAM_MAX_DEPTH = 6
+JSON_STREAM_MAX_KEY = 32
+
+
+def _firmware_like(rng: random.Random, size: int) -> bytes:
+    """Runs of code-like repetition mixed with incompressible bytes."""
+    out = bytearray()
+    while len(out) < size:
+        if rng.random() < 0.5:
+            out += bytes(rng.getrandbits(8) for _ in range(rng.randrange(16, 256)))
+        else:
+            word = bytes(rng.getrandbits(8) for _ in range(rng.choice((2, 4, 8))))
+            out += word * rng.randrange(4, 64)
+    return bytes(out[:size])
+
+
+def _edited(rng: random.Random, base: bytes) -> bytes:
+    """`base` with replaced, inserted and deleted spans and a moved block."""
+    data = bytearray(base)
+    for _ in range(40):
+        at = rng.randrange(len(data))
+        data[at:at + rng.randrange(0, 48)] = bytes(rng.getrandbits(8) for _ in range(rng.randrange(0, 48)))
+    start = rng.randrange(len(data) // 2)
+    block = data[start:start + 4096]
+    del data[start:start + 4096]
+    data[len(data) // 2:len(data) // 2] = block
+    return bytes(data)
+
+
+class FirmwareCodecTests(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        if not shutil.which("gcc"):
+            raise unittest.SkipTest("gcc not available")
+        cls.tmp = tempfile.TemporaryDirectory()
+        cls.harness = Path(cls.tmp.name) / "firmware_codec_harness"
+        subprocess.run(
+            ["gcc", "-std=c11", "-Wall", "-Wextra", "-Wpedantic", "-Werror", "-O1",
+             f"-I{FIRMWARE_DIR}", "-o", str(cls.harness), str(HARNESS_SRC),
+             str(FIRMWARE_DIR / "lzss_stream.c"), str(FIRMWARE_DIR / "delta_patch.c"),
+             str(FIRMWARE_DIR / "json_stream.c")],
+            check=True,
+        )
+        rng = random.Random(20241016)
+        cls.base = _firmware_like(rng, 96 * 1024)
+        cls.target = _edited(rng, cls.base)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.tmp.cleanup()
+
+    def run_harness(self, mode, chunk, data, *args):
+        result = subprocess.run([str(self.harness), mode, str(chunk), *args],
+                                input=data, capture_output=True)
+        self.assertIn(result.returncode, (0, 1), result.stderr.decode())
+        return result.returncode == 0, result.stdout
+
+    # ── LZSS ───────────────────────────────────────────────────────
+
+    def test_lzss_round_trip(self):
+        for data in (self.target, b"", b"\x00" * 5000, bytes(range(256)) * 3):
+            compressed = _lzss_compress(data)
+            for chunk in CHUNK_SIZES:
+                with self.subTest(size=len(data), chunk=chunk):
+                    ok, out = self.run_harness("lzss", chunk, compressed)
+                    self.assertTrue(ok)
+                    self.assertEqual(out, data)
+
+    # ── Delta patches ──────────────────────────────────────────────
+
+    def apply_patch(self, base, patch, chunk):
+        with tempfile.NamedTemporaryFile(dir=self.tmp.name) as f:
+            f.write(base)
+            f.flush()
+            return self.run_harness("delta", chunk, patch, f.name)
+
+    def test_delta_round_trip(self):
+        unrelated = _firmware_like(random.Random(7), 20 * 1024)
+        cases = (
+            (self.base, self.target),
+            (self.base, self.base),
+            (self.base, unrelated),
+            (self.target, self.target[: len(self.target) // 3]),
+        )
+        for base, target in cases:
+            patch = _lzss_compress(_make_delta_patch(base, target))
+            for chunk in CHUNK_SIZES:
+                with self.subTest(target=len(target), chunk=chunk):
+                    ok, out = self.apply_patch(base, patch, chunk)
+                    self.assertTrue(ok)
+                    self.assertEqual(out, target)
+
+    def test_delta_rejects_truncated_patch(self):
+        raw = _make_delta_patch(self.base, self.target)
+        ok, _ = self.apply_patch(self.base, _lzss_compress(raw[:-1]), 4096)
+        self.assertFalse(ok)
+
+    def test_delta_rejects_wrong_base_size(self):
+        patch = _lzss_compress(_make_delta_patch(self.base, self.target))
+        ok, _ = self.apply_patch(self.base[:-1], patch, 4096)
+        self.assertFalse(ok)
+
+    # ── JSON ───────────────────────────────────────────────────────
+
+    def parse_json(self, doc, chunk=4096):
+        ok, out = self.run_harness("json", chunk, doc.encode())
+        return ok, [line.split("\t") for line in out.decode().splitlines()]
+
+    def test_json_events_independent_of_chunking(self):
+        doc = ('{"update_available": true, "version": "1.2.3", "artifact_size": 1048576,'
+               ' "mirrors": ["http://10.0.0.2:8070", "https://cdn.example.com/a\\/b"],'
+               ' "chunks": {"size": 65536, "root": null}, "note": "caf\\u00e9 \\"x\\"",'
+               ' "rate": -1.5e3, "paused": false}')
+        ok, events = self.parse_json(doc)
+        self.assertTrue(ok)
+        self.assertIn(["1", "version", "0", "string", "1.2.3"], events)
+        self.assertIn(["1", "artifact_size", "0", "number", "1048576"], events)
+        self.assertIn(["2", "", "1", "string", "https://cdn.example.com/a/b"], events)
+        self.assertIn(["2", "root", "0", "null", "null"], events)
+        self.assertIn(["1", "rate", "0", "number", "-1.5e3"], events)
+        self.assertIn(["1", "note", "0", "string", 'café "x"'], events)
+        for chunk in CHUNK_SIZES:
+            with self.subTest(chunk=chunk):
+                self.assertEqual(self.parse_json(doc, chunk), (True, events))
+
+    def test_json_value_length_limit(self):
+        longest = "x" * (JSON_STREAM_MAX_VALUE - 1)
+        for chunk in CHUNK_SIZES:
+            with self.subTest(chunk=chunk):
+                ok, events = self.parse_json('{"sig": "%s"}' % longest, chunk)
+                self.assertTrue(ok)
+                self.assertIn(["1", "sig", "0", "string", longest], events)
+                ok, _ = self.parse_json('{"sig": "%sx"}' % longest, chunk)
+                self.assertFalse(ok)
+                ok, _ = self.parse_json('{"n": %s}' % ("1" * JSON_STREAM_MAX_VALUE), chunk)
+                self.assertFalse(ok)
+
+    def test_json_long_keys_are_truncated(self):
+        key = "k" * (JSON_STREAM_MAX_KEY + 10)
+        ok, events = self.parse_json('{"%s": 1}' % key)
+        self.assertTrue(ok)
+        self.assertIn(["1", key[:JSON_STREAM_MAX_KEY - 1], "0", "number", "1"], events)
+
+    def test_json_depth_limit(self):
+        def nested(depth):
+            return "[" * depth + "]" * depth
+        self.assertTrue(self.parse_json(nested(JSON_STREAM_MAX_DEPTH))[0])
+        self.assertFalse(self.parse_json(nested(JSON_STREAM_MAX_DEPTH + 1))[0])
+
+    def test_json_rejects_malformed_documents(self):
+        for doc in ('{"a": 1', '{"a" 1}', '{"a": 1} x', '[1,]', '{"a": tru}', '"\x01"', ""):
+            with self.subTest(doc=doc):
+                self.assertFalse(self.parse_json(doc, 1)[0])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""
+Host tests for the agent's download pipeline (ota_pipeline.c): the
+writer task and the free/full buffer queues between it and the receiver.
+ota_pipeline_harness.c is built with gcc against the firmware template
+source and FreeRTOS shims on pthreads.
+"""
+
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+from pathlib import Path
+
+TESTS_DIR = Path(__file__).resolve().parent
+FIRMWARE_DIR = TESTS_DIR.parent / "backend" / "firmware_templates" / "esp32c3_fleet_agent"
+HARNESS_SRC = TESTS_DIR / "ota_pipeline_harness.c"
+
+BUF_SIZE = 4096
+MAX_DEPTH = 4
+
+
+class OtaPipelineTests(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        if not shutil.which("gcc") or sys.platform != "linux":
+            raise unittest.SkipTest("needs gcc on Linux")
+        cls.tmp = tempfile.TemporaryDirectory()
+        cls.harness = Path(cls.tmp.name) / "ota_pipeline_harness"
+        subprocess.run(
+            ["gcc", "-std=gnu11", "-Wall", "-Wextra", "-Werror", "-O1",
+             f"-I{TESTS_DIR / 'host_idf'}", f"-I{FIRMWARE_DIR}", "-o", str(cls.harness),
+             str(HARNESS_SRC), str(FIRMWARE_DIR / "ota_pipeline.c"), "-lpthread"],
+            check=True,
+        )
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.tmp.cleanup()
+
+    def run_harness(self, depth, size, read_us=0, program_us=0, erase_us=0, fail_at=None):
+        args = [str(self.harness), str(depth), str(size), str(read_us), str(program_us),
+                str(erase_us)]
+        if fail_at is not None:
+            args.append(str(fail_at))
+        # A deadlocked queue hangs the harness instead of failing it
+        result = subprocess.run(args, capture_output=True, text=True, timeout=30)
+        fields = dict(kv.split("=") for kv in result.stdout.split())
+        return result.returncode, fields
+
+    def test_stream_arrives_whole_and_in_order(self):
+        for depth in range(1, MAX_DEPTH + 1):
+            with self.subTest(depth=depth):
+                rc, f = self.run_harness(depth, 300_001)
+                self.assertEqual(rc, 0)
+                self.assertEqual(f["failed"], "0")
+                self.assertEqual(f["received"], "300001")
+                self.assertEqual(f["consumed"], "300001")
+                self.assertEqual(f["consumed_hash"], f["sent_hash"])
+
+    def test_consumer_failure_stops_the_receiver(self):
+        for depth in range(1, MAX_DEPTH + 1):
+            with self.subTest(depth=depth):
+                rc, f = self.run_harness(depth, 1 << 20, fail_at=100_000)
+                self.assertEqual(rc, 0)
+                self.assertEqual(f["failed"], "1")
+                consumed, received = int(f["consumed"]), int(f["received"])
+                self.assertLessEqual(consumed, 100_000)
+                # At most the buffers in flight were read past the failure
+                self.assertLessEqual(received - consumed, (depth + 1) * BUF_SIZE)
+
+    def test_failure_on_first_chunk(self):
+        rc, f = self.run_harness(1, 64 * 1024, fail_at=0)
+        self.assertEqual(rc, 0)
+        self.assertEqual(f["failed"], "1")
+        self.assertEqual(f["consumed"], "0")
+
+    def test_empty_stream(self):
+        rc, f = self.run_harness(3, 0)
+        self.assertEqual(rc, 0)
+        self.assertEqual((f["received"], f["consumed"], f["failed"]), ("0", "0", "0"))
+
+    def test_depth_out_of_range_is_refused(self):
+        for depth in (0, MAX_DEPTH + 1):
+            with self.subTest(depth=depth):
+                rc, f = self.run_harness(depth, 4096)
+                self.assertEqual(rc, 3)
+                self.assertEqual(f["started"], "0")
+
+    def test_receive_overlaps_flash_writes(self):
+        # 2 ms per 4 KB on each side: depth 1 runs them back to back
+        _, serial = self.run_harness(1, 128 * 1024, read_us=2000, program_us=2000)
+        _, piped = self.run_harness(3, 128 * 1024, read_us=2000, program_us=2000)
+        self.assertEqual(piped["consumed_hash"], piped["sent_hash"])
+        self.assertLess(int(piped["wall_us"]), 0.8 * int(serial["wall_us"]))
+
+
+if __name__ == "__main__":
+    unittest.main()